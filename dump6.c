@@ -1,44 +1,77 @@
 #include "mec_mr3.h"
+#include "mec_mr3_cache.h"
 
+#include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
 
-static size_t file_size(const char *filename) {
+static long file_size(const char *filename) {
   FILE *f = fopen(filename, "rb");
-  fseek(f, 0, SEEK_END);
-  long fsize = ftell(f);
+  if (!f)
+    return -1;
+  long fsize = -1;
+  if (fseek(f, 0, SEEK_END) == 0)
+    fsize = ftell(f);
   fclose(f);
   return fsize;
 }
 
-int main(int argc, char *argv[]) {
-  if (argc < 3) {
-    fprintf(stderr, "missing arg\n");
-    return 1;
+// cache is NULL for a single file
+static bool dump(const char *infilename, const char *outfilename,
+                 struct mec_mr3_cache *cache) {
+  const long fsize = file_size(infilename);
+  FILE *in = fsize < 0 ? NULL : fopen(infilename, "rb");
+  if (!in) {
+    fprintf(stderr, "could not read %s\n", infilename);
+    return false;
   }
-  const char *infilename = argv[1];
-  const char *outfilename = argv[2];
-
-  size_t buf_len = file_size(infilename);
+  size_t buf_len = fsize;
   size_t n;
 
-  FILE *in = fopen(infilename, "rb");
-  void *inbuffer = malloc(buf_len);
-  void *outbuffer = malloc(buf_len);
+  // one more byte, malloc(0) may return NULL for an empty file:
+  void *inbuffer = malloc(buf_len + 1);
+  void *outbuffer = malloc(buf_len + 1);
+  if (!inbuffer || !outbuffer) {
+    fprintf(stderr, "out of memory reading %s\n", infilename);
+    fclose(in);
+    free(inbuffer);
+    free(outbuffer);
+    return false;
+  }
   n = fread(inbuffer, 1, buf_len, in);
   fclose(in);
-  int ret = 1;
-  if (n == buf_len) {
-    outbuffer = mec_mr3_memcpy(outbuffer, inbuffer, buf_len);
-    if (outbuffer) {
-      FILE *out = fopen(outfilename, "wb");
+  bool good = false;
+  if (n == buf_len &&
+      (cache ? mec_mr3_scrub_cached(cache, outbuffer, inbuffer, buf_len)
+             : mec_mr3_memcpy(outbuffer, inbuffer, buf_len) != NULL)) {
+    FILE *out = fopen(outfilename, "wb");
+    if (out) {
       n = fwrite(outbuffer, 1, buf_len, out);
-      fclose(out);
-      ret = n == buf_len ? 0 : 1;
+      good = fclose(out) == 0 && n == buf_len;
     }
   }
   free(inbuffer);
   free(outbuffer);
 
+  return good;
+}
+
+int main(int argc, char *argv[]) {
+  // dump6 in1 out1 [in2 out2...]
+  if (argc < 3 || argc % 2 == 0) {
+    fprintf(stderr, "missing arg\n");
+    return 1;
+  }
+  // slices of a series mostly carry the very same blob:
+  struct mec_mr3_cache *cache =
+      argc > 3 ? mec_mr3_cache_create(64 * 1024 * 1024, NULL) : NULL;
+  int ret = 0;
+  int i;
+  for (i = 1; i + 1 < argc; i += 2) {
+    if (!dump(argv[i], argv[i + 1], cache))
+      ret = 1;
+  }
+  mec_mr3_cache_free(cache);
+
   return ret;
 }
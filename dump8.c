@@ -1,7 +1,10 @@
+#include "mec_mr3.h"
 #include "mec_mr3_io.h"
+#include "mec_mr3_sink.h"
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 
 static size_t file_size(const char *filename) {
   FILE *f = fopen(filename, "rb");
@@ -12,11 +15,20 @@ static size_t file_size(const char *filename) {
 }
 
 int main(int argc, char *argv[]) {
-  if (argc < 2) {
+  enum mec_mr3_print_mode mode = MEC_MR3_PRINT_TEXT;
+  int arg = 1;
+  if (arg < argc && strcmp(argv[arg], "--ndjson") == 0) {
+    mode = MEC_MR3_PRINT_NDJSON;
+    ++arg;
+  } else if (arg < argc && strcmp(argv[arg], "--ndjson-blob") == 0) {
+    mode = MEC_MR3_PRINT_NDJSON_BLOB;
+    ++arg;
+  }
+  if (arg >= argc) {
     fprintf(stderr, "missing arg\n");
     return 1;
   }
-  const char *infilename = argv[1];
+  const char *infilename = argv[arg];
 
   size_t buf_len = file_size(infilename);
   size_t n;
@@ -27,7 +39,9 @@ int main(int argc, char *argv[]) {
   fclose(in);
   int ret = 0;
   if (n == buf_len) {
-    if (!mec_mr3_print(inbuffer, buf_len)) {
+    struct mec_mr3_sink sink;
+    mec_mr3_sink_file(&sink, stdout);
+    if (!mec_mr3_print_as(inbuffer, buf_len, &sink, mode)) {
       ret = 1;
     }
   }
@@ -11,432 +11,535 @@
      PURPOSE.  See the above copyright notice for more information.
 
 =========================================================================*/
+#include "mec_mr3.h"
+
+#include "mec_mr3_cursor.h"
+#include "mec_mr3_hash.h"
+#include "mec_mr3_payload.h"
+#include "mec_mr3_policy.h"
+#include "mec_mr3_private.h"
+#include "mec_mr3_uid.h"
 
 #include <assert.h>
 #include <stdbool.h>
 #include <stddef.h>
+#include <stdatomic.h>
 #include <stdint.h>
-#include <stdlib.h> /* realloc */
+#include <stdlib.h> /* malloc */
 #include <string.h> /* memcpy */
 
-struct stream {
-  const void *start;
-  const void *end;
-  void *cur;
-  size_t (*read)(void *ptr, size_t size, size_t nmemb, struct stream *in);
-  size_t (*write)(const void *ptr, size_t size, size_t nmemb,
-                  struct stream *outstream);
-};
+// number of heap allocations performed by the library
+static atomic_size_t allocations;
 
-static size_t stream_read(void *ptr, size_t size, size_t nmemb,
-                          struct stream *in) {
-  char *cur = (char *)in->cur;
-  const char *end = (const char *)in->end;
-  const size_t len = size * nmemb;
-  if (cur + len <= end) {
-    memcpy(ptr, cur, len);
-    in->cur = cur + len;
-  } else {
-    in->cur = NULL;
-    return 0;
-  }
-  return nmemb;
-}
-
-static size_t stream_write(const void *ptr, size_t size, size_t nmemb,
-                           struct stream *out) {
-  char *cur = (char *)out->cur;
-  const char *end = (const char *)out->end;
-  const size_t len = size * nmemb;
-  if (cur + len <= end) {
-    memcpy(cur, ptr, len);
-    out->cur = cur + len;
-  } else {
-    out->cur = NULL;
-    return 0;
-  }
-  return nmemb;
+void *mec_mr3_malloc(size_t size) {
+  atomic_fetch_add_explicit(&allocations, 1, memory_order_relaxed);
+  return malloc(size);
+}
+
+void *mec_mr3_calloc(size_t nmemb, size_t size) {
+  atomic_fetch_add_explicit(&allocations, 1, memory_order_relaxed);
+  return calloc(nmemb, size);
+}
+
+void *mec_mr3_realloc(void *ptr, size_t size) {
+  atomic_fetch_add_explicit(&allocations, 1, memory_order_relaxed);
+  return realloc(ptr, size);
+}
+
+size_t mec_mr3_allocations(void) {
+  return atomic_load_explicit(&allocations, memory_order_relaxed);
 }
 
 struct app {
-  struct stream *in;
-  struct stream *out;
+  const struct mec_mr3_options *options;
+  const struct mec_mr3_policy *policy;
+  struct mec_mr3_spans spans;
 };
 
-static struct app *create_app(struct app *self, struct stream *in,
-                              struct stream *out) {
-  self->in = in;
-  self->out = out;
+static struct app *create_app(struct app *self,
+                              const struct mec_mr3_options *options) {
+  self->options = options;
+  self->policy = options && options->policy ? options->policy
+                                            : mec_mr3_policy_default();
+  self->spans.n = 0;
 
   return self;
 }
 
-static void setup_buffer(struct app *self, void *output, const void *input,
-                         size_t len) {
-  self->in->cur = (char *)input;
-  self->in->start = input;
-  self->in->end = (char *)input + len;
-  self->in->read = stream_read;
-  self->out->cur = output;
-  self->out->start = output;
-  self->out->end = (char *)output + len;
-  self->out->write = stream_write;
-}
-
 #define ERROR_RETURN(X, Y)                                                     \
   if ((X) != (Y))                                                              \
   return false
 
-static size_t fread_mirror(void *ptr, size_t size, size_t nmemb,
-                           struct app *self) {
-  struct stream *instream = self->in;
-  struct stream *outstream = self->out;
+// uncomment the following to validate the parser:
+//#define NOOP
 
-  size_t s = instream->read(ptr, size, nmemb, instream);
-  if (s == nmemb) {
-    s = outstream->write(ptr, size, nmemb, outstream);
-    if (s == nmemb)
-      return nmemb;
+// replace the len bytes of str with a token of the same length, derived from
+// seed, the keyed hash of str, so that a given string always maps to the same
+// token. Each block (seed, counter) gives 12 characters, the blocks of a field
+// are hashed together by mec_mr3_siphash_counter.
+static void hash_buffer(char *str, size_t len, const unsigned char *key,
+                        uint64_t seed) {
+  static const char alphabet[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZ234567";
+  enum { BLOCKS = 24 }; // 288 characters, a buf3 in one call
+  uint64_t bits[BLOCKS];
+  uint64_t counter = 0;
+  size_t i = 0;
+  while (i < len) {
+    size_t n = (len - i + 11) / 12;
+    n = n < BLOCKS ? n : BLOCKS;
+    mec_mr3_siphash_counter(key, seed, counter, n, bits);
+    counter += n;
+    size_t k;
+    for (k = 0; k < n; ++k) {
+      uint64_t v = bits[k];
+      int b;
+      for (b = 0; b < 12 && i < len; ++b, v >>= 5)
+        str[i++] = alphabet[v & 31];
+    }
   }
-  return 0;
 }
 
-// uncomment the following to validate the parser:
-//#define NOOP
-
-static inline void clean_buffer(char *str, size_t buf_len) {
+// seed: keyed hash of the string, only used by MEC_MR3_HASH
+static inline void clean_buffer(char *str, size_t buf_len, uint8_t action,
+                                const struct mec_mr3_options *options,
+                                uint64_t seed) {
 #ifndef NOOP
-  size_t i;
-  const size_t len = strnlen(str, buf_len);
-  for (i = 0; i < len; ++i) {
-    str[i] = ' ';
+  if (action & MEC_MR3_REMOVE) {
+    memset(str, 0, buf_len);
+    return;
+  }
+  if (action & MEC_MR3_HASH) {
+    hash_buffer(str, strnlen(str, buf_len), options->hash_key, seed);
+    return;
   }
+  if (action & MEC_MR3_SHIFT) {
+    mec_mr3_datetime_shift(str, buf_len, options ? options->date_shift : 0);
+    return;
+  }
+  mec_mr3_blank(str, buf_len);
 #endif
 }
 
-struct buffer19 {
-  char sig1[0x3];
-  unsigned char len2;
-  char sig2;
-  unsigned char len3;
-  char sig3;
-  char iso[0x9];
-  char sig4;
-  unsigned char len4;
-  char sig5;
-};
+// number of bytes clean_buffer is about to modify
+static inline uint32_t modified_len(const char *str, size_t buf_len,
+                                    uint8_t action,
+                                    const struct mec_mr3_options *options) {
+  if (action & MEC_MR3_REMOVE)
+    return (uint32_t)buf_len;
+  if (!(action & MEC_MR3_HASH) && (action & MEC_MR3_SHIFT))
+    return options && options->date_shift ? MEC_MR3_DATE_LEN : 0;
+  return (uint32_t)strnlen(str, buf_len);
+}
 
-static size_t fread_mirror_clean_iso(void *ptr, size_t size, size_t nmemb,
-                                     struct app *self) {
-  struct stream *instream = self->in;
-  struct stream *outstream = self->out;
-
-  size_t s = instream->read(ptr, size, nmemb, instream);
-  if (s == nmemb) {
-    static const char magic[] = {0xdf, 0xff, 0x79};
-    if (nmemb >= sizeof magic && memcmp(ptr, magic, sizeof(magic)) == 0) {
-      // iso
-      struct buffer19 b19;
-      if (nmemb < sizeof b19)
-        return 0;
-      memcpy(&b19, ptr, sizeof b19);
-      if (b19.sig2 != 0x1 || b19.sig3 != 0x0 || b19.sig4 != 0x2 ||
-          b19.sig5 != 0x0)
-        return 0;
-      const size_t diff = nmemb - sizeof b19;
-      if (b19.len2 != nmemb - 4 || b19.len3 != 9 || b19.len4 != diff)
-        return 0;
-      if (strncmp(b19.iso, "ISO8859-1", 9) != 0)
-        return 0;
-      char *str = (char *)ptr + sizeof b19;
-      clean_buffer(str, b19.len4);
-    } else {
-      // raw string buffer
-      clean_buffer(ptr, nmemb);
-    }
-    s = outstream->write(ptr, size, nmemb, outstream);
-    if (s == nmemb)
-      return nmemb;
+static bool check_iso(const void *ptr, size_t nmemb) {
+  size_t len;
+  return !mec_mr3_is_iso(ptr, nmemb) || mec_mr3_iso_string(ptr, nmemb, &len);
+}
+
+static inline unsigned add_field(struct mec_mr3_field *fields, unsigned n,
+                                 size_t offset, size_t len) {
+  fields[n].offset = (uint32_t)offset;
+  fields[n].len = (uint32_t)len;
+  return n + 1;
+}
+
+static unsigned iso_fields(const void *ptr, size_t nmemb,
+                           struct mec_mr3_field *fields) {
+  if (mec_mr3_is_iso(ptr, nmemb)) {
+    // iso, header was validated by check_iso
+    return add_field(fields, 0, sizeof(struct buffer19),
+                     nmemb - sizeof(struct buffer19));
   }
-  return 0;
+  // raw string buffer
+  return add_field(fields, 0, 0, nmemb);
 }
 
-typedef char str16[16 + 1];
-typedef char str64[64 + 1];
+static bool check_struct(const void *ptr, size_t nmemb) {
+  (void)ptr;
+  return nmemb == 436 || nmemb == 516 || nmemb == 325;
+}
 
-struct buffer436 {
-  uint32_t zero;
-  char iver[0x45];
-  char buf3[0x100]; // phi
-  str64 buf4;
-  str16 buf5;
-  char modality[0x15];
-  uint32_t val;
-};
-struct buffer516 {
-  str64 zero;
-  char buf2[0x15];
-  char buf3[0x100]; // phi
-  str16 buf4;
-  str64 buf5;
-  str64 buf6;
-  uint32_t bools[6];
-};
-struct buffer325 {
-  str64 array[5];
-};
+// fields are cleaned directly inside the payload, no copy to a local struct
+#define ADD_FIELD(n, type, member)                                             \
+  add_field(fields, n, offsetof(type, member), sizeof(((type *)0)->member))
+
+static unsigned struct_fields(size_t nmemb, struct mec_mr3_field *fields) {
+  if (nmemb == 436)
+    return ADD_FIELD(0, struct buffer436, buf3);
+  if (nmemb == 516)
+    return ADD_FIELD(0, struct buffer516, buf3);
+  assert(nmemb == 325); // programmer error, see check_struct
+  unsigned n = 0;
+  int a;
+  for (a = 0; a < 5; ++a) {
+    n = ADD_FIELD(n, struct buffer325, array[a]);
+  }
+  return n;
+}
 
-static size_t fread_mirror_clean_struct(void *ptr, size_t size, size_t nmemb,
-                                        struct app *self) {
-  struct stream *instream = self->in;
-  struct stream *outstream = self->out;
-
-  size_t s = instream->read(ptr, size, nmemb, instream);
-  if (s == nmemb) {
-    if (s == 436) {
-      struct buffer436 b436;
-      memcpy(&b436, ptr, nmemb);
-      clean_buffer(b436.buf3, sizeof b436.buf3);
-      memcpy(ptr, &b436, nmemb);
-    } else if (s == 516) {
-      struct buffer516 b516;
-      memcpy(&b516, ptr, nmemb);
-      clean_buffer(b516.buf3, sizeof b516.buf3);
-      memcpy(ptr, &b516, nmemb);
-    } else if (s == 325) {
-      struct buffer325 b325;
-      memcpy(&b325, ptr, nmemb);
-      int a;
-      for (a = 0; a < 5; ++a) {
-        clean_buffer(b325.array[a], sizeof b325.array[a]);
-      }
-      memcpy(ptr, &b325, nmemb);
-    } else {
-      assert(0); // programmer error
-      return 0;
-    }
-    s = outstream->write(ptr, size, nmemb, outstream);
-    if (s == nmemb)
-      return nmemb;
+// the uids remapped by MEC_MR3_REMAP, 0 for a payload that holds none
+static unsigned uid_fields(uint32_t len, uint32_t type,
+                           struct mec_mr3_field *fields) {
+  if (type == STRUCT_136 && len == 136) {
+    const unsigned n = ADD_FIELD(0, struct buffer136, uid1);
+    return ADD_FIELD(n, struct buffer136, uid2);
   }
+  if (type == STRUCT_516 && len == 516)
+    return ADD_FIELD(0, struct buffer516, buf5);
   return 0;
 }
 
-static size_t fread_mirror_clean_shift_jis(void *ptr, size_t size, size_t nmemb,
-                                           struct app *self) {
-  struct stream *instream = self->in;
-  struct stream *outstream = self->out;
+#undef ADD_FIELD
 
-  size_t s = instream->read(ptr, size, nmemb, instream);
-  if (s == nmemb) {
-    clean_buffer(ptr, nmemb);
-    s = outstream->write(ptr, size, nmemb, outstream);
-    if (s == nmemb)
-      return nmemb;
-  }
-  return 0;
+static unsigned shift_jis_fields(size_t nmemb, struct mec_mr3_field *fields) {
+  return add_field(fields, 0, 0, nmemb);
 }
 
-static bool read_magic(struct app *self) {
-  (void)self;
-  return true;
+// registered uids (transfer syntaxes, sop classes) identify no one:
+static inline bool is_standard_uid(const char *uid, size_t len) {
+  static const char prefix[] = "1.2.840.10008.";
+  return len >= sizeof prefix - 1 &&
+         memcmp(uid, prefix, sizeof prefix - 1) == 0;
 }
 
-static bool write_trailer(struct app *self) {
-  assert(self->in->cur <= self->in->end);
-  if (self->in->cur == self->in->end)
-    return true;
-  // else it is missing one byte (nul byte):
-  char padding;
-  size_t s = fread_mirror(&padding, sizeof padding, 1, self);
-  ERROR_RETURN(s, 1);
-  ERROR_RETURN(padding, 0);
+static bool check_uids(const void *ptr, uint32_t len, uint32_t type) {
+  struct mec_mr3_field fields[MEC_MR3_MAX_FIELDS];
+  const unsigned n = uid_fields(len, type, fields);
+  unsigned f;
+  for (f = 0; f < n; ++f) {
+    const char *uid = (const char *)ptr + fields[f].offset;
+    const size_t ulen = strnlen(uid, fields[f].len);
+    if (ulen == fields[f].len)
+      return false;
+    // too short for a unique replacement of the same length:
+    if (ulen != 0 && ulen < MEC_MR3_UID_MIN_LEN && !is_standard_uid(uid, ulen))
+      return false;
+    size_t i;
+    for (i = 0; i < ulen; ++i) {
+      if ((uid[i] < '0' || uid[i] > '9') && uid[i] != '.')
+        return false;
+    }
+  }
+  return n != 0;
+}
 
+static bool remap_uids(void *ptr, uint32_t len, uint32_t type,
+                       const struct mec_mr3_options *options,
+                       const struct mec_mr3_phi_origin *origin) {
+  struct mec_mr3_field fields[MEC_MR3_MAX_FIELDS];
+  const unsigned n = uid_fields(len, type, fields);
+  const struct mec_mr3_sink *manifest = options->manifest;
+  unsigned f;
+  for (f = 0; f < n; ++f) {
+    char *uid = (char *)ptr + fields[f].offset;
+    const size_t ulen = strnlen(uid, fields[f].len);
+    if (ulen == 0 || is_standard_uid(uid, ulen))
+      continue;
+    uint64_t digest = 0;
+    if (manifest && options->hash_key)
+      digest = mec_mr3_siphash(options->hash_key, uid, ulen);
+    // only fails when the uid was not reserved (streaming):
+    if (!mec_mr3_uid_map_get(options->uid_map, uid, ulen, uid))
+      return false;
+    if (manifest &&
+        !mec_mr3_manifest_field(manifest, origin, type, MEC_MR3_REMAP,
+                                fields[f].offset, uid, (uint32_t)ulen,
+                                options->hash_key ? &digest : NULL))
+      return false;
+  }
   return true;
 }
 
-struct mec_mr3_info {
-  uint32_t key;
-  uint32_t type;
-};
+static bool check_layout(const void *ptr, uint32_t len, uint32_t type) {
+  switch (type) {
+    // validate payload depending on its type:
+  case ISO_8859_1_STRING:
+    return check_iso(ptr, len);
+  case STRUCT_436:
+  case STRUCT_516:
+  case STRUCT_325:
+    return check_struct(ptr, len);
+  case SHIFT_JIS_STRING:
+    return true;
+  case DATETIME:
+    return mec_mr3_datetime_check(ptr, len, 0);
+  default:
+    // phi key with an unexpected type
+    return false;
+  }
+}
 
-struct mec_mr3_item_data {
-  uint32_t len;
-  char *buffer;
-};
+bool mec_mr3_check_phi(const void *ptr, uint32_t len, uint32_t type,
+                       uint8_t action, const struct mec_mr3_options *options) {
+  if (action & MEC_MR3_REMAP) {
+    if (!options || !options->uid_map || !check_uids(ptr, len, type))
+      return false;
+    action &= (uint8_t)~MEC_MR3_REMAP;
+  }
+  if (action == MEC_MR3_KEEP)
+    return true;
+  // pseudonyms are only as good as the secrecy of the key:
+  if ((action & MEC_MR3_HASH) && (!options || !options->hash_key))
+    return false;
+  if (action & MEC_MR3_SHIFT) {
+    // dates only, and the shifted ones must still fit the format:
+    const int days = options ? options->date_shift : 0;
+    return type == DATETIME && mec_mr3_datetime_check(ptr, len, days);
+  }
+  return check_layout(ptr, len, type);
+}
 
-static const unsigned char magic2[] = {0, 0, 0, 0, 0, 0, 0, 0, 0xc, 0,
-                                       0, 0, 0, 0, 0, 0, 0, 0, 0,   0};
+unsigned mec_mr3_phi_fields(const void *ptr, uint32_t len, uint32_t type,
+                            struct mec_mr3_field *fields) {
+  if (!check_layout(ptr, len, type))
+    return 0;
+  switch (type) {
+    // locate strings depending on the type:
+  case ISO_8859_1_STRING:
+    return iso_fields(ptr, len, fields);
+  case STRUCT_436:
+  case STRUCT_516:
+  case STRUCT_325:
+    return struct_fields(len, fields);
+  case SHIFT_JIS_STRING:
+  case DATETIME:
+    return shift_jis_fields(len, fields);
+  default:
+    assert(0); // programmer error, see check_layout
+    return 0;
+  }
+}
 
-static bool read_info(struct app *self, struct mec_mr3_info *info) {
-  // read key and type at once:
-  size_t s = fread_mirror(info, sizeof *info, 1, self);
-  ERROR_RETURN(s, 1);
-  ERROR_RETURN(info->key & 0xfff00000, 0x0);
-  ERROR_RETURN(info->type & 0x00ff, 0x0);
-  const uint32_t sign = info->type >> 24;
-  ERROR_RETURN(sign == 0x0 || sign == 0xff, true);
+// whether the fields of a payload need their keyed hash: the digests of the
+// manifest and the seeds of MEC_MR3_HASH are the same siphash of the bytes
+// clean_buffer modifies
+static inline bool needs_digests(uint8_t action,
+                                 const struct mec_mr3_options *options) {
+  return options && options->hash_key &&
+         (options->manifest || (action & MEC_MR3_HASH));
+}
 
+// the keyed hash of each field is taken right before the field is cleaned
+static bool clean_fields(char *ptr, uint32_t type, uint8_t action,
+                         const struct mec_mr3_options *options,
+                         const struct mec_mr3_phi_origin *origin,
+                         const struct mec_mr3_field *fields, unsigned n) {
+  const struct mec_mr3_sink *manifest = options ? options->manifest : NULL;
+  const bool digests = needs_digests(action, options);
+  unsigned f;
+  for (f = 0; f < n; ++f) {
+    char *str = ptr + fields[f].offset;
+    const uint32_t modified =
+        digests || manifest ? modified_len(str, fields[f].len, action, options)
+                            : 0;
+    const uint64_t digest =
+        digests ? mec_mr3_siphash(options->hash_key, str, modified) : 0;
+    clean_buffer(str, fields[f].len, action, options, digest);
+    // phi is short, an unkeyed digest would be trivial to invert:
+    if (manifest && modified != 0 &&
+        !mec_mr3_manifest_field(manifest, origin, type, action,
+                                fields[f].offset, str, modified,
+                                digests ? &digest : NULL))
+      return false;
+  }
   return true;
 }
 
-static const uint32_t with_phi[] = {
-    0x000055f2, /* !!!charset!!! */
-    0x000055f3, /* */
-    0x000055fc, /* */
-    0x0000560c, /* !!!charset!!! */
-    0x0000560d, /* */
-    0x00005612, /* */
-    0x00006d77, /* */
-    0x00006d80, /* buffer */
-    0x00006d83, /* buffer */
-    0x00006d8a, /* */
-};
+bool mec_mr3_clean_phi(void *ptr, uint32_t len, uint32_t type,
+                       uint8_t action, const struct mec_mr3_options *options,
+                       const struct mec_mr3_phi_origin *origin) {
+  if ((action & MEC_MR3_REMAP) &&
+      !remap_uids(ptr, len, type, options, origin))
+    return false;
+  action &= (uint8_t)~MEC_MR3_REMAP;
+  if (action == MEC_MR3_KEEP)
+    return true;
+  struct mec_mr3_field fields[MEC_MR3_MAX_FIELDS];
+  const unsigned n = mec_mr3_phi_fields(ptr, len, type, fields);
+  assert(n != 0); // programmer error, see mec_mr3_check_phi
+  return clean_fields(ptr, type, action, options, origin, fields, n);
+}
 
-static inline bool key_is_phi(const uint32_t val) {
-  unsigned int i;
-  for (i = 0; i < sizeof(with_phi) / sizeof(*with_phi); i++) {
-    if (with_phi[i] == val)
-      return true;
+bool mec_mr3_add_span(struct mec_mr3_spans *spans,
+                      const struct mec_mr3_policy *policy,
+                      const struct mec_mr3_options *options,
+                      const struct mec_mr3_walk *w,
+                      const struct mec_mr3_item *item) {
+  const uint8_t action = mec_mr3_policy_lookup(policy, item->group, item->key);
+  if (action != MEC_MR3_KEEP) {
+    // found a key indicating potential phi, record its location:
+    ERROR_RETURN(mec_mr3_check_phi(item->data, item->len, item->type, action,
+                                   options),
+                 true);
+    ERROR_RETURN(spans->n < MEC_MR3_MAX_SPANS, true);
+    struct mec_mr3_span *span = spans->spans + spans->n++;
+    span->offset = (uint32_t)((const unsigned char *)item->data -
+                              w->cursor.start);
+    span->len = item->len;
+    span->type = item->type;
+    span->key = item->key;
+    span->group = item->group;
+    span->action = action;
   }
-  return false;
+
+  return true;
 }
 
-enum Type {
-  ISO_8859_1_STRING =
-      0x00000300,          // ASCII string / or struct with 'ISO-8859-1' marker
-  STRUCT_436 = 0x001f4300, // Fixed struct 436 bytes (struct with ASCII strings)
-  STRUCT_516 = 0x001f4400, // Fixed struct 516 bytes (struct with ASCII strings)
-  STRUCT_325 = 0x001f4600, // Fixed struct 325 bytes (struct with ASCII strings)
-  SHIFT_JIS_STRING = 0xff002c00, // SHIFT-JIS string
-};
+#undef ERROR_RETURN
 
-static bool read_data(struct app *self, const struct mec_mr3_info *info,
-                      struct mec_mr3_item_data *data) {
-  size_t s = fread_mirror(&data->len, sizeof data->len, 1, self);
-  ERROR_RETURN(s, 1);
-  // in the wild we have: data->len <= 9509
-  unsigned char separator[20];
-  s = fread_mirror(separator, sizeof *separator,
-                   sizeof separator / sizeof *separator, self);
-  ERROR_RETURN(s, sizeof separator / sizeof *separator);
-  int b = memcmp(separator, magic2, sizeof(magic2));
-  ERROR_RETURN(b, 0);
-  data->buffer = (char *)realloc(data->buffer, data->len);
-  if (data->len != 0 && data->buffer == NULL) {
+// first phase: walk the item headers and record the phi spans
+static bool mec_mr3_index(struct app *self, const void *input, size_t len) {
+  // spans offsets are stored on 32bits:
+  if (len > UINT32_MAX)
     return false;
+  struct mec_mr3_walk w;
+  mec_mr3_walk_init(&w, input, len);
+
+  struct mec_mr3_item item;
+  int ret = -1;
+  while ((ret = mec_mr3_walk_next(&w, &item)) == 1) {
+    if (!mec_mr3_add_span(&self->spans, self->policy, self->options, &w,
+                          &item))
+      return false;
   }
+  return ret == 0;
+}
 
-  if (key_is_phi(info->key)) {
-    // found a key indicating potential phi
-    switch (info->type) {
-      // clean string depending on its type:
-    case ISO_8859_1_STRING:
-      s = fread_mirror_clean_iso(data->buffer, 1, data->len, self);
-      break;
-    case STRUCT_436:
-    case STRUCT_516:
-    case STRUCT_325:
-      s = fread_mirror_clean_struct(data->buffer, 1, data->len, self);
-      break;
-    case SHIFT_JIS_STRING:
-      s = fread_mirror_clean_shift_jis(data->buffer, 1, data->len, self);
-      break;
-    default:
-      assert(0); // programmer error
-      return false;
+bool mec_mr3_reserve_uids(const void *input, const struct mec_mr3_spans *spans,
+                          const struct mec_mr3_options *options) {
+  uint32_t i;
+  for (i = 0; i < spans->n; ++i) {
+    const struct mec_mr3_span *span = spans->spans + i;
+    if (!(span->action & MEC_MR3_REMAP))
+      continue;
+    const char *payload = (const char *)input + span->offset;
+    struct mec_mr3_field fields[MEC_MR3_MAX_FIELDS];
+    const unsigned n = uid_fields(span->len, span->type, fields);
+    unsigned f;
+    for (f = 0; f < n; ++f) {
+      const char *uid = payload + fields[f].offset;
+      const size_t ulen = strnlen(uid, fields[f].len);
+      char replacement[64];
+      if (ulen != 0 && !is_standard_uid(uid, ulen) &&
+          !mec_mr3_uid_map_get(options->uid_map, uid, ulen, replacement))
+        return false;
     }
-  } else {
-    s = fread_mirror(data->buffer, 1, data->len, self);
   }
-  ERROR_RETURN(s, data->len);
-
   return true;
 }
 
-static bool read_group(struct app *self, uint32_t nitems,
-                       struct mec_mr3_info *info,
-                       struct mec_mr3_item_data *data) {
-  bool good = true;
+// second phase: patch the recorded spans
+bool mec_mr3_patch_spans(void *output, const struct mec_mr3_spans *spans,
+                         const struct mec_mr3_options *options) {
+  const struct mec_mr3_sink *manifest = options ? options->manifest : NULL;
+  if (manifest && !mec_mr3_manifest_begin(manifest))
+    return false;
   uint32_t i;
-  for (i = 0; i < nitems && good; ++i) {
-    good = good && read_info(self, info);
-    // lazy evaluation:
-    good = good && read_data(self, info, data);
+  for (i = 0; i < spans->n; ++i) {
+    const struct mec_mr3_span *span = spans->spans + i;
+    char *payload = (char *)output + span->offset;
+    struct mec_mr3_phi_origin origin;
+    origin.group = span->group;
+    origin.key = span->key;
+    origin.offset = span->offset;
+    if ((span->action & MEC_MR3_REMAP) &&
+        !remap_uids(payload, span->len, span->type, options, &origin))
+      return false;
+    const uint8_t action = span->action & (uint8_t)~MEC_MR3_REMAP;
+    if (action == MEC_MR3_KEEP)
+      continue;
+    struct mec_mr3_field fields[MEC_MR3_MAX_FIELDS];
+    const unsigned n =
+        mec_mr3_phi_fields(payload, span->len, span->type, fields);
+    assert(n != 0); // programmer error, see mec_mr3_check_phi
+    if (!clean_fields(payload, span->type, action, options, &origin, fields,
+                      n))
+      return false;
   }
-  return good;
+  return true;
 }
 
-#undef ERROR_RETURN
-
-static bool mec_mr3_scrub(void *output, const void *input, size_t len) {
+bool mec_mr3_scrub_ex(void *output, const void *input, size_t len,
+                      const struct mec_mr3_options *options) {
   if (!input || !output)
     return false;
-  struct stream sin;
-  struct stream sout;
+  if (options && options->layouts)
+    return mec_mr3_layout_scrub(options->layouts, output, input, len, options);
   struct app a;
-  struct app *self = create_app(&a, &sin, &sout);
-  setup_buffer(self, output, input, len);
-  if (!read_magic(self))
+  struct app *self = create_app(&a, options);
+  if (!mec_mr3_index(self, input, len) ||
+      !mec_mr3_reserve_uids(input, &self->spans, options))
     return false;
 
-  bool good = true;
-  struct mec_mr3_info info;
-  struct mec_mr3_item_data data;
-  data.len = 0;
-  data.buffer = NULL;
-
-  uint32_t remain = 1;
-  size_t s;
-  bool last_element = false;
-  // read until last set of group found:
-  while (!last_element && good) {
-    uint32_t nitems;
-    s = fread_mirror(&nitems, sizeof nitems, 1, self);
-    if (s != 1 || nitems == 0) {
-      good = false;
-    }
-    if (good && nitems <= 3) {
-      // special case to handle last element
-      remain = nitems;
-      last_element = true;
-      s = fread_mirror(&nitems, sizeof nitems, 1, self);
-      if (s != 1 || nitems == 0) {
-        good = false;
-      }
-    }
-    // lazy evaluation
-    good = good && read_group(self, nitems, &info, &data);
-  }
-  // read remaining groups:
-  while (good && --remain != 0) {
-    uint32_t nitems;
-    s = fread_mirror(&nitems, sizeof nitems, 1, self);
-    if (s != 1 || nitems <= 3) {
-      good = false;
-    }
-    good = good && read_group(self, nitems, &info, &data);
-  }
-  // release memory:
-  free(data.buffer);
-  if (!good)
-    return false;
+  if (output != input)
+    memcpy(output, input, len);
+  return mec_mr3_patch_spans(output, &self->spans, options);
+}
 
-  // write trailer:
-  if (!write_trailer(self)) {
+// whether clean_buffer would modify str
+static bool needs_clean(const char *str, size_t buf_len, uint8_t action,
+                        const struct mec_mr3_options *options) {
+  size_t i;
+  if (action & MEC_MR3_REMOVE) {
+    for (i = 0; i < buf_len; ++i) {
+      if (str[i] != 0)
+        return true;
+    }
     return false;
   }
+  const size_t len = strnlen(str, buf_len);
+  if (action & MEC_MR3_HASH)
+    return len != 0;
+  if (action & MEC_MR3_SHIFT)
+    return options && options->date_shift != 0;
+  for (i = 0; i < len; ++i) {
+    if (str[i] != ' ')
+      return true;
+  }
+  return false;
+}
 
-  // make sure the whole input was processed:
-  assert(self->in->cur <= self->in->end); // programmer error
-  if (self->in->cur < self->in->end) {
-    return false;
+int mec_mr3_needs_scrub(const void *buf, size_t len,
+                        const struct mec_mr3_options *options) {
+  if (!buf)
+    return -1;
+  struct app a;
+  struct app *self = create_app(&a, options);
+  if (!mec_mr3_index(self, buf, len))
+    return -1;
+  uint32_t i;
+  for (i = 0; i < self->spans.n; ++i) {
+    const struct mec_mr3_span *span = self->spans.spans + i;
+    const char *payload = (const char *)buf + span->offset;
+    struct mec_mr3_field fields[MEC_MR3_MAX_FIELDS];
+    unsigned n, f;
+    if (span->action & MEC_MR3_REMAP) {
+      // there is no telling a replacement from an original:
+      n = uid_fields(span->len, span->type, fields);
+      for (f = 0; f < n; ++f) {
+        const char *uid = payload + fields[f].offset;
+        const size_t ulen = strnlen(uid, fields[f].len);
+        if (ulen != 0 && !is_standard_uid(uid, ulen))
+          return 1;
+      }
+    }
+    if ((span->action & ~MEC_MR3_REMAP) == MEC_MR3_KEEP)
+      continue;
+    n = mec_mr3_phi_fields(payload, span->len, span->type, fields);
+    for (f = 0; f < n; ++f) {
+      if (needs_clean(payload + fields[f].offset, fields[f].len, span->action,
+                      options))
+        return 1;
+    }
   }
-  assert(self->out->cur == self->out->end); // programmer error
-  return true;
+  return 0;
 }
 
 void *mec_mr3_memcpy(void *dest, const void *src, size_t n) {
-  const bool b = mec_mr3_scrub(dest, src, n);
+  const bool b = mec_mr3_scrub_ex(dest, src, n, NULL);
   return b ? dest : NULL;
 }
+
+bool mec_mr3_scrub_inplace(void *buf, size_t len) {
+  return mec_mr3_scrub_ex(buf, buf, len, NULL);
+}
@@ -14,6 +14,7 @@
 #ifndef MEC_MR3_H
 #define MEC_MR3_H
 
+#include <stdbool.h>
 #include <stddef.h>
 
 #ifdef __cplusplus
@@ -22,6 +23,58 @@ extern "C" {
 
 void *mec_mr3_memcpy(void *dest, const void *src, size_t n);
 
+struct mec_mr3_policy;
+struct mec_mr3_layout_cache;
+struct mec_mr3_uid_map;
+
+/* output callback, write must return false to abort */
+struct mec_mr3_sink {
+  bool (*write)(const void *buf, size_t n, void *user);
+  void *user;
+};
+
+/* scrub options, zero initialize for the defaults */
+struct mec_mr3_options {
+  const struct mec_mr3_policy *policy; // NULL: mec_mr3_policy_default()
+  // key of the hash action, MEC_MR3_HASH_KEY_SIZE bytes. Required as soon as
+  // the policy uses hash: the same string always maps to the same pseudonym
+  // for a given key.
+  const unsigned char *hash_key;
+  // days added to the dates by the shift action, may be negative. Use the
+  // same value for all the studies of a patient to keep their intervals.
+  int date_shift;
+  // replacements of the remap action, see mec_mr3_uid.h. Required as soon as
+  // the policy uses remap.
+  struct mec_mr3_uid_map *uid_map;
+  // when set, receives the manifest of the modified bytes, see
+  // mec_mr3_manifest.h
+  const struct mec_mr3_sink *manifest;
+  // when set, blobs with a layout seen before skip the parsing, see
+  // mec_mr3_layout.h
+  struct mec_mr3_layout_cache *layouts;
+};
+
+/* scrub n bytes from src into dest according to options (may be NULL). dest
+ * may be equal to src to scrub in place. Return false on invalid layout. */
+bool mec_mr3_scrub_ex(void *dest, const void *src, size_t n,
+                      const struct mec_mr3_options *options);
+
+/* header only pass: return 1 when scrubbing buf would modify it, 0 when its
+ * phi fields are already blank (or zero, as the policy says) and -1 when buf
+ * can not be scrubbed. */
+int mec_mr3_needs_scrub(const void *buf, size_t len,
+                        const struct mec_mr3_options *options);
+
+/* scrub buf in place: only the bytes of PHI payloads are rewritten, everything
+ * else is left untouched. The whole layout is validated before the first
+ * write, so buf is left unmodified when false is returned. */
+bool mec_mr3_scrub_inplace(void *buf, size_t len);
+
+/* number of heap allocations performed by the library since startup. The scrub
+ * functions above work on caller-owned memory only and never allocate, except
+ * to record a new layout in options.layouts. */
+size_t mec_mr3_allocations(void);
+
 #ifdef __cplusplus
 } /* end extern "C" */
 #endif
@@ -0,0 +1,190 @@
+#include "mec_mr3_batch.h"
+
+#include "mec_mr3.h"
+#include "mec_mr3_private.h"
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <unistd.h> /* sysconf */
+
+/* range of indices [lo, hi) owned by a worker, packed as hi << 32 | lo so that
+ * the owner (taking from lo) and thieves (taking from hi) agree through a
+ * single compare-and-swap */
+struct worker {
+  _Atomic uint64_t range;
+  pthread_t thread;
+  unsigned id;
+  struct pool *pool;
+};
+
+struct pool {
+  struct worker *workers;
+  unsigned nworkers;
+  void (*fn)(size_t i, void *user);
+  void *user;
+  // steals between the shrinking of the victim's range and the store of the
+  // thief's own, the stolen indices are in no range meanwhile
+  atomic_uint stealing;
+};
+
+static inline uint64_t make_range(uint32_t lo, uint32_t hi) {
+  return (uint64_t)hi << 32 | lo;
+}
+
+static inline uint32_t range_lo(uint64_t r) { return (uint32_t)r; }
+static inline uint32_t range_hi(uint64_t r) { return (uint32_t)(r >> 32); }
+
+// take one index from the front of our own range
+static bool pop(struct worker *self, uint32_t *index) {
+  uint64_t r = atomic_load_explicit(&self->range, memory_order_acquire);
+  for (;;) {
+    const uint32_t lo = range_lo(r);
+    const uint32_t hi = range_hi(r);
+    if (lo >= hi)
+      return false;
+    if (atomic_compare_exchange_weak_explicit(&self->range, &r,
+                                              make_range(lo + 1, hi),
+                                              memory_order_acq_rel,
+                                              memory_order_acquire)) {
+      *index = lo;
+      return true;
+    }
+  }
+}
+
+// take the upper half of the range of victim and make it our own
+static bool steal(struct worker *self, struct worker *victim) {
+  atomic_uint *stealing = &self->pool->stealing;
+  uint64_t r = atomic_load_explicit(&victim->range, memory_order_acquire);
+  for (;;) {
+    const uint32_t lo = range_lo(r);
+    const uint32_t hi = range_hi(r);
+    if (lo >= hi)
+      return false;
+    const uint32_t mid = hi - (hi - lo + 1) / 2;
+    // only counted while there is something to steal, so that idle workers
+    // do not keep each other waiting:
+    atomic_fetch_add(stealing, 1);
+    if (atomic_compare_exchange_weak_explicit(&victim->range, &r,
+                                              make_range(lo, mid),
+                                              memory_order_acq_rel,
+                                              memory_order_acquire)) {
+      atomic_store_explicit(&self->range, make_range(mid, hi),
+                            memory_order_release);
+      atomic_fetch_sub(stealing, 1);
+      return true;
+    }
+    atomic_fetch_sub(stealing, 1);
+  }
+}
+
+static void *worker_main(void *arg) {
+  struct worker *self = arg;
+  struct pool *pool = self->pool;
+  for (;;) {
+    uint32_t index;
+    while (pop(self, &index)) {
+      pool->fn(index, pool->user);
+    }
+    // own range is exhausted, look for work elsewhere:
+    bool stolen = false;
+    unsigned i;
+    for (i = 1; i < pool->nworkers && !stolen; ++i) {
+      struct worker *victim = pool->workers + (self->id + i) % pool->nworkers;
+      stolen = steal(self, victim);
+    }
+    // a range only grows by a steal, whose thief then runs it. Every range
+    // was seen empty: done unless a steal was in flight, whose indices may
+    // have been in none of the ranges when they were looked at
+    if (!stolen && atomic_load(&pool->stealing) == 0)
+      return NULL;
+  }
+}
+
+static unsigned default_threads(void) {
+  const long n = sysconf(_SC_NPROCESSORS_ONLN);
+  return n > 0 ? (unsigned)n : 1;
+}
+
+static bool parallel_for(uint32_t n, unsigned nthreads,
+                         void (*fn)(size_t i, void *user), void *user) {
+  if (nthreads > n)
+    nthreads = n;
+  if (nthreads == 0)
+    return true;
+  struct pool pool;
+  pool.workers = mec_mr3_calloc(nthreads, sizeof *pool.workers);
+  if (!pool.workers)
+    return false;
+  pool.nworkers = nthreads;
+  pool.fn = fn;
+  pool.user = user;
+  atomic_init(&pool.stealing, 0);
+
+  // initial even split of the indices:
+  unsigned t;
+  for (t = 0; t < nthreads; ++t) {
+    struct worker *w = pool.workers + t;
+    const uint32_t lo = (uint32_t)((uint64_t)n * t / nthreads);
+    const uint32_t hi = (uint32_t)((uint64_t)n * (t + 1) / nthreads);
+    atomic_init(&w->range, make_range(lo, hi));
+    w->id = t;
+    w->pool = &pool;
+  }
+  // calling thread is worker #0:
+  unsigned started = 1;
+  for (t = 1; t < nthreads; ++t, ++started) {
+    struct worker *w = pool.workers + t;
+    if (pthread_create(&w->thread, NULL, worker_main, w) != 0)
+      break; // remaining ranges get stolen by the running workers
+  }
+  worker_main(pool.workers);
+  for (t = 1; t < started; ++t) {
+    pthread_join(pool.workers[t].thread, NULL);
+  }
+  free(pool.workers);
+  return true;
+}
+
+bool mec_mr3_parallel_for(size_t n, unsigned nthreads,
+                          void (*fn)(size_t i, void *user), void *user) {
+  // indices are stored on 32bits:
+  if (n > UINT32_MAX)
+    return false;
+  if (nthreads == 0)
+    nthreads = default_threads();
+  return parallel_for((uint32_t)n, nthreads, fn, user);
+}
+
+struct batch {
+  const struct mec_mr3_job *jobs;
+  bool *status;
+  atomic_size_t failures;
+};
+
+static void scrub_job(size_t i, void *user) {
+  struct batch *batch = user;
+  const struct mec_mr3_job *job = batch->jobs + i;
+  const bool good =
+      mec_mr3_scrub_ex(job->dest, job->src, job->len, job->options);
+  batch->status[i] = good;
+  if (!good)
+    atomic_fetch_add_explicit(&batch->failures, 1, memory_order_relaxed);
+}
+
+size_t mec_mr3_scrub_batch(const struct mec_mr3_job *jobs, size_t n,
+                           unsigned nthreads, bool *status) {
+  struct batch batch;
+  batch.jobs = jobs;
+  batch.status = status;
+  atomic_init(&batch.failures, 0);
+  if (!mec_mr3_parallel_for(n, nthreads, scrub_job, &batch)) {
+    size_t i;
+    for (i = 0; i < n; ++i)
+      status[i] = false;
+    return n;
+  }
+  return atomic_load(&batch.failures);
+}
@@ -0,0 +1,34 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+struct mec_mr3_options;
+
+/* one independent blob to scrub, dest may be equal to src to scrub in place */
+struct mec_mr3_job {
+  void *dest;
+  const void *src;
+  size_t len;
+  const struct mec_mr3_options *options; // may be NULL
+};
+
+/* scrub n jobs on nthreads threads (0: one per online cpu). status[i] is set
+ * to whether jobs[i] succeeded. Return the number of failed jobs. */
+size_t mec_mr3_scrub_batch(const struct mec_mr3_job *jobs, size_t n,
+                           unsigned nthreads, bool *status);
+
+/* call fn(i, user) exactly once for each i in [0, n) on nthreads threads (0:
+ * one per online cpu). Each thread owns a range of indices and steals half of
+ * the range of another thread once its own is exhausted. A thread only
+ * returns once every range is empty and no steal is under way. */
+bool mec_mr3_parallel_for(size_t n, unsigned nthreads,
+                          void (*fn)(size_t i, void *user), void *user);
+
+#ifdef __cplusplus
+} /* end extern "C" */
+#endif
@@ -0,0 +1,116 @@
+#include "mec_mr3_private.h"
+
+#include <string.h>
+
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__)
+#define MEC_MR3_X86
+#include <immintrin.h>
+#endif
+
+static void blank_scalar(char *str, size_t buf_len) {
+  const size_t len = strnlen(str, buf_len);
+  memset(str, ' ', len);
+}
+
+#ifdef MEC_MR3_X86
+/* each kernel handles whole vectors inside the field: lanes before the first
+ * nul byte become spaces, the vector is written back unchanged past it. The
+ * tail shorter than a vector is left to blank_scalar. */
+
+__attribute__((target("sse2"))) static void blank_sse2(char *str,
+                                                       size_t buf_len) {
+  const __m128i zero = _mm_setzero_si128();
+  const __m128i spaces = _mm_set1_epi8(' ');
+  const __m128i lanes = _mm_setr_epi8(0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11,
+                                      12, 13, 14, 15);
+  size_t i;
+  for (i = 0; i + 16 <= buf_len; i += 16) {
+    __m128i *p = (__m128i *)(str + i);
+    const __m128i v = _mm_loadu_si128(p);
+    const unsigned mask = (unsigned)_mm_movemask_epi8(_mm_cmpeq_epi8(v, zero));
+    if (mask == 0) {
+      _mm_storeu_si128(p, spaces);
+      continue;
+    }
+    const int n = __builtin_ctz(mask);
+    const __m128i before = _mm_cmplt_epi8(lanes, _mm_set1_epi8((char)n));
+    _mm_storeu_si128(p, _mm_or_si128(_mm_and_si128(before, spaces),
+                                     _mm_andnot_si128(before, v)));
+    return;
+  }
+  blank_scalar(str + i, buf_len - i);
+}
+
+__attribute__((target("avx2"))) static void blank_avx2(char *str,
+                                                       size_t buf_len) {
+  const __m256i zero = _mm256_setzero_si256();
+  const __m256i spaces = _mm256_set1_epi8(' ');
+  const __m256i lanes = _mm256_setr_epi8(
+      0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15, 16, 17, 18, 19, 20,
+      21, 22, 23, 24, 25, 26, 27, 28, 29, 30, 31);
+  size_t i;
+  for (i = 0; i + 32 <= buf_len; i += 32) {
+    __m256i *p = (__m256i *)(str + i);
+    const __m256i v = _mm256_loadu_si256(p);
+    const unsigned mask =
+        (unsigned)_mm256_movemask_epi8(_mm256_cmpeq_epi8(v, zero));
+    if (mask == 0) {
+      _mm256_storeu_si256(p, spaces);
+      continue;
+    }
+    const int n = __builtin_ctz(mask);
+    const __m256i before =
+        _mm256_cmpgt_epi8(_mm256_set1_epi8((char)n), lanes);
+    _mm256_storeu_si256(p, _mm256_blendv_epi8(v, spaces, before));
+    return;
+  }
+  blank_sse2(str + i, buf_len - i);
+}
+#endif
+
+static void blank_resolve(char *str, size_t buf_len);
+
+// selected on first use, every thread would pick the same kernel:
+static void (*blank)(char *str, size_t buf_len) = blank_resolve;
+
+static void blank_resolve(char *str, size_t buf_len) {
+  void (*kernel)(char *, size_t) = blank_scalar;
+#ifdef MEC_MR3_X86
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx2"))
+    kernel = blank_avx2;
+  else if (__builtin_cpu_supports("sse2"))
+    kernel = blank_sse2;
+#endif
+  __atomic_store_n(&blank, kernel, __ATOMIC_RELAXED);
+  kernel(str, buf_len);
+}
+
+void mec_mr3_blank(char *str, size_t buf_len) {
+  __atomic_load_n(&blank, __ATOMIC_RELAXED)(str, buf_len);
+}
+
+bool mec_mr3_blank_with(enum mec_mr3_blank_kernel kernel, char *str,
+                        size_t buf_len) {
+  switch (kernel) {
+  case MEC_MR3_BLANK_SCALAR:
+    blank_scalar(str, buf_len);
+    return true;
+#ifdef MEC_MR3_X86
+  case MEC_MR3_BLANK_SSE2:
+    __builtin_cpu_init();
+    if (!__builtin_cpu_supports("sse2"))
+      return false;
+    blank_sse2(str, buf_len);
+    return true;
+  case MEC_MR3_BLANK_AVX2:
+    __builtin_cpu_init();
+    if (!__builtin_cpu_supports("avx2"))
+      return false;
+    blank_avx2(str, buf_len);
+    return true;
+#endif
+  default:
+    return false;
+  }
+}
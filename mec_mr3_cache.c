@@ -0,0 +1,182 @@
+#include "mec_mr3_cache.h"
+
+#include "mec_mr3.h"
+#include "mec_mr3_hash.h"
+#include "mec_mr3_private.h"
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+enum {
+  SHARDS = 16,  // independent locks, picked by the hash
+  BUCKETS = 64, // per shard, a series rarely has more distinct blobs
+};
+
+struct entry {
+  uint64_t hash;
+  size_t len;
+  bool good;                 // result of the scrub, no output if false
+  struct entry *chain;       // next in bucket
+  struct entry *prev, *next; // lru list, most recent first
+  unsigned char data[];      // input, then output
+};
+
+struct shard {
+  pthread_mutex_t lock;
+  struct entry *buckets[BUCKETS];
+  struct entry *head, *tail;
+  size_t bytes;
+};
+
+struct mec_mr3_cache {
+  const struct mec_mr3_options *options;
+  size_t max_bytes; // per shard
+  atomic_size_t hits;
+  struct shard shards[SHARDS];
+};
+
+struct mec_mr3_cache *
+mec_mr3_cache_create(size_t max_bytes, const struct mec_mr3_options *options) {
+  struct mec_mr3_cache *cache = mec_mr3_calloc(1, sizeof *cache);
+  if (!cache)
+    return NULL;
+  cache->options = options;
+  cache->max_bytes = max_bytes / SHARDS;
+  atomic_init(&cache->hits, 0);
+  int s;
+  for (s = 0; s < SHARDS; ++s) {
+    pthread_mutex_init(&cache->shards[s].lock, NULL);
+  }
+  return cache;
+}
+
+void mec_mr3_cache_free(struct mec_mr3_cache *cache) {
+  if (!cache)
+    return;
+  int s;
+  for (s = 0; s < SHARDS; ++s) {
+    struct shard *shard = cache->shards + s;
+    struct entry *e = shard->head;
+    while (e) {
+      struct entry *next = e->next;
+      free(e);
+      e = next;
+    }
+    pthread_mutex_destroy(&shard->lock);
+  }
+  free(cache);
+}
+
+size_t mec_mr3_cache_hits(const struct mec_mr3_cache *cache) {
+  return atomic_load_explicit(&cache->hits, memory_order_relaxed);
+}
+
+static inline size_t entry_size(const struct entry *e) {
+  return sizeof *e + (e->good ? 2 * e->len : e->len);
+}
+
+static void lru_unlink(struct shard *shard, struct entry *e) {
+  if (e->prev)
+    e->prev->next = e->next;
+  else
+    shard->head = e->next;
+  if (e->next)
+    e->next->prev = e->prev;
+  else
+    shard->tail = e->prev;
+}
+
+static void lru_push(struct shard *shard, struct entry *e) {
+  e->prev = NULL;
+  e->next = shard->head;
+  if (shard->head)
+    shard->head->prev = e;
+  else
+    shard->tail = e;
+  shard->head = e;
+}
+
+static void evict(struct shard *shard, struct entry *e) {
+  struct entry **p = shard->buckets + e->hash % BUCKETS;
+  while (*p != e)
+    p = &(*p)->chain;
+  *p = e->chain;
+  lru_unlink(shard, e);
+  shard->bytes -= entry_size(e);
+  free(e);
+}
+
+// must hold the lock of the shard
+static struct entry *find(struct shard *shard, uint64_t hash, const void *src,
+                          size_t n) {
+  struct entry *e;
+  for (e = shard->buckets[hash % BUCKETS]; e; e = e->chain) {
+    if (e->hash == hash && e->len == n && memcmp(e->data, src, n) == 0)
+      return e;
+  }
+  return NULL;
+}
+
+static void insert(struct shard *shard, size_t max_bytes, struct entry *e) {
+  while (shard->tail && shard->bytes + entry_size(e) > max_bytes)
+    evict(shard, shard->tail);
+  struct entry **bucket = shard->buckets + e->hash % BUCKETS;
+  e->chain = *bucket;
+  *bucket = e;
+  lru_push(shard, e);
+  shard->bytes += entry_size(e);
+}
+
+bool mec_mr3_scrub_cached(struct mec_mr3_cache *cache, void *dest,
+                          const void *src, size_t n) {
+  const struct mec_mr3_options *options = cache->options;
+  if (options && options->manifest)
+    return mec_mr3_scrub_ex(dest, src, n, options);
+  const uint64_t hash = mec_mr3_xxh64(src, n, 0);
+  struct shard *shard = cache->shards + (hash >> 60) % SHARDS;
+
+  bool good = false;
+  pthread_mutex_lock(&shard->lock);
+  struct entry *hit = find(shard, hash, src, n);
+  if (hit) {
+    good = hit->good;
+    if (good)
+      memcpy(dest, hit->data + n, n);
+    lru_unlink(shard, hit);
+    lru_push(shard, hit);
+  }
+  pthread_mutex_unlock(&shard->lock);
+  if (hit) {
+    atomic_fetch_add_explicit(&cache->hits, 1, memory_order_relaxed);
+    return good;
+  }
+
+  // keep a copy of the input before dest overwrites it (in place scrub):
+  struct entry *e = NULL;
+  if (sizeof *e + 2 * n <= cache->max_bytes) {
+    e = mec_mr3_malloc(sizeof *e + 2 * n);
+    if (e)
+      memcpy(e->data, src, n);
+  }
+  good = mec_mr3_scrub_ex(dest, src, n, options);
+  if (!e)
+    return good;
+  e->hash = hash;
+  e->len = n;
+  e->good = good;
+  if (good)
+    memcpy(e->data + n, dest, n);
+
+  pthread_mutex_lock(&shard->lock);
+  // another thread may have inserted the same input meanwhile:
+  if (find(shard, hash, e->data, n)) {
+    free(e);
+  } else {
+    insert(shard, cache->max_bytes, e);
+  }
+  pthread_mutex_unlock(&shard->lock);
+  return good;
+}
@@ -0,0 +1,34 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+struct mec_mr3_options;
+struct mec_mr3_cache;
+
+/* cache of scrubbed blobs keyed on their content, for series where every
+ * slice carries the same blob. At most max_bytes of inputs and outputs are
+ * kept, least recently used first out. The cache is bound to options (may be
+ * NULL), which must outlive it. Return NULL on allocation failure. */
+struct mec_mr3_cache *
+mec_mr3_cache_create(size_t max_bytes, const struct mec_mr3_options *options);
+
+void mec_mr3_cache_free(struct mec_mr3_cache *cache);
+
+/* same as mec_mr3_scrub_ex with the options of the cache, reusing the output
+ * of a previous call on an identical input. Safe to call from several threads.
+ * Inputs are compared in full on a hit, never by hash alone. A manifest in the
+ * options disables the cache: each call must write its own records. */
+bool mec_mr3_scrub_cached(struct mec_mr3_cache *cache, void *dest,
+                          const void *src, size_t n);
+
+/* number of calls served from the cache */
+size_t mec_mr3_cache_hits(const struct mec_mr3_cache *cache);
+
+#ifdef __cplusplus
+} /* end extern "C" */
+#endif
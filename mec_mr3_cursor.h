@@ -0,0 +1,158 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+/* bounds-checked cursor over a MEC_MR3 blob. Nothing is ever copied: each
+ * accessor hands back a pointer into the input buffer. */
+struct mec_mr3_cursor {
+  const unsigned char *start;
+  const unsigned char *cur;
+  const unsigned char *end;
+};
+
+static inline void mec_mr3_cursor_init(struct mec_mr3_cursor *c,
+                                       const void *buf, size_t len) {
+  c->start = (const unsigned char *)buf;
+  c->cur = c->start;
+  c->end = c->start + len;
+}
+
+static inline size_t mec_mr3_cursor_offset(const struct mec_mr3_cursor *c) {
+  return (size_t)(c->cur - c->start);
+}
+
+static inline size_t mec_mr3_cursor_remaining(const struct mec_mr3_cursor *c) {
+  return (size_t)(c->end - c->cur);
+}
+
+// return a pointer to the next n bytes and move past them, NULL if the input
+// is too short (cursor is left unchanged).
+static inline const void *mec_mr3_cursor_take(struct mec_mr3_cursor *c,
+                                              size_t n) {
+  if (n > mec_mr3_cursor_remaining(c))
+    return NULL;
+  const void *ptr = c->cur;
+  c->cur += n;
+  return ptr;
+}
+
+static inline bool mec_mr3_cursor_u32(struct mec_mr3_cursor *c, uint32_t *v) {
+  const void *ptr = mec_mr3_cursor_take(c, sizeof *v);
+  if (!ptr)
+    return false;
+  memcpy(v, ptr, sizeof *v); // unaligned load
+  return true;
+}
+
+/* item as stored in the blob: 32 bytes header (key, type, len, separator)
+ * followed by len bytes of payload. */
+struct mec_mr3_item {
+  uint8_t group;
+  uint32_t key;
+  uint32_t type;
+  uint32_t len;
+  const void *data; // view into the input, not aligned
+};
+
+enum { MEC_MR3_ITEM_HEADER_SIZE = 32 };
+
+static const unsigned char mec_mr3_separator[] = {
+    0, 0, 0, 0, 0, 0, 0, 0, 0xc, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0};
+
+// decode the 32 bytes header of an item, payload is not touched
+static inline bool mec_mr3_item_header(const unsigned char *hdr,
+                                       struct mec_mr3_item *item) {
+  memcpy(&item->key, hdr + 0, sizeof item->key);
+  memcpy(&item->type, hdr + 4, sizeof item->type);
+  memcpy(&item->len, hdr + 8, sizeof item->len);
+  if (memcmp(hdr + 12, mec_mr3_separator, sizeof mec_mr3_separator) != 0)
+    return false;
+  if ((item->key & 0xfff00000) != 0x0 || (item->type & 0x00ff) != 0x0)
+    return false;
+  const uint32_t sign = item->type >> 24;
+  if (sign != 0x0 && sign != 0xff)
+    return false;
+  // in the wild we have: len <= 9509
+  return true;
+}
+
+static inline bool mec_mr3_cursor_item(struct mec_mr3_cursor *c,
+                                       struct mec_mr3_item *item) {
+  const unsigned char *hdr =
+      (const unsigned char *)mec_mr3_cursor_take(c, MEC_MR3_ITEM_HEADER_SIZE);
+  if (!hdr || !mec_mr3_item_header(hdr, item))
+    return false;
+  item->data = mec_mr3_cursor_take(c, item->len);
+  return item->data != NULL;
+}
+
+/* walk over all items of a blob, group after group */
+struct mec_mr3_walk {
+  struct mec_mr3_cursor cursor;
+  uint32_t nitems; // items left in current group
+  uint32_t remain; // groups left once the last set of groups was found
+  bool last_element;
+  uint8_t group;
+};
+
+static inline void mec_mr3_walk_init(struct mec_mr3_walk *w, const void *buf,
+                                     size_t len) {
+  mec_mr3_cursor_init(&w->cursor, buf, len);
+  w->nitems = 0;
+  w->remain = 1;
+  w->last_element = false;
+  w->group = 0;
+}
+
+static inline bool mec_mr3_walk_trailer(struct mec_mr3_walk *w) {
+  struct mec_mr3_cursor *c = &w->cursor;
+  if (mec_mr3_cursor_remaining(c) == 0)
+    return true;
+  // else it is missing one byte (nul byte):
+  const unsigned char *padding =
+      (const unsigned char *)mec_mr3_cursor_take(c, 1);
+  if (!padding || *padding != 0)
+    return false;
+  // make sure the whole input was processed:
+  return mec_mr3_cursor_remaining(c) == 0;
+}
+
+/* read next item. Return 1 when an item was read, 0 once the whole blob was
+ * consumed and -1 on invalid layout, which includes more than 255 groups.
+ * Must not be called again after it returned 0 or -1. */
+static inline int mec_mr3_walk_next(struct mec_mr3_walk *w,
+                                    struct mec_mr3_item *item) {
+  struct mec_mr3_cursor *c = &w->cursor;
+  if (w->nitems == 0) {
+    uint32_t nitems;
+    if (!w->last_element) {
+      // read until last set of group found:
+      if (!mec_mr3_cursor_u32(c, &nitems) || nitems == 0)
+        return -1;
+      if (nitems <= 3) {
+        // special case to handle last element
+        w->remain = nitems;
+        w->last_element = true;
+        if (!mec_mr3_cursor_u32(c, &nitems) || nitems == 0)
+          return -1;
+      }
+    } else {
+      // read remaining groups:
+      if (--w->remain == 0)
+        return mec_mr3_walk_trailer(w) ? 0 : -1;
+      if (!mec_mr3_cursor_u32(c, &nitems) || nitems <= 3)
+        return -1;
+    }
+    // groups are numbered on 8 bits:
+    if (w->group == UINT8_MAX)
+      return -1;
+    ++w->group;
+    w->nitems = nitems;
+  }
+  --w->nitems;
+  item->group = w->group;
+  return mec_mr3_cursor_item(c, item) ? 1 : -1;
+}
@@ -0,0 +1,95 @@
+#include "mec_mr3_private.h"
+
+#include <string.h>
+
+// 11/12/2002,11:27:32, '0' stands for any digit
+static const char datetime_format[] = "00/00/0000,00:00:00";
+
+enum { DATETIME_LEN = sizeof datetime_format - 1 };
+
+struct date {
+  int64_t year;
+  unsigned month;
+  unsigned day;
+};
+
+// days since 1970-01-01 in the proleptic gregorian calendar, see
+// http://howardhinnant.github.io/date_algorithms.html
+static int64_t days_from_civil(const struct date *date) {
+  const int64_t y = date->year - (date->month <= 2);
+  const int64_t era = (y >= 0 ? y : y - 399) / 400;
+  const unsigned yoe = (unsigned)(y - era * 400);
+  const unsigned mp = date->month > 2 ? date->month - 3 : date->month + 9;
+  const unsigned doy = (153 * mp + 2) / 5 + date->day - 1;
+  const unsigned doe = yoe * 365 + yoe / 4 - yoe / 100 + doy;
+  return era * 146097 + (int64_t)doe - 719468;
+}
+
+static void civil_from_days(int64_t z, struct date *date) {
+  z += 719468;
+  const int64_t era = (z >= 0 ? z : z - 146096) / 146097;
+  const unsigned doe = (unsigned)(z - era * 146097);
+  const unsigned yoe = (doe - doe / 1460 + doe / 36524 - doe / 146096) / 365;
+  const unsigned doy = doe - (365 * yoe + yoe / 4 - yoe / 100);
+  const unsigned mp = (5 * doy + 2) / 153;
+  date->day = doy - (153 * mp + 2) / 5 + 1;
+  date->month = mp < 10 ? mp + 3 : mp - 9;
+  date->year = (int64_t)yoe + era * 400 + (date->month <= 2);
+}
+
+static unsigned parse_digits(const char *str, int n) {
+  unsigned v = 0;
+  int i;
+  for (i = 0; i < n; ++i)
+    v = v * 10 + (unsigned)(str[i] - '0');
+  return v;
+}
+
+static void format_digits(char *str, int n, unsigned v) {
+  int i;
+  for (i = n - 1; i >= 0; --i) {
+    str[i] = (char)('0' + v % 10);
+    v /= 10;
+  }
+}
+
+static bool parse_date(const char *str, size_t len, struct date *date) {
+  // optionally nul terminated:
+  if (len < DATETIME_LEN || strnlen(str, len) != DATETIME_LEN)
+    return false;
+  size_t i;
+  for (i = 0; i < DATETIME_LEN; ++i) {
+    const bool good = datetime_format[i] == '0'
+                          ? str[i] >= '0' && str[i] <= '9'
+                          : str[i] == datetime_format[i];
+    if (!good)
+      return false;
+  }
+  date->day = parse_digits(str, 2);
+  date->month = parse_digits(str + 3, 2);
+  date->year = parse_digits(str + 6, 4);
+  if (date->month < 1 || date->month > 12 || date->day < 1)
+    return false;
+  // the day must exist, it would not round trip otherwise:
+  struct date check;
+  civil_from_days(days_from_civil(date), &check);
+  return check.day == date->day;
+}
+
+bool mec_mr3_datetime_check(const char *str, size_t len, int days) {
+  struct date date;
+  if (!parse_date(str, len, &date))
+    return false;
+  civil_from_days(days_from_civil(&date) + days, &date);
+  return date.year >= 0 && date.year <= 9999;
+}
+
+void mec_mr3_datetime_shift(char *str, size_t len, int days) {
+  struct date date;
+  if (days == 0 || !parse_date(str, len, &date))
+    return;
+  civil_from_days(days_from_civil(&date) + days, &date);
+  format_digits(str, 2, date.day);
+  format_digits(str + 3, 2, date.month);
+  format_digits(str + 6, 4, (unsigned)date.year);
+}
@@ -791,6 +791,22 @@ void check_mec_mr3_dict() {
   }
 }
 
+// the dictionary is sorted by group then key, see check_mec_mr3_dict
+static const struct mec_mr3_dict *find(const uint8_t group,
+                                       const uint32_t key) {
+  uint32_t lo = 0, hi = dict_size;
+  while (lo < hi) {
+    const uint32_t mid = lo + (hi - lo) / 2;
+    const struct mec_mr3_dict *d = dict + mid;
+    if (d->group < group || (d->group == group && d->key < key))
+      lo = mid + 1;
+    else
+      hi = mid;
+  }
+  const struct mec_mr3_dict *d = dict + lo;
+  return lo < dict_size && d->group == group && d->key == key ? d : NULL;
+}
+
 bool check_mec_mr3_info(const uint8_t group, const uint32_t key,
                         const uint32_t type) {
   assert(group > 0x0 && group < 0x9);
@@ -798,24 +814,14 @@ bool check_mec_mr3_info(const uint8_t group, const uint32_t key,
   assert((type & 0x000000ff) == 0x0);
   const uint32_t sign = type >> 24u;
   assert(sign == 0x0 || sign == 0xff);
-  bool found = false;
-  for (uint32_t i = 0; i < dict_size; ++i) {
-    const struct mec_mr3_dict *d = dict + i;
-    if (group == d->group && key == d->key) {
-      assert(d->type == type);
-      found = true;
-    }
-  }
-  return found;
+  const struct mec_mr3_dict *d = find(group, key);
+  if (!d)
+    return false;
+  assert(d->type == type);
+  return true;
 }
 
 const char *get_mec_mr3_info_name(const uint8_t group, const uint32_t key) {
-  const char *ret = NULL;
-  for (uint32_t i = 0; i < dict_size; ++i) {
-    const struct mec_mr3_dict *d = dict + i;
-    if (group == d->group && key == d->key) {
-      ret = d->name;
-    }
-  }
-  return ret;
+  const struct mec_mr3_dict *d = find(group, key);
+  return d ? d->name : NULL;
 }
@@ -0,0 +1,165 @@
+#include "mec_mr3_doc.h"
+
+#include "mec_mr3_private.h"
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+enum { INITIAL_CAPACITY = 1024 }; // blobs in the wild have about 700 items
+
+/* open addressing table of a group, at most half full: slots[first + h] for h
+ * in [0, mask] hold index + 1 of the items, 0 being empty. */
+struct table {
+  uint32_t first;
+  uint32_t mask;
+};
+
+struct index {
+  uint32_t ngroups;
+  const uint32_t *slots;
+  struct table tables[]; // of groups 1 to ngroups, at [group - 1]
+};
+
+static inline uint32_t hash_key(uint32_t key) {
+  return (uint32_t)((key * UINT64_C(0x9e3779b97f4a7c15)) >> 32);
+}
+
+// move the columns to a block of capacity entries, as one allocation
+static bool reserve(struct mec_mr3_doc *doc, size_t capacity) {
+  const size_t entry = 4 * sizeof(uint32_t) + sizeof(uint8_t);
+  if (capacity > SIZE_MAX / entry)
+    return false;
+  uint32_t *block = mec_mr3_malloc(capacity * entry);
+  if (!block)
+    return false;
+  uint32_t *keys = block;
+  uint32_t *types = keys + capacity;
+  uint32_t *offsets = types + capacity;
+  uint32_t *lens = offsets + capacity;
+  uint8_t *groups = (uint8_t *)(lens + capacity);
+  if (doc->n) {
+    memcpy(keys, doc->keys, doc->n * sizeof *keys);
+    memcpy(types, doc->types, doc->n * sizeof *types);
+    memcpy(offsets, doc->offsets, doc->n * sizeof *offsets);
+    memcpy(lens, doc->lens, doc->n * sizeof *lens);
+    memcpy(groups, doc->groups, doc->n * sizeof *groups);
+  }
+  free(doc->keys);
+  doc->keys = keys;
+  doc->types = types;
+  doc->offsets = offsets;
+  doc->lens = lens;
+  doc->groups = groups;
+  return true;
+}
+
+static struct index *build_index(const struct mec_mr3_doc *doc,
+                                 uint32_t ngroups) {
+  size_t *counts = mec_mr3_calloc(ngroups, sizeof *counts);
+  if (!counts)
+    return NULL;
+  size_t i;
+  for (i = 0; i < doc->n; ++i)
+    ++counts[doc->groups[i] - 1];
+  const size_t header = sizeof(struct index) + ngroups * sizeof(struct table);
+  uint32_t g;
+  size_t nslots = 0;
+  for (g = 0; g < ngroups; ++g) {
+    size_t size = 2;
+    while (size < 2 * counts[g])
+      size *= 2;
+    counts[g] = size;
+    nslots += size;
+  }
+  struct index *index = mec_mr3_calloc(1, header + nslots * sizeof(uint32_t));
+  if (!index) {
+    free(counts);
+    return NULL;
+  }
+  uint32_t *slots = (uint32_t *)((char *)index + header);
+  index->ngroups = ngroups;
+  index->slots = slots;
+  uint32_t first = 0;
+  for (g = 0; g < ngroups; ++g) {
+    index->tables[g].first = first;
+    index->tables[g].mask = (uint32_t)counts[g] - 1;
+    first += (uint32_t)counts[g];
+  }
+  free(counts);
+  for (i = 0; i < doc->n; ++i) {
+    const struct table *t = index->tables + doc->groups[i] - 1;
+    uint32_t h = hash_key(doc->keys[i]);
+    for (;; ++h) {
+      uint32_t *slot = slots + t->first + (h & t->mask);
+      if (*slot == 0) {
+        *slot = (uint32_t)i + 1;
+        break;
+      }
+      if (doc->keys[*slot - 1] == doc->keys[i])
+        break; // repeated key, keep the first one
+    }
+  }
+  return index;
+}
+
+struct mec_mr3_doc *mec_mr3_doc_parse(const void *input, size_t len) {
+  // offsets are stored on 32 bits, n fits as well:
+  if (len > UINT32_MAX)
+    return NULL;
+  struct mec_mr3_doc *doc = mec_mr3_calloc(1, sizeof *doc);
+  if (!doc)
+    return NULL;
+  doc->input = input;
+  size_t capacity = INITIAL_CAPACITY;
+  if (!reserve(doc, capacity)) {
+    free(doc);
+    return NULL;
+  }
+  struct mec_mr3_walk w;
+  struct mec_mr3_item item;
+  int ret;
+  mec_mr3_walk_init(&w, input, len);
+  while ((ret = mec_mr3_walk_next(&w, &item)) == 1) {
+    if (doc->n == capacity) {
+      capacity *= 2;
+      if (!reserve(doc, capacity))
+        break;
+    }
+    const size_t i = doc->n++;
+    doc->keys[i] = item.key;
+    doc->types[i] = item.type;
+    doc->offsets[i] = (uint32_t)((const unsigned char *)item.data - doc->input);
+    doc->lens[i] = item.len;
+    doc->groups[i] = item.group;
+  }
+  if (ret != 0 || !(doc->index = build_index(doc, w.group))) {
+    mec_mr3_doc_free(doc);
+    return NULL;
+  }
+  return doc;
+}
+
+void mec_mr3_doc_free(struct mec_mr3_doc *doc) {
+  if (!doc)
+    return;
+  free(doc->index);
+  free(doc->keys);
+  free(doc);
+}
+
+size_t mec_mr3_doc_find(const struct mec_mr3_doc *doc, uint8_t group,
+                        uint32_t key) {
+  const struct index *index = doc->index;
+  if (group == 0 || group > index->ngroups)
+    return doc->n;
+  const struct table *t = index->tables + group - 1;
+  uint32_t h = hash_key(key);
+  for (;; ++h) {
+    const uint32_t slot = index->slots[t->first + (h & t->mask)];
+    if (slot == 0)
+      return doc->n;
+    if (doc->keys[slot - 1] == key)
+      return slot - 1;
+  }
+}
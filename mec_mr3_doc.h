@@ -0,0 +1,62 @@
+#pragma once
+
+#include "mec_mr3_cursor.h"
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* index of the items of a blob, built in one pass over the item headers:
+ * payloads are not read. Columns are parallel arrays of n entries in blob
+ * order, item i being key keys[i] of group groups[i] with lens[i] bytes of
+ * payload at input + offsets[i]. The input is not copied, it must outlive the
+ * doc. */
+struct mec_mr3_doc {
+  const unsigned char *input;
+  size_t n;
+  uint32_t *keys;
+  uint32_t *types;
+  uint32_t *offsets;
+  uint32_t *lens;
+  uint8_t *groups;
+  void *index; // key to item tables, one per group
+};
+
+/* Return NULL on invalid layout or allocation failure. */
+struct mec_mr3_doc *mec_mr3_doc_parse(const void *input, size_t len);
+
+void mec_mr3_doc_free(struct mec_mr3_doc *doc);
+
+/* index of the item of group and key (the first one when the key is repeated
+ * within the group), doc->n when there is none. Constant time. */
+size_t mec_mr3_doc_find(const struct mec_mr3_doc *doc, uint8_t group,
+                        uint32_t key);
+
+static inline void mec_mr3_doc_item(const struct mec_mr3_doc *doc, size_t i,
+                                    struct mec_mr3_item *item) {
+  item->group = doc->groups[i];
+  item->key = doc->keys[i];
+  item->type = doc->types[i];
+  item->len = doc->lens[i];
+  item->data = doc->input + doc->offsets[i];
+}
+
+/* item of group and key, e.g. imaging frequency (1,013ec). Return false when
+ * there is none. */
+static inline bool mec_mr3_doc_get(const struct mec_mr3_doc *doc,
+                                   uint8_t group, uint32_t key,
+                                   struct mec_mr3_item *item) {
+  const size_t i = mec_mr3_doc_find(doc, group, key);
+  if (i == doc->n)
+    return false;
+  mec_mr3_doc_item(doc, i, item);
+  return true;
+}
+
+#ifdef __cplusplus
+} /* end extern "C" */
+#endif
@@ -0,0 +1,150 @@
+#define _XOPEN_SOURCE 700 /* posix_fallocate */
+
+#include "mec_mr3_file.h"
+
+#include "mec_mr3.h"
+#include "mec_mr3_manifest.h"
+#include "mec_mr3_verify.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stddef.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+struct mapping {
+  int fd;
+  void *addr;
+  size_t len;
+  bool writable; // flushed by unmap_file
+  struct stat st;
+};
+
+static bool map_file(struct mapping *m, const char *filename, bool writable) {
+  m->addr = MAP_FAILED;
+  m->writable = writable;
+  m->fd = open(filename, writable ? O_RDWR : O_RDONLY);
+  if (m->fd < 0)
+    return false;
+  struct stat *st = &m->st;
+  if (fstat(m->fd, st) != 0 || !S_ISREG(st->st_mode) || st->st_size == 0)
+    return false;
+  m->len = (size_t)st->st_size;
+  const int prot = writable ? PROT_READ | PROT_WRITE : PROT_READ;
+  m->addr = mmap(NULL, m->len, prot, MAP_SHARED, m->fd, 0);
+  return m->addr != MAP_FAILED;
+}
+
+static bool create_file(struct mapping *m, const char *filename,
+                        const struct mapping *in) {
+  m->addr = MAP_FAILED;
+  m->fd = -1;
+  m->len = in->len;
+  m->writable = true;
+  // truncating the input would pull the mapping from under our feet:
+  struct stat st;
+  if (stat(filename, &st) == 0 && st.st_dev == in->st.st_dev &&
+      st.st_ino == in->st.st_ino)
+    return false;
+  m->fd = open(filename, O_RDWR | O_CREAT | O_TRUNC, 0666);
+  if (m->fd < 0)
+    return false;
+  // allocate the blocks now: running out of space while writing through the
+  // mapping would raise SIGBUS instead of failing
+  if (posix_fallocate(m->fd, 0, (off_t)m->len) != 0)
+    return false;
+  m->addr = mmap(NULL, m->len, PROT_READ | PROT_WRITE, MAP_SHARED, m->fd, 0);
+  return m->addr != MAP_FAILED;
+}
+
+// the write errors of a shared mapping only show up when it is flushed
+static bool unmap_file(struct mapping *m) {
+  bool good = true;
+  if (m->addr != MAP_FAILED) {
+    if (m->writable)
+      good = msync(m->addr, m->len, MS_SYNC) == 0;
+    good = munmap(m->addr, m->len) == 0 && good;
+  }
+  if (m->fd >= 0)
+    good = close(m->fd) == 0 && good;
+  return good;
+}
+
+bool mec_mr3_scrub_file(const char *infilename, const char *outfilename,
+                        const struct mec_mr3_options *options) {
+  struct mapping in;
+  struct mapping out;
+  bool good = map_file(&in, infilename, false);
+  if (good) {
+    good = create_file(&out, outfilename, &in);
+    const bool created = out.fd >= 0;
+    good = good && mec_mr3_scrub_ex(out.addr, in.addr, in.len, options);
+    good = unmap_file(&out) && good;
+    if (!good && created)
+      unlink(outfilename);
+  }
+  good = unmap_file(&in) && good;
+  return good;
+}
+
+// a manifest wants its records even for blank fields
+static int needs_scrub(const struct mapping *m,
+                       const struct mec_mr3_options *options) {
+  if (options && options->manifest)
+    return 1;
+  return mec_mr3_needs_scrub(m->addr, m->len, options);
+}
+
+bool mec_mr3_scrub_file_link(const char *infilename, const char *outfilename,
+                             const struct mec_mr3_options *options) {
+  struct mapping in;
+  bool good = map_file(&in, infilename, false);
+  const int needs = good ? needs_scrub(&in, options) : -1;
+  good = unmap_file(&in) && good;
+  if (!good || needs == -1)
+    return false;
+  if (needs == 0) {
+    struct stat st;
+    // do not unlink the input itself:
+    if (stat(outfilename, &st) == 0 && st.st_dev == in.st.st_dev &&
+        st.st_ino == in.st.st_ino)
+      return false;
+    if ((unlink(outfilename) == 0 || errno == ENOENT) &&
+        link(infilename, outfilename) == 0)
+      return true;
+    // cross device, or no hard links on this file system
+  }
+  return mec_mr3_scrub_file(infilename, outfilename, options);
+}
+
+bool mec_mr3_scrub_file_inplace(const char *filename,
+                                const struct mec_mr3_options *options) {
+  struct mapping m;
+  bool good = map_file(&m, filename, true);
+  // even rewriting identical bytes would dirty the pages:
+  const int needs = good ? needs_scrub(&m, options) : -1;
+  good = needs == 0 ||
+         (needs == 1 && mec_mr3_scrub_ex(m.addr, m.addr, m.len, options));
+  good = unmap_file(&m) && good;
+  return good;
+}
+
+bool mec_mr3_manifest_apply_file(const char *filename, const void *manifest,
+                                 size_t size, const unsigned char *key) {
+  struct mapping m;
+  bool good = map_file(&m, filename, true);
+  good = good && mec_mr3_manifest_apply(m.addr, m.len, manifest, size, key);
+  good = unmap_file(&m) && good;
+  return good;
+}
+
+bool mec_mr3_verify_file(const char *filename,
+                         const struct mec_mr3_options *options,
+                         struct mec_mr3_verify_report *report) {
+  struct mapping m;
+  bool good = map_file(&m, filename, false);
+  good = good && mec_mr3_verify_scrubbed(m.addr, m.len, options, report);
+  good = unmap_file(&m) && good;
+  return good;
+}
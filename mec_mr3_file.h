@@ -0,0 +1,43 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+
+struct mec_mr3_options;
+struct mec_mr3_verify_report;
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* scrub infilename into outfilename. Both files are mapped in memory, the
+ * output is created (or truncated) to the size of the input and removed on
+ * failure. Its blocks are allocated up front, so a full disk fails the call,
+ * and it is flushed to disk before returning. options may be NULL. */
+bool mec_mr3_scrub_file(const char *infilename, const char *outfilename,
+                        const struct mec_mr3_options *options);
+
+/* same as mec_mr3_scrub_file, but when the input is already clean (see
+ * mec_mr3_needs_scrub) the output is made a hard link to it instead of a copy.
+ * Falls back to a copy when the link can not be made. */
+bool mec_mr3_scrub_file_link(const char *infilename, const char *outfilename,
+                             const struct mec_mr3_options *options);
+
+/* scrub filename in place, only pages holding PHI are written back and they
+ * are flushed to disk before returning. Nothing at all is written when the
+ * file is already clean. */
+bool mec_mr3_scrub_file_inplace(const char *filename,
+                                const struct mec_mr3_options *options);
+
+/* mec_mr3_manifest_apply on a writable mapping of filename */
+bool mec_mr3_manifest_apply_file(const char *filename, const void *manifest,
+                                 size_t size, const unsigned char *key);
+
+/* mec_mr3_verify_scrubbed on a mapping of filename */
+bool mec_mr3_verify_file(const char *filename,
+                         const struct mec_mr3_options *options,
+                         struct mec_mr3_verify_report *report);
+
+#ifdef __cplusplus
+} /* end extern "C" */
+#endif
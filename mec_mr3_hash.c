@@ -0,0 +1,186 @@
+#include "mec_mr3_hash.h"
+
+#include <stdio.h>
+#include <string.h>
+
+static inline uint64_t load64(const unsigned char *p) {
+  // little endian, independent of the host:
+  return (uint64_t)p[0] | (uint64_t)p[1] << 8 | (uint64_t)p[2] << 16 |
+         (uint64_t)p[3] << 24 | (uint64_t)p[4] << 32 | (uint64_t)p[5] << 40 |
+         (uint64_t)p[6] << 48 | (uint64_t)p[7] << 56;
+}
+
+static inline uint64_t rotl(uint64_t x, int b) {
+  return (x << b) | (x >> (64 - b));
+}
+
+#define SIPROUND                                                               \
+  do {                                                                         \
+    v0 += v1;                                                                  \
+    v1 = rotl(v1, 13);                                                         \
+    v1 ^= v0;                                                                  \
+    v0 = rotl(v0, 32);                                                         \
+    v2 += v3;                                                                  \
+    v3 = rotl(v3, 16);                                                         \
+    v3 ^= v2;                                                                  \
+    v0 += v3;                                                                  \
+    v3 = rotl(v3, 21);                                                         \
+    v3 ^= v0;                                                                  \
+    v2 += v1;                                                                  \
+    v1 = rotl(v1, 17);                                                         \
+    v1 ^= v2;                                                                  \
+    v2 = rotl(v2, 32);                                                         \
+  } while (0)
+
+#define SIPHASH_INIT                                                           \
+  uint64_t v0 = 0x736f6d6570736575ULL ^ k0;                                    \
+  uint64_t v1 = 0x646f72616e646f6dULL ^ k1;                                    \
+  uint64_t v2 = 0x6c7967656e657261ULL ^ k0;                                    \
+  uint64_t v3 = 0x7465646279746573ULL ^ k1
+
+#define COMPRESS(b)                                                            \
+  do {                                                                         \
+    v3 ^= (b);                                                                 \
+    SIPROUND;                                                                  \
+    SIPROUND;                                                                  \
+    v0 ^= (b);                                                                 \
+  } while (0)
+
+#define FINALIZE                                                               \
+  do {                                                                         \
+    v2 ^= 0xff;                                                                \
+    SIPROUND;                                                                  \
+    SIPROUND;                                                                  \
+    SIPROUND;                                                                  \
+    SIPROUND;                                                                  \
+  } while (0)
+
+static inline uint64_t siphash(uint64_t k0, uint64_t k1, const void *data,
+                               size_t len) {
+  const unsigned char *in = (const unsigned char *)data;
+  SIPHASH_INIT;
+  const unsigned char *end = in + (len & ~(size_t)7);
+  for (; in != end; in += 8)
+    COMPRESS(load64(in));
+  // last block holds the remaining bytes and the length:
+  unsigned char last[8] = {0};
+  memcpy(last, in, len & 7);
+  last[7] = (unsigned char)len;
+  COMPRESS(load64(last));
+  FINALIZE;
+  return v0 ^ v1 ^ v2 ^ v3;
+}
+
+uint64_t mec_mr3_siphash(const unsigned char *key, const void *data,
+                         size_t len) {
+  return siphash(load64(key), load64(key + 8), data, len);
+}
+
+void mec_mr3_siphash_counter(const unsigned char *key, uint64_t seed,
+                             uint64_t first, size_t n, uint64_t *out) {
+  const uint64_t k0 = load64(key);
+  const uint64_t k1 = load64(key + 8);
+  SIPHASH_INIT;
+  // the seed block is common to every output, compressed once:
+  COMPRESS(seed);
+  const uint64_t u0 = v0, u1 = v1, u2 = v2, u3 = v3;
+  const uint64_t last = (uint64_t)16 << 56; // no remaining bytes
+  size_t i;
+  for (i = 0; i < n; ++i) {
+    v0 = u0;
+    v1 = u1;
+    v2 = u2;
+    v3 = u3;
+    COMPRESS(first + i);
+    COMPRESS(last);
+    FINALIZE;
+    out[i] = v0 ^ v1 ^ v2 ^ v3;
+  }
+}
+
+#undef FINALIZE
+#undef COMPRESS
+#undef SIPHASH_INIT
+#undef SIPROUND
+
+static const uint64_t prime1 = 0x9e3779b185ebca87ULL;
+static const uint64_t prime2 = 0xc2b2ae3d27d4eb4fULL;
+static const uint64_t prime3 = 0x165667b19e3779f9ULL;
+static const uint64_t prime4 = 0x85ebca77c2b2ae63ULL;
+static const uint64_t prime5 = 0x27d4eb2f165667c5ULL;
+
+static inline uint32_t load32(const unsigned char *p) {
+  return (uint32_t)p[0] | (uint32_t)p[1] << 8 | (uint32_t)p[2] << 16 |
+         (uint32_t)p[3] << 24;
+}
+
+static inline uint64_t xxh_round(uint64_t acc, uint64_t input) {
+  acc += input * prime2;
+  acc = rotl(acc, 31);
+  return acc * prime1;
+}
+
+static inline uint64_t xxh_merge(uint64_t acc, uint64_t val) {
+  acc ^= xxh_round(0, val);
+  return acc * prime1 + prime4;
+}
+
+uint64_t mec_mr3_xxh64(const void *data, size_t len, uint64_t seed) {
+  const unsigned char *p = (const unsigned char *)data;
+  const unsigned char *end = p + len;
+  uint64_t h;
+  if (len >= 32) {
+    uint64_t v1 = seed + prime1 + prime2;
+    uint64_t v2 = seed + prime2;
+    uint64_t v3 = seed;
+    uint64_t v4 = seed - prime1;
+    const unsigned char *limit = end - 32;
+    do {
+      v1 = xxh_round(v1, load64(p));
+      v2 = xxh_round(v2, load64(p + 8));
+      v3 = xxh_round(v3, load64(p + 16));
+      v4 = xxh_round(v4, load64(p + 24));
+      p += 32;
+    } while (p <= limit);
+    h = rotl(v1, 1) + rotl(v2, 7) + rotl(v3, 12) + rotl(v4, 18);
+    h = xxh_merge(h, v1);
+    h = xxh_merge(h, v2);
+    h = xxh_merge(h, v3);
+    h = xxh_merge(h, v4);
+  } else {
+    h = seed + prime5;
+  }
+  h += (uint64_t)len;
+  for (; p + 8 <= end; p += 8) {
+    h ^= xxh_round(0, load64(p));
+    h = rotl(h, 27) * prime1 + prime4;
+  }
+  if (p + 4 <= end) {
+    h ^= (uint64_t)load32(p) * prime1;
+    h = rotl(h, 23) * prime2 + prime3;
+    p += 4;
+  }
+  for (; p < end; ++p) {
+    h ^= *p * prime5;
+    h = rotl(h, 11) * prime1;
+  }
+  h ^= h >> 33;
+  h *= prime2;
+  h ^= h >> 29;
+  h *= prime3;
+  h ^= h >> 32;
+  return h;
+}
+
+bool mec_mr3_hash_key_load(const char *filename,
+                           unsigned char key[MEC_MR3_HASH_KEY_SIZE]) {
+  FILE *f = fopen(filename, "rb");
+  if (!f)
+    return false;
+  unsigned char extra;
+  const bool good = fread(key, 1, MEC_MR3_HASH_KEY_SIZE, f) ==
+                        MEC_MR3_HASH_KEY_SIZE &&
+                    fread(&extra, 1, 1, f) == 0;
+  fclose(f);
+  return good;
+}
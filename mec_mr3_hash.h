@@ -0,0 +1,33 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+enum { MEC_MR3_HASH_KEY_SIZE = 16 };
+
+/* SipHash-2-4 of len bytes, keyed with MEC_MR3_HASH_KEY_SIZE bytes */
+uint64_t mec_mr3_siphash(const unsigned char *key, const void *data,
+                         size_t len);
+
+/* out[i] = mec_mr3_siphash of the 16 bytes seed, first + i, both little
+ * endian. The seed block is only compressed once, which saves a fifth of the
+ * rounds of n separate calls. */
+void mec_mr3_siphash_counter(const unsigned char *key, uint64_t seed,
+                             uint64_t first, size_t n, uint64_t *out);
+
+/* XXH64 of len bytes, not keyed: only suitable to detect identical inputs,
+ * never to hide their content */
+uint64_t mec_mr3_xxh64(const void *data, size_t len, uint64_t seed);
+
+/* read a key from a file holding exactly MEC_MR3_HASH_KEY_SIZE bytes */
+bool mec_mr3_hash_key_load(const char *filename,
+                           unsigned char key[MEC_MR3_HASH_KEY_SIZE]);
+
+#ifdef __cplusplus
+} /* end extern "C" */
+#endif
@@ -1,6 +1,10 @@
 #include "mec_mr3_io.h"
 
+#include "mec_mr3.h"
+#include "mec_mr3_cursor.h"
 #include "mec_mr3_dict.h"
+#include "mec_mr3_payload.h"
+#include "mec_mr3_sink.h"
 
 #include <assert.h>
 #include <iconv.h>
@@ -10,189 +14,129 @@
 #include <stdlib.h>
 #include <string.h>
 
-struct stream {
-  const void *start;
-  const void *end;
-  void *cur;
-  size_t (*read)(void *ptr, size_t size, size_t nmemb, struct stream *in);
+/* output is gathered in a large buffer and handed to the sink in chunks,
+ * numbers are formatted by hand: no stdio call per value */
+struct out {
+  const struct mec_mr3_sink *sink;
+  bool good; // false once the sink failed
+  size_t written; // handed to the sink
+  size_t n;
+  char buf[64 * 1024];
 };
 
-static size_t stream_read(void *ptr, size_t size, size_t nmemb,
-                          struct stream *in) {
-  char *cur = (char *)in->cur;
-  const char *end = (const char *)in->end;
-  const size_t len = size * nmemb;
-  if (cur + len <= end) {
-    memcpy(ptr, cur, len);
-    in->cur = cur + len;
-  } else {
-    in->cur = NULL;
-    return 0;
+static void out_flush(struct out *o) {
+  if (o->n != 0 && o->good)
+    o->good = o->sink->write(o->buf, o->n, o->sink->user);
+  o->written += o->n;
+  o->n = 0;
+}
+
+static void out_mem(struct out *o, const void *ptr, size_t n) {
+  if (n > sizeof o->buf - o->n) {
+    out_flush(o);
+    if (n > sizeof o->buf) {
+      if (o->good)
+        o->good = o->sink->write(ptr, n, o->sink->user);
+      o->written += n;
+      return;
+    }
   }
-  return nmemb;
+  memcpy(o->buf + o->n, ptr, n);
+  o->n += n;
 }
 
-struct app {
-  struct stream *in;
-  iconv_t conv;
-  void *shift_jis_buffer;
-};
+static inline void out_char(struct out *o, char c) {
+  if (o->n == sizeof o->buf)
+    out_flush(o);
+  o->buf[o->n++] = c;
+}
 
-static struct app *create_app(struct app *self, struct stream *in) {
-  self->in = in;
-  self->conv = iconv_open("utf-8", "shift-jis");
-  assert(self->conv != (iconv_t)-1);
-  self->shift_jis_buffer = NULL;
+// position in the output, see out_rewind
+static inline size_t out_tell(const struct out *o) { return o->written + o->n; }
 
-  return self;
+// drop what was written since pos, if it did not reach the sink yet
+static inline void out_rewind(struct out *o, size_t pos) {
+  if (pos >= o->written)
+    o->n = pos - o->written;
 }
 
-static void setup_buffer(struct app *self, const void *input, size_t len) {
-  self->in->cur = (char *)input;
-  self->in->start = input;
-  self->in->end = (char *)input + len;
-  self->in->read = stream_read;
+static inline void out_str(struct out *o, const char *str) {
+  out_mem(o, str, strlen(str));
 }
 
-#define ERROR_RETURN(X, Y)                                                     \
-  if ((X) != (Y))                                                              \
-  return false
+// at most max bytes of str, up to its terminator
+static inline void out_strn(struct out *o, const char *str, size_t max) {
+  out_mem(o, str, strnlen(str, max));
+}
 
-static size_t fread_mirror(void *ptr, size_t size, size_t nmemb,
-                           struct app *self) {
-  struct stream *instream = self->in;
+static void out_u32(struct out *o, uint32_t v) {
+  char tmp[10];
+  size_t i = sizeof tmp;
+  do {
+    tmp[--i] = (char)('0' + v % 10);
+    v /= 10;
+  } while (v != 0);
+  out_mem(o, tmp + i, sizeof tmp - i);
+}
 
-  size_t s = instream->read(ptr, size, nmemb, instream);
-  if (s == nmemb) {
-    return nmemb;
+static void out_i32(struct out *o, int32_t v) {
+  if (v < 0) {
+    out_char(o, '-');
+    out_u32(o, 0u - (uint32_t)v);
+  } else {
+    out_u32(o, (uint32_t)v);
   }
-  assert(0);
-  return s;
 }
 
-static bool write_trailer(struct app *self) {
-  assert(self->in->cur <= self->in->end);
-  if (self->in->cur == self->in->end)
-    return true;
-  // else it is missing one byte (nul byte):
-  char padding;
-  size_t s = fread_mirror(&padding, sizeof padding, 1, self);
-  ERROR_RETURN(s, 1);
-  ERROR_RETURN(padding, 0);
-
-  return true;
+// lower case, zero padded to width digits
+static void out_hex(struct out *o, uint32_t v, size_t width) {
+  static const char digits[] = "0123456789abcdef";
+  char tmp[8];
+  size_t i = sizeof tmp;
+  do {
+    tmp[--i] = digits[v & 0xf];
+    v >>= 4;
+  } while (v != 0);
+  while (i > sizeof tmp - width)
+    tmp[--i] = '0';
+  out_mem(o, tmp + i, sizeof tmp - i);
 }
 
-struct mec_mr3_info {
-  uint32_t key;
-  uint32_t type;
-};
+// floating point keeps the printf formatting, snprintf takes no lock
+static void out_double(struct out *o, const char *format, double v) {
+  char tmp[512]; // %f of FLT_MAX is 46 bytes
+  const int n = snprintf(tmp, sizeof tmp, format, v);
+  if (n > 0)
+    out_mem(o, tmp, (size_t)n < sizeof tmp ? (size_t)n : sizeof tmp - 1);
+}
 
-struct mec_mr3_item_data {
-  uint32_t len;
-  void *buffer;
-  size_t size; // aligned/realloc implementation detail
+struct app {
+  iconv_t conv;
+  void *shift_jis_buffer;
+  struct out *out;
 };
 
-static const unsigned char magic2[] = {0, 0, 0, 0, 0, 0, 0, 0, 0xc, 0,
-                                       0, 0, 0, 0, 0, 0, 0, 0, 0,   0};
-
-static bool read_info(struct app *self, const uint8_t group,
-                      struct mec_mr3_info *info) {
-  // read key and type at once:
-  size_t s = fread_mirror(info, sizeof *info, 1, self);
-  ERROR_RETURN(s, 1);
-  bool found = check_mec_mr3_info(group, info->key, info->type);
-  ERROR_RETURN(found, true);
-
-  return true;
-}
+static struct app *create_app(struct app *self, struct out *out) {
+  self->conv = iconv_open("utf-8", "shift-jis");
+  assert(self->conv != (iconv_t)-1);
+  self->shift_jis_buffer = NULL;
+  self->out = out;
 
-static void *aligned_alloc_impl(size_t alignment, size_t size) {
-  return aligned_alloc(alignment, size);
+  return self;
 }
 
-static struct mec_mr3_item_data *
-mec_mr3_aligned_realloc(struct mec_mr3_item_data *data, size_t size) {
-  if (!data)
-    return NULL;
-  // fast path
-  if (size <= data->size) {
-    return data;
-  }
-  // else need to reallocate
-  const size_t guesstimate = size < 4096 ? 4096 : 2 * size;
-  void *buffer = aligned_alloc_impl(64u, guesstimate);
-  if (!buffer)
-    return NULL;
-  if (data->buffer)
-    free(data->buffer);
-  data->buffer = buffer;
-  data->size = guesstimate;
-  return data;
-}
-
-static inline bool is_aligned(const void *restrict pointer, size_t byte_count) {
-  // https://stackoverflow.com/questions/1898153/how-to-determine-if-memory-is-aligned
-  return (uintptr_t)pointer % byte_count == 0;
-}
-
-static bool read_data(struct app *self, const uint8_t group,
-                      const struct mec_mr3_info *info,
-                      struct mec_mr3_item_data *data) {
-  (void)group;
-  (void)info;
-  size_t s = fread_mirror(&data->len, sizeof data->len, 1, self);
-  ERROR_RETURN(s, 1);
-  // in the wild we have: data->len <= 9509
-  unsigned char separator[20];
-  s = fread_mirror(separator, sizeof *separator,
-                   sizeof separator / sizeof *separator, self);
-  ERROR_RETURN(s, sizeof separator / sizeof *separator);
-  int b = memcmp(separator, magic2, sizeof(magic2));
-  ERROR_RETURN(b, 0);
-  data = mec_mr3_aligned_realloc(data, data->len);
-  if (data == NULL) {
-    return false;
-  }
+#define ERROR_RETURN(X, Y)                                                     \
+  if ((X) != (Y))                                                              \
+  return false
 
-  s = fread_mirror(data->buffer, 1, data->len, self);
-  ERROR_RETURN(s, data->len);
+static bool read_info(struct app *self, const struct mec_mr3_item *item) {
+  (void)self;
+  bool found = check_mec_mr3_info(item->group, item->key, item->type);
+  ERROR_RETURN(found, true);
 
   return true;
 }
 
-enum Type {
-  ISO_8859_1_STRING =
-      0x00000300, // ASCII string / or struct with 'ISO-8859-1' marker
-  FLOAT32_VM2N = 0x00000500, // float/32bits VM:2n
-  FLOAT32_VM3N = 0x00000600, // float/32bits VM:3n
-  DATETIME = 0x00000e00,     // Date/Time stored as ASCII
-  STRUCT_136 = 0x001f4100, // Fixed struct 136 bytes (struct with ASCII strings)
-  STRUCT_436 = 0x001f4300, // Fixed struct 436 bytes (struct with ASCII strings)
-  STRUCT_516 = 0x001f4400, // Fixed struct 516 bytes (struct with ASCII strings)
-  STRUCT_325 = 0x001f4600, // Fixed struct 325 bytes (struct with ASCII strings)
-  BOOL_04 = 0xff000400,    // bool/32bits
-  FLOAT32_VM1 = 0xff000800,      // float/32bits
-  INT32_VM1N = 0xff002400,       // int32_t (signed)
-  FLOAT32_VM1N = 0xff002800,     // float/32bits
-  FLOAT64_VM1 = 0xff002900,      // float/64bits
-  BOOL_2A = 0xff002a00,          // bool/32bits
-  SHIFT_JIS_STRING = 0xff002c00, // SHIFT-JIS string
-};
-
-struct buffer19 {
-  char sig1[0x3];
-  unsigned char len2;
-  char sig2;
-  unsigned char len3;
-  char sig3;
-  char iso[0x9];
-  char sig4;
-  unsigned char len4;
-  char sig5;
-};
-
 static void dump2file(const char *in, int len) {
   static int debug = 0;
   char buffer[512];
@@ -203,55 +147,50 @@ static void dump2file(const char *in, int len) {
   fclose(f);
 }
 
-static bool print_iso(void *ptr, size_t size, size_t nmemb, struct app *self) {
+static bool print_iso(const void *ptr, size_t size, size_t nmemb,
+                      struct app *self) {
   assert(size == 1);
-  static const char magic[] = {0xdf, 0xff, 0x79};
-  if (nmemb >= sizeof magic && memcmp(ptr, magic, sizeof(magic)) == 0) {
-    // iso
-    struct buffer19 b19;
-    if (nmemb < sizeof b19)
-      return 0;
-    memcpy(&b19, ptr, sizeof b19);
-    if (b19.sig2 != 0x1 || b19.sig3 != 0x0 || b19.sig4 != 0x2 ||
-        b19.sig5 != 0x0)
-      return 0;
-    const size_t diff = nmemb - sizeof b19;
-    if (b19.len2 != nmemb - 4 || b19.len3 != 9 || b19.len4 != diff)
+  if (mec_mr3_is_iso(ptr, nmemb)) {
+    size_t len;
+    // iconv does not modify its input:
+    char *str = (char *)mec_mr3_iso_string(ptr, nmemb, &len);
+    if (!str)
       return 0;
-    if (strncmp(b19.iso, "ISO8859-1", 9) != 0)
-      return 0;
-    char *str = (char *)ptr + sizeof b19;
     {
       char *gbk_str = str;
       char dest_str[100];
       char *out = dest_str;
-      size_t inbytes = b19.len4;
+      size_t inbytes = len;
       size_t outbytes = sizeof dest_str;
       if (iconv(self->conv, &gbk_str, &inbytes, &out, &outbytes) ==
           (size_t)-1) {
         dump2file(gbk_str, inbytes);
-        printf("{%.*s : %.*s}", 9, b19.iso, b19.len4, str);
-        fflush(stdout);
+        out_str(self->out, "{ISO8859-1 : ");
+        out_strn(self->out, str, len);
+        out_char(self->out, '}');
+        out_flush(self->out);
         assert(0);
       }
       dest_str[sizeof dest_str - outbytes] = 0;
-      // printf("{%.*s : %.*s}", 9, b19.iso, (int)outbytes, dest_str);
-      printf("{%.*s : %s}", 9, b19.iso, dest_str);
+      out_str(self->out, "{ISO8859-1 : ");
+      out_str(self->out, dest_str);
+      out_char(self->out, '}');
     }
   } else {
     // raw string buffer
-    printf("[%.*s]", (int)nmemb, (char *)ptr);
+    out_char(self->out, '[');
+    out_strn(self->out, ptr, nmemb);
+    out_char(self->out, ']');
   }
   return true;
 }
 
-static bool print_datetime(void *ptr, size_t size, size_t nmemb,
+static bool print_datetime(const void *ptr, size_t size, size_t nmemb,
                            struct app *self) {
   // 11/12/2002,11:27:32
   assert(size == 1);
-  (void)self;
   assert(nmemb == 19 || nmemb == 20);
-  char *str = (char *)ptr;
+  const char *str = (const char *)ptr;
   size_t i;
   const size_t len = strnlen(str, nmemb);
   assert(len == 19);
@@ -260,37 +199,30 @@ static bool print_datetime(void *ptr, size_t size, size_t nmemb,
            str[i] == ':');
   }
 
-  printf("[%.*s]", (int)nmemb, str);
+  out_char(self->out, '[');
+  out_strn(self->out, str, nmemb);
+  out_char(self->out, ']');
   return true;
 }
 
-typedef char str16[16 + 1];
-typedef char str64[64 + 1];
+// print a fixed size string field, followed by sep
+#define OUT_FIELD(o, field, sep)                                               \
+  out_strn(o, field, sizeof(field));                                           \
+  out_char(o, sep)
 
-struct buffer136 {
-  uint32_t zero1;
-  str64 uid1; // Detached Study Management SOP Class (1.2.840.10008.3.1.2.3.1) ?
-  str64 uid2; // 1.2.840.113745.101000.1098000.X.Y.Z
-  uint16_t zero2;
-};
-
-void print_buffer136(struct buffer136 *b136) {
+static void print_buffer136(struct buffer136 *b136, struct out *o) {
   assert(b136->zero1 == 0);
   assert(b136->zero2 == 0);
-  printf("{%u,%s,%s,%hu}", b136->zero1, b136->uid1, b136->uid2, b136->zero2);
+  out_char(o, '{');
+  out_u32(o, b136->zero1);
+  out_char(o, ',');
+  OUT_FIELD(o, b136->uid1, ',');
+  OUT_FIELD(o, b136->uid2, ',');
+  out_u32(o, b136->zero2);
+  out_char(o, '}');
 }
 
-struct buffer436 {
-  uint32_t zero;
-  char iver[0x45];
-  char buf3[0x100]; // phi
-  str64 buf4;
-  str16 buf5;
-  char modality[0x15];
-  uint32_t val;
-};
-
-static void print_buffer436(struct buffer436 *b436) {
+static void print_buffer436(struct buffer436 *b436, struct out *o) {
   static const char vers1[] = "TM_MR_DCM_V1.0";
   static const char vers2[] = "TM_MR_DCM_V2.0";
   static const char vers3[] = "TM_MR_DCM_V1.0_3";
@@ -300,72 +232,72 @@ static void print_buffer436(struct buffer436 *b436) {
          strcmp(b436->iver, vers3) == 0 || strcmp(b436->iver, vers4) == 0);
   assert(strcmp(b436->modality, "MR") == 0);
   assert(b436->val == 1 || b436->val == 3);
-  printf("{%u;%s;%s;%s;%s;%s;%u}", b436->zero, b436->iver, b436->buf3,
-         b436->buf4, b436->buf5, b436->modality, b436->val);
-}
-
-struct buffer516 {
-  str64 zero; // aka 'none'
-  char buf2[0x15];
-  char buf3[0x100]; // phi
-  str16 buf4;
-  str64 buf5; // Study Instance UID
-  str64 buf6;
-  uint32_t bools[6];
-};
-
-static void print_buffer516(struct buffer516 *b516) {
-  printf("{%s;%s;%s;%s;%s;%s", b516->zero, b516->buf2, b516->buf3, b516->buf4,
-         b516->buf5, b516->buf6);
+  out_char(o, '{');
+  out_u32(o, b436->zero);
+  out_char(o, ';');
+  OUT_FIELD(o, b436->iver, ';');
+  OUT_FIELD(o, b436->buf3, ';');
+  OUT_FIELD(o, b436->buf4, ';');
+  OUT_FIELD(o, b436->buf5, ';');
+  OUT_FIELD(o, b436->modality, ';');
+  out_u32(o, b436->val);
+  out_char(o, '}');
+}
+
+static void print_buffer516(struct buffer516 *b516, struct out *o) {
+  out_char(o, '{');
+  OUT_FIELD(o, b516->zero, ';');
+  OUT_FIELD(o, b516->buf2, ';');
+  OUT_FIELD(o, b516->buf3, ';');
+  OUT_FIELD(o, b516->buf4, ';');
+  OUT_FIELD(o, b516->buf5, ';');
+  out_strn(o, b516->buf6, sizeof b516->buf6);
   uint32_t c;
   for (c = 0; c < 6; ++c) {
     assert(b516->bools[c] == c % 2);
 #if 0
     if (c)
-      printf(",");
-    printf("%d", b516->bools[c]);
+      out_char(o, ',');
+    out_u32(o, b516->bools[c]);
 #endif
   }
-  printf("}");
+  out_char(o, '}');
 }
 
-struct buffer325 {
-  str64 array[5];
-};
-
-static void print_buffer325(struct buffer325 *b325) {
+static void print_buffer325(struct buffer325 *b325, struct out *o) {
   int c;
-  printf("{");
+  out_char(o, '{');
   for (c = 0; c < 5; ++c) {
     if (c)
-      printf(";");
-    printf("%s", b325->array[c]);
+      out_char(o, ';');
+    out_strn(o, b325->array[c], sizeof b325->array[c]);
   }
-  printf("}");
+  out_char(o, '}');
 }
 
-static bool print_struct(void *ptr, size_t size, size_t nmemb,
+#undef OUT_FIELD
+
+static bool print_struct(const void *ptr, size_t size, size_t nmemb,
                          struct app *self) {
 
-  (void)self;
   assert(size == 1);
   const size_t s = nmemb;
   if (s == 136) {
     struct buffer136 b136;
     memcpy(&b136, ptr, nmemb);
-    print_buffer136(&b136);
+    print_buffer136(&b136, self->out);
   } else if (s == 436) {
     struct buffer436 b436;
     memcpy(&b436, ptr, nmemb);
-    print_buffer436(&b436);
+    print_buffer436(&b436, self->out);
   } else if (s == 516) {
     struct buffer516 b516;
     memcpy(&b516, ptr, nmemb);
-    print_buffer516(&b516);
+    print_buffer516(&b516, self->out);
   } else if (s == 325) {
     struct buffer325 b325;
     memcpy(&b325, ptr, nmemb);
-    print_buffer325(&b325);
+    print_buffer325(&b325, self->out);
   } else {
     assert(0); // programmer error
     return 0;
@@ -373,10 +305,10 @@ static bool print_struct(void *ptr, size_t size, size_t nmemb,
   return true;
 }
 
-static bool print_shift_jis(void *ptr, size_t size, size_t nmemb,
+static bool print_shift_jis(const void *ptr, size_t size, size_t nmemb,
                             struct app *self) {
   assert(size == 1);
-  char *str = ptr;
+  char *str = (char *)ptr; // iconv does not modify its input
   {
     char *gbk_str = str;
     self->shift_jis_buffer = realloc(self->shift_jis_buffer, nmemb * 2);
@@ -386,287 +318,564 @@ static bool print_shift_jis(void *ptr, size_t size, size_t nmemb,
     size_t outbytes = nmemb * 2;
     if (iconv(self->conv, &gbk_str, &inbytes, &out, &outbytes) == (size_t)-1) {
       dump2file(gbk_str, inbytes);
-      printf("[%.*s]", (int)nmemb, str);
-      fflush(stdout);
+      out_char(self->out, '[');
+      out_strn(self->out, str, nmemb);
+      out_char(self->out, ']');
+      out_flush(self->out);
       assert(0);
     }
     dest_str[nmemb * 2 - outbytes] = 0;
-    // printf("[%.*s]", (int)outbytes, dest_str);
-    printf("[%s]", dest_str);
+    out_char(self->out, '[');
+    out_str(self->out, dest_str);
+    out_char(self->out, ']');
   }
   return true;
 }
 
-static void print_int(const int32_t *buffer, int len) {
+static void print_int(const int32_t *buffer, int len, struct out *o) {
   const int m = sizeof(int32_t);
-  assert(is_aligned(buffer, m));
   assert(len % m == 0);
   int i;
-  printf("[");
+  out_char(o, '[');
   for (i = 0; i < len / m; i++) {
     if (i)
-      printf(",");
+      out_char(o, ',');
     int32_t cur = -1;
     memcpy(&cur, buffer + i, sizeof cur);
-    printf("%d", cur);
+    out_i32(o, cur);
   }
-  printf("]");
+  out_char(o, ']');
 }
 
-static void print_float(const float *buffer, int len) {
+static void print_float(const float *buffer, int len, struct out *o) {
   const int m = sizeof(float);
-  assert(is_aligned(buffer, m));
   assert(len % m == 0);
   int i;
-  printf("[");
+  out_char(o, '[');
   for (i = 0; i < len / m; i++) {
     if (i)
-      printf(",");
+      out_char(o, ',');
     float cur = -1;
     memcpy(&cur, buffer + i, sizeof cur);
     assert(isfinite(cur) && !isnan(cur));
-    printf("%f", cur);
+    out_double(o, "%f", cur);
   }
-  printf("]");
+  out_char(o, ']');
 }
 
-static void print_double(const double *buffer, int len) {
+static void print_double(const double *buffer, int len, struct out *o) {
   const int m = sizeof(double);
-  assert(is_aligned(buffer, m));
   assert(len % m == 0);
   int i;
-  printf("[");
+  out_char(o, '[');
   for (i = 0; i < len / m; i++) {
     if (i)
-      printf(",");
-    const double cur = buffer[i];
+      out_char(o, ',');
+    double cur = -1;
+    memcpy(&cur, buffer + i, sizeof cur);
     assert(isfinite(cur) && !isnan(cur));
-    printf("%g", cur);
+    out_double(o, "%g", cur);
   }
-  printf("]");
+  out_char(o, ']');
 }
 
-static bool print_int32(void *ptr, size_t size, size_t nmemb,
+static bool print_int32(const void *ptr, size_t size, size_t nmemb,
                         struct app *self) {
   assert(size == 1);
-  (void)self;
   // assert(nmemb == 4 || nmemb == 8 || nmemb == 12 || nmembnmemb == 24 || nmemb
   // == 32 || nmemb == 48);
   assert(nmemb % 4 == 0);
-  print_int(ptr, nmemb);
+  print_int(ptr, nmemb, self->out);
 
   return true;
 }
 
-static bool print_float32(void *ptr, size_t size, size_t nmemb,
+static bool print_float32(const void *ptr, size_t size, size_t nmemb,
                           struct app *self) {
   assert(size == 1);
-  (void)self;
   assert(nmemb == 4);
-  print_float(ptr, nmemb);
+  print_float(ptr, nmemb, self->out);
 
   return true;
 }
 
-static bool print_float32_vm1n(void *ptr, size_t size, size_t nmemb,
+static bool print_float32_vm1n(const void *ptr, size_t size, size_t nmemb,
                                struct app *self) {
   assert(size == 1);
-  (void)self;
   assert(nmemb % 4 == 0);
-  print_float(ptr, nmemb);
+  print_float(ptr, nmemb, self->out);
 
   return true;
 }
 
-static bool print_float32_vm2n(void *ptr, size_t size, size_t nmemb,
+static bool print_float32_vm2n(const void *ptr, size_t size, size_t nmemb,
                                struct app *self) {
   assert(size == 1);
-  (void)self;
   assert((nmemb / 4) % 2 == 0);
   assert(nmemb == 8 || nmemb == 40);
   // FIXME: low/high value for nmemb==40 makes them look like double...
-  print_float(ptr, nmemb);
+  print_float(ptr, nmemb, self->out);
 
   return true;
 }
 
-static bool print_float32_vm3n(void *ptr, size_t size, size_t nmemb,
+static bool print_float32_vm3n(const void *ptr, size_t size, size_t nmemb,
                                struct app *self) {
   assert(size == 1);
-  (void)self;
   assert((nmemb / 4) % 3 == 0);
   assert(nmemb == 12 || nmemb == 36);
-  print_float(ptr, nmemb);
+  print_float(ptr, nmemb, self->out);
 
   return true;
 }
 
-static bool print_float64(void *ptr, size_t size, size_t nmemb,
+static bool print_float64(const void *ptr, size_t size, size_t nmemb,
                           struct app *self) {
   assert(size == 1);
-  (void)self;
   assert(nmemb == 8);
-  print_double(ptr, nmemb);
+  print_double(ptr, nmemb, self->out);
   return true;
 }
 
-static bool print_bool32(void *ptr, size_t size, size_t nmemb,
+static bool print_bool32(const void *ptr, size_t size, size_t nmemb,
                          struct app *self) {
   assert(size == 1);
-  assert(is_aligned(ptr, 4));
-  (void)self;
   assert(nmemb == 4);
   uint32_t u;
   memcpy(&u, ptr, nmemb);
   assert(u == 0x0 || u == 0x1);
 #if 0
-  printf("%u", u);
+  out_u32(self->out, u);
 #else
-  printf("%s", u ? "true" : "false");
+  out_str(self->out, u ? "true" : "false");
 #endif
   return true;
 }
 
-static bool print(struct app *self, const uint8_t group,
-                  const struct mec_mr3_info *info,
-                  struct mec_mr3_item_data *data) {
-  const char *name = get_mec_mr3_info_name(group, info->key);
-  const uint32_t sign = info->type >> 24;
+static bool print(struct app *self, const struct mec_mr3_item *item) {
+  const char *name = get_mec_mr3_info_name(item->group, item->key);
+  const uint32_t sign = item->type >> 24;
   const char symb = sign ? '_' : ' ';
 
   bool ret = true;
   uint32_t mult = 1;
+  struct out *o = self->out;
   // print info
-  printf("(%01x,%05x) %c%04x ", group, info->key, symb,
-         (info->type & 0x00ffff00) >> 8);
+  out_char(o, '(');
+  out_hex(o, item->group, 1);
+  out_char(o, ',');
+  out_hex(o, item->key, 5);
+  out_str(o, ") ");
+  out_char(o, symb);
+  out_hex(o, (item->type & 0x00ffff00) >> 8, 4);
+  out_char(o, ' ');
   // print data:
-  switch (info->type) {
+  switch (item->type) {
   case ISO_8859_1_STRING:
-    ret = print_iso(data->buffer, 1, data->len, self);
+    ret = print_iso(item->data, 1, item->len, self);
     break;
   case FLOAT32_VM2N:
-    ret = print_float32_vm2n(data->buffer, 1, data->len, self);
+    ret = print_float32_vm2n(item->data, 1, item->len, self);
     break;
   case FLOAT32_VM3N:
-    ret = print_float32_vm3n(data->buffer, 1, data->len, self);
+    ret = print_float32_vm3n(item->data, 1, item->len, self);
     break;
   case DATETIME:
-    ret = print_datetime(data->buffer, 1, data->len, self);
+    ret = print_datetime(item->data, 1, item->len, self);
     break;
   case STRUCT_136:
   case STRUCT_436:
   case STRUCT_516:
   case STRUCT_325:
-    ret = print_struct(data->buffer, 1, data->len, self);
+    ret = print_struct(item->data, 1, item->len, self);
     break;
   case SHIFT_JIS_STRING:
-    ret = print_shift_jis(data->buffer, 1, data->len, self);
+    ret = print_shift_jis(item->data, 1, item->len, self);
     break;
   case FLOAT32_VM1:
-    ret = print_float32(data->buffer, 1, data->len, self);
+    ret = print_float32(item->data, 1, item->len, self);
     break;
   case INT32_VM1N:
-    ret = print_int32(data->buffer, 1, data->len, self);
+    ret = print_int32(item->data, 1, item->len, self);
     break;
   case FLOAT32_VM1N:
-    ret = print_float32_vm1n(data->buffer, 1, data->len, self);
+    ret = print_float32_vm1n(item->data, 1, item->len, self);
     break;
   case FLOAT64_VM1:
-    ret = print_float64(data->buffer, 1, data->len, self);
+    ret = print_float64(item->data, 1, item->len, self);
     break;
   case BOOL_04:
   case BOOL_2A:
-    ret = print_bool32(data->buffer, 1, data->len, self);
+    ret = print_bool32(item->data, 1, item->len, self);
     break;
   default:
-    printf("|NotImplemented|");
+    out_str(o, "|NotImplemented|");
     ret = true;
   }
   // print key name
-  printf(" # %u,%u %s", data->len, mult, name);
-
-  printf("\n");
+  out_str(o, " # ");
+  out_u32(o, item->len);
+  out_char(o, ',');
+  out_u32(o, mult);
+  out_char(o, ' ');
+  out_str(o, name);
+
+  out_char(o, '\n');
   return ret;
 }
 
-static bool read_group(struct app *self, uint8_t group, uint32_t nitems,
-                       struct mec_mr3_info *info,
-                       struct mec_mr3_item_data *data) {
-  bool good = true;
-  uint32_t i;
-  for (i = 0; i < nitems && good; ++i) {
-    good = good && read_info(self, group, info);
-    // lazy evaluation:
-    good = good && read_data(self, group, info, data);
-    good = good && print(self, group, info, data);
+/* NDJSON output: same walk as above, values are written as typed json */
+
+// length of the valid utf-8 sequence at s, 0 when there is none
+static size_t utf8_len(const unsigned char *s, size_t n) {
+  size_t len, i;
+  uint32_t cp;
+  if (s[0] >= 0xc2 && s[0] <= 0xdf) {
+    len = 2;
+    cp = s[0] & 0x1f;
+  } else if (s[0] >= 0xe0 && s[0] <= 0xef) {
+    len = 3;
+    cp = s[0] & 0x0f;
+  } else if (s[0] >= 0xf0 && s[0] <= 0xf4) {
+    len = 4;
+    cp = s[0] & 0x07;
+  } else {
+    return 0;
   }
+  if (len > n)
+    return 0;
+  for (i = 1; i < len; ++i) {
+    if ((s[i] & 0xc0) != 0x80)
+      return 0;
+    cp = cp << 6 | (s[i] & 0x3f);
+  }
+  // overlong forms, surrogates and out of range code points:
+  if (len == 3 && (cp < 0x800 || (cp >= 0xd800 && cp <= 0xdfff)))
+    return 0;
+  if (len == 4 && (cp < 0x10000 || cp > 0x10ffff))
+    return 0;
+  return len;
+}
+
+static inline bool json_plain(unsigned char c) {
+  return c >= 0x20 && c < 0x80 && c != '"' && c != '\\';
+}
+
+/* string of at most max bytes, up to its terminator. Bytes that are not valid
+ * utf-8 are taken as latin-1 so that the output always is. */
+static void out_json_string(struct out *o, const char *str, size_t max) {
+  static const char digits[] = "0123456789abcdef";
+  const unsigned char *s = (const unsigned char *)str;
+  const size_t n = strnlen(str, max);
+  size_t i = 0;
+  out_char(o, '"');
+  while (i < n) {
+    const unsigned char c = s[i];
+    if (json_plain(c)) {
+      size_t j = i + 1;
+      while (j < n && json_plain(s[j]))
+        ++j;
+      out_mem(o, s + i, j - i);
+      i = j;
+    } else if (c == '"' || c == '\\') {
+      out_char(o, '\\');
+      out_char(o, (char)c);
+      ++i;
+    } else if (c < 0x20) {
+      const char esc = c == '\n' ? 'n' : c == '\r' ? 'r' : c == '\t' ? 't' : 0;
+      out_char(o, '\\');
+      if (esc) {
+        out_char(o, esc);
+      } else {
+        out_str(o, "u00");
+        out_char(o, digits[c >> 4]);
+        out_char(o, digits[c & 0xf]);
+      }
+      ++i;
+    } else {
+      const size_t len = utf8_len(s + i, n - i);
+      if (len) {
+        out_mem(o, s + i, len);
+        i += len;
+      } else {
+        out_char(o, (char)(0xc0 | c >> 6));
+        out_char(o, (char)(0x80 | (c & 0x3f)));
+        ++i;
+      }
+    }
+  }
+  out_char(o, '"');
+}
+
+// json has no representation for infinities and nan
+static void out_json_double(struct out *o, const char *format, double v) {
+  if (isfinite(v))
+    out_double(o, format, v);
+  else
+    out_str(o, "null");
+}
+
+// utf-8 of a shift-jis string, NULL when it does not convert
+static const char *to_utf8(struct app *self, const char *str, size_t n) {
+  // a half-width katakana takes 1 byte in shift-jis, 3 in utf-8:
+  const size_t size = 3 * n + 1;
+  char *dest = realloc(self->shift_jis_buffer, size);
+  if (!dest)
+    return NULL;
+  self->shift_jis_buffer = dest;
+  char *in = (char *)str; // iconv does not modify its input
+  char *out = dest;
+  size_t inbytes = n;
+  size_t outbytes = size - 1;
+  if (iconv(self->conv, &in, &inbytes, &out, &outbytes) == (size_t)-1) {
+    iconv(self->conv, NULL, NULL, NULL, NULL); // reset the shift state
+    return NULL;
+  }
+  *out = 0;
+  return dest;
+}
+
+static void json_text(struct app *self, const char *str, size_t max) {
+  const size_t n = strnlen(str, max);
+  const char *utf8 = to_utf8(self, str, n);
+  out_json_string(self->out, utf8 ? utf8 : str, utf8 ? SIZE_MAX : n);
+}
+
+static void json_field(struct out *o, const char *name, const char *str,
+                       size_t max, bool first) {
+  if (!first)
+    out_char(o, ',');
+  out_char(o, '"');
+  out_str(o, name);
+  out_str(o, "\":");
+  out_json_string(o, str, max);
+}
+
+#define JSON_FIELD(o, b, member, first)                                        \
+  json_field(o, #member, (b)->member, sizeof((b)->member), first)
+
+static bool json_struct(const void *ptr, size_t nmemb, struct out *o) {
+  out_char(o, '{');
+  if (nmemb == 136) {
+    struct buffer136 b;
+    memcpy(&b, ptr, nmemb);
+    JSON_FIELD(o, &b, uid1, true);
+    JSON_FIELD(o, &b, uid2, false);
+  } else if (nmemb == 436) {
+    struct buffer436 b;
+    memcpy(&b, ptr, nmemb);
+    JSON_FIELD(o, &b, iver, true);
+    JSON_FIELD(o, &b, buf3, false);
+    JSON_FIELD(o, &b, buf4, false);
+    JSON_FIELD(o, &b, buf5, false);
+    JSON_FIELD(o, &b, modality, false);
+    out_str(o, ",\"val\":");
+    out_u32(o, b.val);
+  } else if (nmemb == 516) {
+    struct buffer516 b;
+    memcpy(&b, ptr, nmemb);
+    JSON_FIELD(o, &b, zero, true);
+    JSON_FIELD(o, &b, buf2, false);
+    JSON_FIELD(o, &b, buf3, false);
+    JSON_FIELD(o, &b, buf4, false);
+    JSON_FIELD(o, &b, buf5, false);
+    JSON_FIELD(o, &b, buf6, false);
+    out_str(o, ",\"bools\":[");
+    size_t i;
+    for (i = 0; i < sizeof b.bools / sizeof *b.bools; ++i) {
+      if (i)
+        out_char(o, ',');
+      out_u32(o, b.bools[i]);
+    }
+    out_char(o, ']');
+  } else if (nmemb == 325) {
+    struct buffer325 b;
+    memcpy(&b, ptr, nmemb);
+    int c;
+    out_str(o, "\"array\":[");
+    for (c = 0; c < 5; ++c) {
+      if (c)
+        out_char(o, ',');
+      out_json_string(o, b.array[c], sizeof b.array[c]);
+    }
+    out_char(o, ']');
+  } else {
+    return false;
+  }
+  out_char(o, '}');
+  return true;
+}
+
+#undef JSON_FIELD
+
+// array of the little endian values of a payload, m bytes each. The lengths
+// are checked as in mec_mr3_visit_item: single values are exactly one, VM2N
+// and VM3N arrays hold whole pairs and triplets
+static bool json_numbers(const void *ptr, size_t nmemb, uint32_t type,
+                         struct out *o) {
+  const size_t m = type == FLOAT64_VM1 ? sizeof(double) : 4;
+  const size_t vm = type == FLOAT32_VM2N ? 2 : type == FLOAT32_VM3N ? 3 : 1;
+  if (nmemb % (vm * m) != 0)
+    return false;
+  if ((type == FLOAT32_VM1 || type == FLOAT64_VM1) && nmemb != m)
+    return false;
+  const char *p = ptr;
+  size_t i;
+  out_char(o, '[');
+  for (i = 0; i < nmemb / m; ++i) {
+    if (i)
+      out_char(o, ',');
+    if (type == INT32_VM1N) {
+      int32_t v;
+      memcpy(&v, p + i * m, sizeof v);
+      out_i32(o, v);
+    } else if (type == FLOAT64_VM1) {
+      double v;
+      memcpy(&v, p + i * m, sizeof v);
+      out_json_double(o, "%.17g", v);
+    } else {
+      float v;
+      memcpy(&v, p + i * m, sizeof v);
+      out_json_double(o, "%.9g", v); // enough digits to round trip
+    }
+  }
+  out_char(o, ']');
+  return true;
+}
+
+static bool json_value(struct app *self, const struct mec_mr3_item *item) {
+  struct out *o = self->out;
+  const char *data = item->data;
+  switch (item->type) {
+  case ISO_8859_1_STRING:
+    if (mec_mr3_is_iso(data, item->len)) {
+      size_t len;
+      const char *str = mec_mr3_iso_string(data, item->len, &len);
+      if (!str)
+        return false;
+      json_text(self, str, len);
+    } else {
+      json_text(self, data, item->len);
+    }
+    return true;
+  case SHIFT_JIS_STRING:
+    json_text(self, data, item->len);
+    return true;
+  case DATETIME:
+    out_json_string(o, data, item->len);
+    return true;
+  case STRUCT_136:
+  case STRUCT_436:
+  case STRUCT_516:
+  case STRUCT_325:
+    return json_struct(data, item->len, o);
+  case FLOAT32_VM2N:
+  case FLOAT32_VM3N:
+  case FLOAT32_VM1:
+  case FLOAT32_VM1N:
+  case INT32_VM1N:
+  case FLOAT64_VM1:
+    return json_numbers(data, item->len, item->type, o);
+  case BOOL_04:
+  case BOOL_2A: {
+    uint32_t u;
+    if (item->len != sizeof u)
+      return false;
+    memcpy(&u, data, sizeof u);
+    out_str(o, u ? "true" : "false");
+    return true;
+  }
+  default:
+    out_str(o, "null");
+    return true;
+  }
+}
+
+static bool print_json(struct app *self, const struct mec_mr3_item *item) {
+  struct out *o = self->out;
+  const char *name = get_mec_mr3_info_name(item->group, item->key);
+  out_str(o, "{\"group\":");
+  out_u32(o, item->group);
+  out_str(o, ",\"key\":\"");
+  out_hex(o, item->key, 5);
+  out_str(o, "\",\"type\":\"");
+  out_hex(o, item->type, 8);
+  out_str(o, "\",\"name\":");
+  out_json_string(o, name ? name : "", SIZE_MAX);
+  out_str(o, ",\"len\":");
+  out_u32(o, item->len);
+  out_str(o, ",\"value\":");
+  const bool good = json_value(self, item);
+  out_char(o, '}');
   return good;
 }
 
-bool mec_mr3_print(const void *input, size_t len) {
-  if (!input)
+#undef ERROR_RETURN
+
+bool mec_mr3_print_as(const void *input, size_t len,
+                      const struct mec_mr3_sink *sink,
+                      enum mec_mr3_print_mode mode) {
+  if (!input || !sink)
+    return false;
+  struct out *out = malloc(sizeof *out);
+  if (!out)
     return false;
-  struct stream sin;
+  out->sink = sink;
+  out->good = true;
+  out->written = 0;
+  out->n = 0;
   struct app a;
-  struct app *self = create_app(&a, &sin);
-  setup_buffer(self, input, len);
+  struct app *self = create_app(&a, out);
+  struct mec_mr3_walk w;
+  mec_mr3_walk_init(&w, input, len);
 
   bool good = true;
-  struct mec_mr3_info info;
-  struct mec_mr3_item_data data;
-  data.size = data.len = 0;
-  data.buffer = NULL;
-
-  uint32_t remain = 1;
-  size_t s;
-  bool last_element = false;
-  uint8_t group = 0;
-  // read until last set of group found:
-  while (!last_element && good) {
-    uint32_t nitems;
-    s = fread_mirror(&nitems, sizeof nitems, 1, self);
-    if (s != 1 || nitems == 0) {
-      good = false;
+  struct mec_mr3_item item;
+  int ret = -1;
+  if (mode == MEC_MR3_PRINT_NDJSON_BLOB)
+    out_str(out, "{\"items\":[");
+  bool first = true;
+  while (good && (ret = mec_mr3_walk_next(&w, &item)) == 1) {
+    good = read_info(self, &item);
+    // lazy evaluation:
+    if (mode == MEC_MR3_PRINT_TEXT) {
+      good = good && print(self, &item);
+      continue;
     }
-    if (good && nitems <= 3) {
-      // special case to handle last element
-      remain = nitems;
-      last_element = true;
-      s = fread_mirror(&nitems, sizeof nitems, 1, self);
-      if (s != 1 || nitems == 0) {
-        good = false;
-      }
+    // a json item is complete or not there at all, unless the buffer had to
+    // be flushed within it:
+    const size_t start = out_tell(out);
+    if (mode == MEC_MR3_PRINT_NDJSON_BLOB && !first)
+      out_char(out, ',');
+    good = good && print_json(self, &item);
+    if (!good) {
+      out_rewind(out, start);
+      break;
     }
-    // lazy evaluation
-    ++group;
-    good = good && read_group(self, group, nitems, &info, &data);
-  }
-  // read remaining groups:
-  while (good && --remain != 0) {
-    uint32_t nitems;
-    s = fread_mirror(&nitems, sizeof nitems, 1, self);
-    if (s != 1 || nitems <= 3) {
-      good = false;
-    }
-    ++group;
-    good = good && read_group(self, group, nitems, &info, &data);
+    if (mode == MEC_MR3_PRINT_NDJSON)
+      out_char(out, '\n');
+    first = false;
   }
+  // an incomplete blob is not closed, so that it does not parse:
+  if (mode == MEC_MR3_PRINT_NDJSON_BLOB && good && ret == 0)
+    out_str(out, "]}\n");
+  out_flush(out);
+  good = good && out->good;
   // release memory:
-  free(data.buffer);
   iconv_close(self->conv);
   free(self->shift_jis_buffer);
-  if (!good)
-    return false;
+  free(out);
 
-  // write trailer:
-  if (!write_trailer(self)) {
-    return false;
-  }
+  return good && ret == 0;
+}
 
-  // make sure the whole input was processed:
-  assert(self->in->cur <= self->in->end); // programmer error
-  if (self->in->cur < self->in->end) {
-    return false;
-  }
-  return true;
+bool mec_mr3_print_to(const void *input, size_t len,
+                      const struct mec_mr3_sink *sink) {
+  return mec_mr3_print_as(input, len, sink, MEC_MR3_PRINT_TEXT);
+}
+
+bool mec_mr3_print(const void *input, size_t len) {
+  struct mec_mr3_sink sink;
+  mec_mr3_sink_file(&sink, stdout);
+  return mec_mr3_print_to(input, len, &sink);
 }
@@ -3,4 +3,29 @@
 #include <stdbool.h>
 #include <stddef.h>
 
+struct mec_mr3_sink;
+
+enum mec_mr3_print_mode {
+  MEC_MR3_PRINT_TEXT,        // one line per item, as printed by dump8
+  MEC_MR3_PRINT_NDJSON,      // one json object per item and line
+  MEC_MR3_PRINT_NDJSON_BLOB, // one json object per blob: {"items":[...]}
+};
+
+/* print the items of input to sink, see mec_mr3_sink.h for FILE and memory
+ * sinks. Output is buffered and written in large chunks.
+ *
+ * A json item is {"group":1,"key":"055f8","type":"ff000800",
+ * "name":"Patient Size (cm)","len":4,"value":[150]}, its value being an array
+ * of numbers for the float and int types, a utf-8 string for the text types,
+ * an object of the string fields for the fixed structs, a boolean, or null
+ * for the types not decoded. */
+bool mec_mr3_print_as(const void *input, size_t len,
+                      const struct mec_mr3_sink *sink,
+                      enum mec_mr3_print_mode mode);
+
+/* same as above in text mode */
+bool mec_mr3_print_to(const void *input, size_t len,
+                      const struct mec_mr3_sink *sink);
+
+/* same as above to stdout */
 bool mec_mr3_print(const void *input, size_t len);
@@ -0,0 +1,247 @@
+#include "mec_mr3_layout.h"
+
+#include "mec_mr3.h"
+#include "mec_mr3_cursor.h"
+#include "mec_mr3_hash.h"
+#include "mec_mr3_policy.h"
+#include "mec_mr3_private.h"
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+enum {
+  BUCKETS = 64,
+  PREFIX = 64, // bytes hashed to find the candidates: first count and header
+};
+
+// structural bytes [offset, offset + len) of the blob
+struct run {
+  uint32_t offset;
+  uint32_t len;
+};
+
+/* immutable once published */
+struct layout {
+  struct layout *next; // in bucket
+  uint64_t fingerprint;
+  size_t len;
+  uint64_t policy; // generation, the address may be reused by another policy
+  uint32_t nruns;
+  const struct run *runs;
+  const unsigned char *bytes; // content of the runs, back to back
+  struct mec_mr3_spans spans;
+};
+
+struct mec_mr3_layout_cache {
+  _Atomic(struct layout *) buckets[BUCKETS];
+  pthread_mutex_t lock; // serializes writers
+  size_t nlayouts;
+  size_t max_layouts;
+  atomic_size_t hits;
+};
+
+struct mec_mr3_layout_cache *mec_mr3_layout_cache_create(size_t max_layouts) {
+  struct mec_mr3_layout_cache *cache = mec_mr3_calloc(1, sizeof *cache);
+  if (!cache)
+    return NULL;
+  int b;
+  for (b = 0; b < BUCKETS; ++b) {
+    atomic_init(&cache->buckets[b], NULL);
+  }
+  pthread_mutex_init(&cache->lock, NULL);
+  cache->max_layouts = max_layouts;
+  atomic_init(&cache->hits, 0);
+  return cache;
+}
+
+void mec_mr3_layout_cache_free(struct mec_mr3_layout_cache *cache) {
+  if (!cache)
+    return;
+  int b;
+  for (b = 0; b < BUCKETS; ++b) {
+    struct layout *l = atomic_load(&cache->buckets[b]);
+    while (l) {
+      struct layout *next = l->next;
+      free(l);
+      l = next;
+    }
+  }
+  pthread_mutex_destroy(&cache->lock);
+  free(cache);
+}
+
+size_t mec_mr3_layout_hits(const struct mec_mr3_layout_cache *cache) {
+  return atomic_load_explicit(&cache->hits, memory_order_relaxed);
+}
+
+static uint64_t fingerprint(const void *input, size_t len) {
+  return mec_mr3_xxh64(input, len < PREFIX ? len : PREFIX, len);
+}
+
+// the walk only depends on the structural bytes and the length, a blob
+// sharing them has the very same items and spans
+static bool same_structure(const struct layout *l, const unsigned char *input,
+                           size_t len, const struct mec_mr3_policy *policy) {
+  if (l->len != len || l->policy != policy->generation)
+    return false;
+  const unsigned char *bytes = l->bytes;
+  uint32_t r;
+  for (r = 0; r < l->nruns; ++r) {
+    if (memcmp(input + l->runs[r].offset, bytes, l->runs[r].len) != 0)
+      return false;
+    bytes += l->runs[r].len;
+  }
+  return true;
+}
+
+static const struct layout *find(struct mec_mr3_layout_cache *cache,
+                                 uint64_t fp, const unsigned char *input,
+                                 size_t len,
+                                 const struct mec_mr3_policy *policy) {
+  const struct layout *l =
+      atomic_load_explicit(&cache->buckets[fp % BUCKETS], memory_order_acquire);
+  for (; l; l = l->next) {
+    if (l->fingerprint == fp && same_structure(l, input, len, policy))
+      return l;
+  }
+  return NULL;
+}
+
+// structural runs found while walking a new blob
+struct runs {
+  struct run *runs;
+  uint32_t n;
+  uint32_t capacity;
+  size_t bytes; // sum of the lengths
+};
+
+static bool add_run(struct runs *runs, size_t start, size_t end) {
+  if (start == end)
+    return true;
+  runs->bytes += end - start;
+  // payload of length zero, extend previous run:
+  if (runs->n != 0) {
+    struct run *last = runs->runs + runs->n - 1;
+    if (last->offset + last->len == start) {
+      last->len += (uint32_t)(end - start);
+      return true;
+    }
+  }
+  if (runs->n == runs->capacity) {
+    const uint32_t capacity = runs->capacity ? 2 * runs->capacity : 256;
+    struct run *tmp = mec_mr3_realloc(runs->runs, capacity * sizeof *tmp);
+    if (!tmp)
+      return false;
+    runs->runs = tmp;
+    runs->capacity = capacity;
+  }
+  runs->runs[runs->n].offset = (uint32_t)start;
+  runs->runs[runs->n].len = (uint32_t)(end - start);
+  ++runs->n;
+  return true;
+}
+
+// same as the first phase of mec_mr3_scrub_ex, also recording the runs
+static bool index_blob(const unsigned char *input, size_t len,
+                       const struct mec_mr3_policy *policy,
+                       const struct mec_mr3_options *options,
+                       struct mec_mr3_spans *spans, struct runs *runs) {
+  // offsets are stored on 32bits:
+  if (len > UINT32_MAX)
+    return false;
+  struct mec_mr3_walk w;
+  mec_mr3_walk_init(&w, input, len);
+  struct mec_mr3_item item;
+  size_t end = 0; // of previous payload
+  int ret = -1;
+  while ((ret = mec_mr3_walk_next(&w, &item)) == 1) {
+    if (!mec_mr3_add_span(spans, policy, options, &w, &item))
+      return false;
+    const size_t start = (size_t)((const unsigned char *)item.data - input);
+    if (!add_run(runs, end, start))
+      return false;
+    end = start + item.len;
+  }
+  // group counts and headers are all in, so is the trailer:
+  return ret == 0 && add_run(runs, end, len);
+}
+
+static void insert(struct mec_mr3_layout_cache *cache, uint64_t fp,
+                   const unsigned char *input, size_t len,
+                   const struct mec_mr3_policy *policy,
+                   const struct mec_mr3_spans *spans,
+                   const struct runs *runs) {
+  pthread_mutex_lock(&cache->lock);
+  // another thread may have recorded the same layout meanwhile:
+  if (cache->nlayouts < cache->max_layouts &&
+      !find(cache, fp, input, len, policy)) {
+    const size_t runs_size = runs->n * sizeof *runs->runs;
+    struct layout *l = mec_mr3_malloc(sizeof *l + runs_size + runs->bytes);
+    if (l) {
+      struct run *r = (struct run *)(l + 1);
+      unsigned char *bytes = (unsigned char *)r + runs_size;
+      memcpy(r, runs->runs, runs_size);
+      unsigned char *p = bytes;
+      uint32_t i;
+      for (i = 0; i < runs->n; ++i) {
+        memcpy(p, input + r[i].offset, r[i].len);
+        p += r[i].len;
+      }
+      l->fingerprint = fp;
+      l->len = len;
+      l->policy = policy->generation;
+      l->nruns = runs->n;
+      l->runs = r;
+      l->bytes = bytes;
+      l->spans = *spans;
+      _Atomic(struct layout *) *bucket = cache->buckets + fp % BUCKETS;
+      l->next = atomic_load_explicit(bucket, memory_order_relaxed);
+      atomic_store_explicit(bucket, l, memory_order_release);
+      ++cache->nlayouts;
+    }
+  }
+  pthread_mutex_unlock(&cache->lock);
+}
+
+bool mec_mr3_layout_scrub(struct mec_mr3_layout_cache *cache, void *output,
+                          const void *input, size_t len,
+                          const struct mec_mr3_options *options) {
+  const struct mec_mr3_policy *policy =
+      options->policy ? options->policy : mec_mr3_policy_default();
+  const unsigned char *in = (const unsigned char *)input;
+  const uint64_t fp = fingerprint(in, len);
+  const struct layout *l = find(cache, fp, in, len, policy);
+  if (l) {
+    atomic_fetch_add_explicit(&cache->hits, 1, memory_order_relaxed);
+    // the payloads still have to be validated:
+    uint32_t i;
+    for (i = 0; i < l->spans.n; ++i) {
+      const struct mec_mr3_span *span = l->spans.spans + i;
+      if (!mec_mr3_check_phi(in + span->offset, span->len, span->type,
+                             span->action, options))
+        return false;
+    }
+    if (!mec_mr3_reserve_uids(in, &l->spans, options))
+      return false;
+    if (output != input)
+      memcpy(output, input, len);
+    return mec_mr3_patch_spans(output, &l->spans, options);
+  }
+
+  struct mec_mr3_spans spans;
+  spans.n = 0;
+  struct runs runs = {NULL, 0, 0, 0};
+  const bool good = index_blob(in, len, policy, options, &spans, &runs) &&
+                    mec_mr3_reserve_uids(in, &spans, options);
+  if (good) {
+    // record before the output overwrites an in place input:
+    insert(cache, fp, in, len, policy, &spans, &runs);
+    if (output != input)
+      memcpy(output, input, len);
+  }
+  free(runs.runs);
+  return good && mec_mr3_patch_spans(output, &spans, options);
+}
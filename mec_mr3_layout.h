@@ -0,0 +1,31 @@
+#pragma once
+
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+struct mec_mr3_layout_cache;
+
+/* cache of blob layouts, to be set in mec_mr3_options.layouts. Blobs written
+ * by the same scanner software share their sequence of group counts and item
+ * headers; the first blob of a layout is parsed as usual and its structural
+ * bytes (everything but the payloads) and phi spans are recorded. A later blob
+ * of the same length and first bytes is checked against the recorded bytes,
+ * one memcmp per run of structural bytes between two payloads (about 700 for
+ * a typical blob), and patched right away. Layouts are recorded per policy: a
+ * policy never sees the spans of another one, even one freed at the same
+ * address. At most max_layouts are kept, they are never evicted. Lookups are
+ * lock free, the cache can be shared by threads. Return NULL on allocation
+ * failure. */
+struct mec_mr3_layout_cache *mec_mr3_layout_cache_create(size_t max_layouts);
+
+void mec_mr3_layout_cache_free(struct mec_mr3_layout_cache *cache);
+
+/* number of blobs that matched a recorded layout */
+size_t mec_mr3_layout_hits(const struct mec_mr3_layout_cache *cache);
+
+#ifdef __cplusplus
+} /* end extern "C" */
+#endif
@@ -0,0 +1,277 @@
+#include "mec_mr3_lazy.h"
+
+#include "mec_mr3_private.h"
+
+#include <iconv.h>
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+// memoized result of the items failing to decode
+static const struct mec_mr3_value invalid;
+
+struct mec_mr3_lazy {
+  struct mec_mr3_doc *doc;
+  iconv_t shift_jis; // opened on first use
+  const struct mec_mr3_value **values; // of the items, NULL until decoded
+};
+
+struct decode {
+  struct mec_mr3_lazy *lazy;
+  struct mec_mr3_value *value;
+  bool nomem;
+};
+
+// value followed by size bytes of storage, aligned for any of the arrays
+static struct mec_mr3_value *new_value(struct decode *d,
+                                       enum mec_mr3_value_kind kind, size_t n,
+                                       size_t size) {
+  struct mec_mr3_value *value = mec_mr3_malloc(sizeof *value + size);
+  if (!value) {
+    d->nomem = true;
+    return NULL;
+  }
+  value->kind = kind;
+  value->n = n;
+  d->value = value;
+  return value;
+}
+
+static inline void *storage(struct mec_mr3_value *value) { return value + 1; }
+
+static bool on_float32_array(const struct mec_mr3_item *item,
+                             const void *values, size_t n, void *user) {
+  (void)item;
+  size_t i;
+  for (i = 0; i < n; ++i) {
+    if (!isfinite(mec_mr3_float32_at(values, i)))
+      return false;
+  }
+  struct mec_mr3_value *value =
+      new_value(user, MEC_MR3_VALUE_FLOAT32, n, n * sizeof(float));
+  if (!value)
+    return false;
+  value->f32 = memcpy(storage(value), values, n * sizeof(float));
+  return true;
+}
+
+static bool on_int32_array(const struct mec_mr3_item *item, const void *values,
+                           size_t n, void *user) {
+  (void)item;
+  struct mec_mr3_value *value =
+      new_value(user, MEC_MR3_VALUE_INT32, n, n * sizeof(int32_t));
+  if (!value)
+    return false;
+  value->i32 = memcpy(storage(value), values, n * sizeof(int32_t));
+  return true;
+}
+
+static bool on_float64(const struct mec_mr3_item *item, double f64,
+                       void *user) {
+  (void)item;
+  if (!isfinite(f64))
+    return false;
+  struct mec_mr3_value *value = new_value(user, MEC_MR3_VALUE_FLOAT64, 1, 0);
+  if (!value)
+    return false;
+  value->f64 = f64;
+  return true;
+}
+
+static bool on_bool(const struct mec_mr3_item *item, bool b, void *user) {
+  (void)item;
+  struct mec_mr3_value *value = new_value(user, MEC_MR3_VALUE_BOOL, 1, 0);
+  if (!value)
+    return false;
+  value->b = b;
+  return true;
+}
+
+static size_t latin1_to_utf8(const char *str, size_t n, char *dest) {
+  size_t i, len = 0;
+  for (i = 0; i < n; ++i) {
+    const unsigned char c = (unsigned char)str[i];
+    if (c < 0x80) {
+      dest[len++] = (char)c;
+    } else {
+      dest[len++] = (char)(0xc0 | c >> 6);
+      dest[len++] = (char)(0x80 | (c & 0x3f));
+    }
+  }
+  return len;
+}
+
+static bool shift_jis_to_utf8(struct mec_mr3_lazy *lazy, const char *str,
+                              size_t n, char *dest, size_t size, size_t *len) {
+  if (lazy->shift_jis == (iconv_t)-1) {
+    lazy->shift_jis = iconv_open("utf-8", "shift-jis");
+    if (lazy->shift_jis == (iconv_t)-1)
+      return false;
+  }
+  char *in = (char *)str; // iconv does not modify its input
+  char *out = dest;
+  size_t inbytes = n;
+  size_t outbytes = size;
+  if (iconv(lazy->shift_jis, &in, &inbytes, &out, &outbytes) == (size_t)-1) {
+    iconv(lazy->shift_jis, NULL, NULL, NULL, NULL); // reset the shift state
+    return false;
+  }
+  *len = size - outbytes;
+  return true;
+}
+
+static bool on_string(const struct mec_mr3_item *item,
+                      const struct mec_mr3_str *str, void *user) {
+  (void)item;
+  struct decode *d = user;
+  // a half-width katakana takes 1 byte in shift-jis, 3 in utf-8:
+  const size_t size = 3 * str->len;
+  struct mec_mr3_value *value =
+      new_value(d, MEC_MR3_VALUE_STRING, 0, size + 1);
+  if (!value)
+    return false;
+  char *dest = storage(value);
+  // the scanner writes shift-jis in the ISO8859-1 strings as well, as for
+  // mec_mr3_print_as() the bytes that do not convert are taken as latin-1:
+  if (!shift_jis_to_utf8(d->lazy, str->ptr, str->len, dest, size, &value->n))
+    value->n = latin1_to_utf8(str->ptr, str->len, dest);
+  dest[value->n] = 0;
+  value->str = dest;
+  return true;
+}
+
+static bool on_datetime(const struct mec_mr3_item *item,
+                        const struct mec_mr3_str *str, void *user) {
+  (void)item;
+  struct mec_mr3_value *value =
+      new_value(user, MEC_MR3_VALUE_DATETIME, str->len, str->len + 1);
+  if (!value)
+    return false;
+  char *dest = storage(value);
+  memcpy(dest, str->ptr, str->len);
+  dest[str->len] = 0;
+  value->str = dest;
+  return true;
+}
+
+static bool on_struct136(const struct mec_mr3_item *item,
+                         const struct mec_mr3_struct136 *s, void *user) {
+  (void)item;
+  struct mec_mr3_value *value =
+      new_value(user, MEC_MR3_VALUE_STRUCT136, 1, 0);
+  if (!value)
+    return false;
+  value->s136 = *s;
+  return true;
+}
+
+static bool on_struct436(const struct mec_mr3_item *item,
+                         const struct mec_mr3_struct436 *s, void *user) {
+  (void)item;
+  struct mec_mr3_value *value =
+      new_value(user, MEC_MR3_VALUE_STRUCT436, 1, 0);
+  if (!value)
+    return false;
+  value->s436 = *s;
+  return true;
+}
+
+static bool on_struct516(const struct mec_mr3_item *item,
+                         const struct mec_mr3_struct516 *s, void *user) {
+  (void)item;
+  struct mec_mr3_value *value =
+      new_value(user, MEC_MR3_VALUE_STRUCT516, 1, 0);
+  if (!value)
+    return false;
+  value->s516 = *s;
+  return true;
+}
+
+static bool on_struct325(const struct mec_mr3_item *item,
+                         const struct mec_mr3_struct325 *s, void *user) {
+  (void)item;
+  struct mec_mr3_value *value =
+      new_value(user, MEC_MR3_VALUE_STRUCT325, 1, 0);
+  if (!value)
+    return false;
+  value->s325 = *s;
+  return true;
+}
+
+static bool on_other(const struct mec_mr3_item *item, void *user) {
+  struct mec_mr3_value *value =
+      new_value(user, MEC_MR3_VALUE_OTHER, item->len, 0);
+  if (!value)
+    return false;
+  value->data = item->data;
+  return true;
+}
+
+static const struct mec_mr3_visitor decoder = {
+    on_float32_array, on_int32_array, on_float64,   on_bool,
+    on_string,        on_datetime,    on_struct136, on_struct436,
+    on_struct516,     on_struct325,   on_other,
+};
+
+struct mec_mr3_lazy *mec_mr3_lazy_parse(const void *input, size_t len) {
+  struct mec_mr3_lazy *lazy = mec_mr3_calloc(1, sizeof *lazy);
+  if (!lazy)
+    return NULL;
+  lazy->shift_jis = (iconv_t)-1;
+  lazy->doc = mec_mr3_doc_parse(input, len);
+  if (lazy->doc)
+    lazy->values = mec_mr3_calloc(lazy->doc->n, sizeof *lazy->values);
+  if (!lazy->values) {
+    mec_mr3_lazy_free(lazy);
+    return NULL;
+  }
+  return lazy;
+}
+
+void mec_mr3_lazy_free(struct mec_mr3_lazy *lazy) {
+  if (!lazy)
+    return;
+  if (lazy->values) {
+    size_t i;
+    for (i = 0; i < lazy->doc->n; ++i) {
+      if (lazy->values[i] != &invalid)
+        free((void *)lazy->values[i]);
+    }
+    free(lazy->values);
+  }
+  if (lazy->shift_jis != (iconv_t)-1)
+    iconv_close(lazy->shift_jis);
+  mec_mr3_doc_free(lazy->doc);
+  free(lazy);
+}
+
+const struct mec_mr3_doc *mec_mr3_lazy_doc(const struct mec_mr3_lazy *lazy) {
+  return lazy->doc;
+}
+
+const struct mec_mr3_value *mec_mr3_lazy_at(struct mec_mr3_lazy *lazy,
+                                            size_t i) {
+  if (i >= lazy->doc->n)
+    return NULL;
+  const struct mec_mr3_value *value = lazy->values[i];
+  if (!value) {
+    struct mec_mr3_item item;
+    mec_mr3_doc_item(lazy->doc, i, &item);
+    struct decode d = {lazy, NULL, false};
+    if (mec_mr3_visit_item(&item, &decoder, &d)) {
+      value = d.value;
+    } else {
+      free(d.value);
+      if (d.nomem)
+        return NULL; // try again next time
+      value = &invalid;
+    }
+    lazy->values[i] = value;
+  }
+  return value != &invalid ? value : NULL;
+}
+
+const struct mec_mr3_value *mec_mr3_lazy_get(struct mec_mr3_lazy *lazy,
+                                             uint8_t group, uint32_t key) {
+  return mec_mr3_lazy_at(lazy, mec_mr3_doc_find(lazy->doc, group, key));
+}
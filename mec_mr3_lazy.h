@@ -0,0 +1,73 @@
+#pragma once
+
+#include "mec_mr3_doc.h"
+#include "mec_mr3_visit.h"
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+enum mec_mr3_value_kind {
+  MEC_MR3_VALUE_FLOAT32,  // f32[n], all finite
+  MEC_MR3_VALUE_INT32,    // i32[n]
+  MEC_MR3_VALUE_FLOAT64,  // f64, finite
+  MEC_MR3_VALUE_BOOL,     // b
+  MEC_MR3_VALUE_STRING,   // str, n bytes of utf-8 plus a nul byte
+  MEC_MR3_VALUE_DATETIME, // str, as for strings: 11/12/2002,11:27:32
+  MEC_MR3_VALUE_STRUCT136,
+  MEC_MR3_VALUE_STRUCT436,
+  MEC_MR3_VALUE_STRUCT516,
+  MEC_MR3_VALUE_STRUCT325,
+  MEC_MR3_VALUE_OTHER, // data, n bytes: types not decoded
+};
+
+/* decoded value of an item. Arrays are aligned copies, struct fields are
+ * views into the input as in mec_mr3_visit(). */
+struct mec_mr3_value {
+  enum mec_mr3_value_kind kind;
+  size_t n;
+  union {
+    const float *f32;
+    const int32_t *i32;
+    double f64;
+    bool b;
+    const char *str;
+    struct mec_mr3_struct136 s136;
+    struct mec_mr3_struct436 s436;
+    struct mec_mr3_struct516 s516;
+    struct mec_mr3_struct325 s325;
+    const void *data;
+  };
+};
+
+struct mec_mr3_lazy;
+
+/* index the items of input as mec_mr3_doc_parse() does, payloads are left
+ * alone until their value is asked for. Each value is decoded once on first
+ * access (strings to utf-8, float checks, struct unpacking) and kept until
+ * mec_mr3_lazy_free(). Values are not shared between threads: use one
+ * mec_mr3_lazy per thread. The input must outlive it. Return NULL on invalid
+ * layout or allocation failure. */
+struct mec_mr3_lazy *mec_mr3_lazy_parse(const void *input, size_t len);
+
+void mec_mr3_lazy_free(struct mec_mr3_lazy *lazy);
+
+/* the index, to iterate over the items */
+const struct mec_mr3_doc *mec_mr3_lazy_doc(const struct mec_mr3_lazy *lazy);
+
+/* value of item i of the doc. Return NULL when its payload is invalid or on
+ * allocation failure. */
+const struct mec_mr3_value *mec_mr3_lazy_at(struct mec_mr3_lazy *lazy,
+                                            size_t i);
+
+/* value of the item of group and key, NULL when there is none or as above */
+const struct mec_mr3_value *mec_mr3_lazy_get(struct mec_mr3_lazy *lazy,
+                                             uint8_t group, uint32_t key);
+
+#ifdef __cplusplus
+} /* end extern "C" */
+#endif
@@ -0,0 +1,302 @@
+#include "mec_mr3_leak.h"
+
+#include "mec_mr3_cursor.h"
+#include "mec_mr3_payload.h"
+#include "mec_mr3_private.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+/* deterministic automaton: delta holds the next state for every state and
+ * byte, so the scan is one table lookup per byte */
+struct mec_mr3_leak_scanner {
+  int32_t *delta; // nstates * 256
+  int32_t *match; // needle ending at each state, -1 for none
+  int32_t *next;  // next state on the suffix chain with a match, -1 for none
+  const size_t *lens;
+  const bool *numeric; // needles made of digits only
+};
+
+static inline unsigned char fold(unsigned char c) {
+  return c >= 'a' && c <= 'z' ? (unsigned char)(c - 'a' + 'A') : c;
+}
+
+static inline bool is_digit(unsigned char c) { return c >= '0' && c <= '9'; }
+
+static inline bool is_alnum(unsigned char c) {
+  return is_digit(c) || (fold(c) >= 'A' && fold(c) <= 'Z');
+}
+
+static bool all_digits(const char *str) {
+  for (; *str; ++str) {
+    if (!is_digit((unsigned char)*str))
+      return false;
+  }
+  return true;
+}
+
+struct mec_mr3_leak_scanner *
+mec_mr3_leak_scanner_create(const char *const *needles, size_t n) {
+  size_t total = 1; // root
+  size_t i;
+  for (i = 0; i < n; ++i)
+    total += strlen(needles[i]);
+  if (total > INT32_MAX / 256)
+    return NULL;
+  struct mec_mr3_leak_scanner *s = mec_mr3_calloc(1, sizeof *s);
+  int32_t *delta = mec_mr3_malloc(total * 256 * sizeof *delta);
+  int32_t *match = mec_mr3_malloc(total * sizeof *match);
+  int32_t *next = mec_mr3_malloc(total * sizeof *next);
+  size_t *lens = mec_mr3_malloc((n ? n : 1) * sizeof *lens);
+  bool *numeric = mec_mr3_malloc((n ? n : 1) * sizeof *numeric);
+  // only needed while building:
+  int32_t *link = mec_mr3_malloc(total * sizeof *link); // failure links
+  int32_t *queue = mec_mr3_malloc(total * sizeof *queue);
+  if (!s || !delta || !match || !next || !lens || !numeric || !link ||
+      !queue) {
+    free(s);
+    free(delta);
+    free(match);
+    free(next);
+    free(lens);
+    free(numeric);
+    free(link);
+    free(queue);
+    return NULL;
+  }
+  memset(delta, 0xff, total * 256 * sizeof *delta); // -1: no edge yet
+  uint32_t nstates = 1;
+  match[0] = -1;
+  // trie of the needles:
+  for (i = 0; i < n; ++i) {
+    const unsigned char *p = (const unsigned char *)needles[i];
+    lens[i] = strlen(needles[i]);
+    numeric[i] = all_digits(needles[i]);
+    int32_t state = 0;
+    for (; *p; ++p) {
+      int32_t *edge = delta + (size_t)state * 256 + fold(*p);
+      if (*edge < 0) {
+        match[nstates] = -1;
+        *edge = (int32_t)nstates++;
+      }
+      state = *edge;
+    }
+    if (state != 0 && match[state] < 0)
+      match[state] = (int32_t)i;
+  }
+  // breadth first, so that the failure link of a state is known before its
+  // children are reached. Missing edges are completed along the way:
+  size_t head = 0, tail = 0;
+  link[0] = 0;
+  next[0] = -1;
+  int c;
+  for (c = 0; c < 256; ++c) {
+    int32_t *edge = delta + c;
+    if (*edge < 0) {
+      *edge = 0;
+    } else {
+      link[*edge] = 0;
+      next[*edge] = -1;
+      queue[tail++] = *edge;
+    }
+  }
+  while (head < tail) {
+    const int32_t state = queue[head++];
+    for (c = 0; c < 256; ++c) {
+      int32_t *edge = delta + (size_t)state * 256 + c;
+      const int32_t fallback = delta[(size_t)link[state] * 256 + c];
+      if (*edge < 0) {
+        *edge = fallback;
+        continue;
+      }
+      const int32_t child = *edge;
+      link[child] = fallback;
+      next[child] = match[fallback] >= 0 ? fallback : next[fallback];
+      queue[tail++] = child;
+    }
+  }
+  free(link);
+  free(queue);
+  s->delta = delta;
+  s->match = match;
+  s->next = next;
+  s->lens = lens;
+  s->numeric = numeric;
+  return s;
+}
+
+void mec_mr3_leak_scanner_free(struct mec_mr3_leak_scanner *scanner) {
+  if (!scanner)
+    return;
+  free(scanner->delta);
+  free(scanner->match);
+  free(scanner->next);
+  free((void *)scanner->lens);
+  free((void *)scanner->numeric);
+  free(scanner);
+}
+
+static inline unsigned add_field(struct mec_mr3_field *fields, unsigned n,
+                                 size_t offset, size_t len) {
+  fields[n].offset = (uint32_t)offset;
+  fields[n].len = (uint32_t)len;
+  return n + 1;
+}
+
+#define ADD_FIELD(n, type, member)                                             \
+  add_field(fields, n, offsetof(type, member), sizeof(((type *)0)->member))
+
+// the free text of a payload: uids and binary fields are left out
+static unsigned text_fields(const struct mec_mr3_item *item,
+                            struct mec_mr3_field *fields) {
+  unsigned n = 0;
+  switch (item->type) {
+  case ISO_8859_1_STRING:
+    if (!mec_mr3_is_iso(item->data, item->len))
+      return add_field(fields, 0, 0, item->len);
+    size_t len;
+    if (!mec_mr3_iso_string(item->data, item->len, &len))
+      return 0;
+    return add_field(fields, 0, item->len - len, len);
+  case SHIFT_JIS_STRING:
+    return add_field(fields, 0, 0, item->len);
+  case STRUCT_436:
+    if (item->len != sizeof(struct buffer436))
+      return 0;
+    n = ADD_FIELD(n, struct buffer436, iver);
+    n = ADD_FIELD(n, struct buffer436, buf3);
+    n = ADD_FIELD(n, struct buffer436, buf4);
+    n = ADD_FIELD(n, struct buffer436, buf5);
+    return ADD_FIELD(n, struct buffer436, modality);
+  case STRUCT_516:
+    if (item->len != sizeof(struct buffer516))
+      return 0;
+    // buf5 is the study instance uid:
+    n = ADD_FIELD(n, struct buffer516, zero);
+    n = ADD_FIELD(n, struct buffer516, buf2);
+    n = ADD_FIELD(n, struct buffer516, buf3);
+    n = ADD_FIELD(n, struct buffer516, buf4);
+    return ADD_FIELD(n, struct buffer516, buf6);
+  case STRUCT_325:
+    if (item->len != sizeof(struct buffer325))
+      return 0;
+    int a;
+    for (a = 0; a < 5; ++a)
+      n = ADD_FIELD(n, struct buffer325, array[a]);
+    return n;
+  default:
+    // STRUCT_136 only holds uids
+    return 0;
+  }
+}
+
+#undef ADD_FIELD
+
+// digits and dots, with at least one dot
+static bool looks_like_uid(const unsigned char *str, size_t len) {
+  bool dot = false;
+  size_t i;
+  for (i = 0; i < len; ++i) {
+    if (str[i] == '.')
+      dot = true;
+    else if (!is_digit(str[i]))
+      return false;
+  }
+  return dot;
+}
+
+// whether the byte at i runs into the token ending or starting at
+// str[i - dir]: a digit, a letter or, within a number, a dot followed by a
+// digit as in 12.5
+static bool continues(const unsigned char *str, size_t len, size_t i, int dir,
+                      bool numeric) {
+  if (is_alnum(str[i]))
+    return true;
+  if (!numeric || str[i] != '.')
+    return false;
+  // the digit is on the far side of the dot:
+  return dir < 0 ? i > 0 && is_digit(str[i - 1])
+                 : i + 1 < len && is_digit(str[i + 1]);
+}
+
+// a needle only counts as a whole token: ANN is not found in SCANNER, 12345
+// is not found in 123456 nor in 1.2.12345
+static bool at_boundaries(const unsigned char *str, size_t len, size_t start,
+                          size_t end, bool numeric) {
+  if (start > 0 && continues(str, len, start - 1, -1, numeric))
+    return false;
+  return end == len || !continues(str, len, end, 1, numeric);
+}
+
+// one text field, up to its nul byte
+static size_t scan_field(const struct mec_mr3_leak_scanner *s,
+                         unsigned char *str, size_t len,
+                         const struct mec_mr3_item *item, size_t base,
+                         bool blank,
+                         void (*report)(const struct mec_mr3_leak *, void *),
+                         void *user) {
+  len = strnlen((const char *)str, len);
+  if (looks_like_uid(str, len))
+    return 0;
+  size_t hits = 0;
+  int32_t state = 0;
+  size_t i;
+  for (i = 0; i < len; ++i) {
+    state = s->delta[(size_t)state * 256 + fold(str[i])];
+    int32_t m = s->match[state] >= 0 ? state : s->next[state];
+    for (; m >= 0; m = s->next[m]) {
+      const size_t needle = (size_t)s->match[m];
+      const size_t n = s->lens[needle];
+      const size_t start = i + 1 - n;
+      if (!at_boundaries(str, len, start, i + 1, s->numeric[needle]))
+        continue;
+      ++hits;
+      if (report) {
+        struct mec_mr3_leak leak;
+        leak.group = item->group;
+        leak.key = item->key;
+        leak.type = item->type;
+        leak.offset = base + start;
+        leak.len = n;
+        leak.needle = needle;
+        report(&leak, user);
+      }
+      // bytes already went through the automaton, safe to overwrite. The
+      // boundaries of the next needles are checked on the blanks:
+      if (blank)
+        memset(str + start, ' ', n);
+    }
+  }
+  return hits;
+}
+
+bool mec_mr3_leak_scan(const struct mec_mr3_leak_scanner *scanner, void *buf,
+                       size_t len, bool blank,
+                       void (*report)(const struct mec_mr3_leak *leak,
+                                      void *user),
+                       void *user, size_t *nhits) {
+  *nhits = 0;
+  // validate the whole layout before the first write:
+  struct mec_mr3_walk w;
+  struct mec_mr3_item item;
+  int ret;
+  mec_mr3_walk_init(&w, buf, len);
+  while ((ret = mec_mr3_walk_next(&w, &item)) == 1) {
+  }
+  if (ret != 0)
+    return false;
+  mec_mr3_walk_init(&w, buf, len);
+  while (mec_mr3_walk_next(&w, &item) == 1) {
+    struct mec_mr3_field fields[MEC_MR3_MAX_FIELDS];
+    const unsigned n = text_fields(&item, fields);
+    const size_t base =
+        (size_t)((const unsigned char *)item.data - w.cursor.start);
+    unsigned f;
+    for (f = 0; f < n; ++f) {
+      const size_t offset = base + fields[f].offset;
+      *nhits += scan_field(scanner, (unsigned char *)buf + offset,
+                           fields[f].len, &item, offset, blank, report, user);
+    }
+  }
+  return true;
+}
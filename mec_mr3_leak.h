@@ -0,0 +1,51 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* search the text fields of a blob for identifiers of the patient (name
+ * components, id...) that the policy did not catch, e.g. a name typed in a
+ * study description. All needles are searched in a single pass with an
+ * Aho-Corasick automaton, ASCII letters compare case insensitively. Needles
+ * only match whole tokens, between bytes that are not ASCII letters or digits:
+ * ANN is not found in SCANNER, 12345 is not found in 123456 nor in 12345.6. */
+struct mec_mr3_leak_scanner;
+
+/* build the automaton for n nul terminated needles, empty needles are
+ * ignored. This is the only allocation. Return NULL on allocation failure. */
+struct mec_mr3_leak_scanner *
+mec_mr3_leak_scanner_create(const char *const *needles, size_t n);
+
+void mec_mr3_leak_scanner_free(struct mec_mr3_leak_scanner *scanner);
+
+/* one occurrence of a needle */
+struct mec_mr3_leak {
+  uint8_t group;
+  uint32_t key;
+  uint32_t type;
+  size_t offset; // of the first byte in the blob
+  size_t len;
+  size_t needle; // index in the needles given to the scanner
+};
+
+/* scan the text fields of buf in linear time, without allocating: the string
+ * after the header of ISO_8859_1_STRING payloads, SHIFT_JIS_STRING payloads
+ * and the strings of the structs that are not uids. Fields made of digits and
+ * dots are taken as uids and skipped, as are binary fields. report (may be
+ * NULL) is called for each occurrence. When blank is true the bytes of each
+ * occurrence are replaced with spaces. Return false on invalid layout, buf is
+ * left untouched then. *nhits is set to the number of occurrences. */
+bool mec_mr3_leak_scan(const struct mec_mr3_leak_scanner *scanner, void *buf,
+                       size_t len, bool blank,
+                       void (*report)(const struct mec_mr3_leak *leak,
+                                      void *user),
+                       void *user, size_t *nhits);
+
+#ifdef __cplusplus
+} /* end extern "C" */
+#endif
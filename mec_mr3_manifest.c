@@ -0,0 +1,124 @@
+#include "mec_mr3_manifest.h"
+
+#include "mec_mr3.h"
+#include "mec_mr3_cursor.h"
+#include "mec_mr3_hash.h"
+#include "mec_mr3_private.h"
+
+#include <stdint.h>
+#include <string.h>
+
+static const unsigned char magic[] = {'M', 'R', '3', 'M', 1, 0, 0, 0};
+
+enum { RECORD_SIZE = 32 };
+
+struct record {
+  uint8_t group;
+  uint8_t action;
+  uint8_t flags;
+  uint32_t key;
+  uint32_t type;
+  uint32_t len;
+  uint64_t offset;
+  uint64_t digest;
+  const void *data;
+};
+
+// little endian, independent of the host:
+static inline void store32(unsigned char *p, uint32_t v) {
+  int b;
+  for (b = 0; b < 4; ++b)
+    p[b] = (unsigned char)(v >> 8 * b);
+}
+
+static inline void store64(unsigned char *p, uint64_t v) {
+  store32(p, (uint32_t)v);
+  store32(p + 4, (uint32_t)(v >> 32));
+}
+
+static inline uint32_t load32(const unsigned char *p) {
+  return (uint32_t)p[0] | (uint32_t)p[1] << 8 | (uint32_t)p[2] << 16 |
+         (uint32_t)p[3] << 24;
+}
+
+static inline uint64_t load64(const unsigned char *p) {
+  return (uint64_t)load32(p) | (uint64_t)load32(p + 4) << 32;
+}
+
+bool mec_mr3_manifest_begin(const struct mec_mr3_sink *sink) {
+  return sink->write(magic, sizeof magic, sink->user);
+}
+
+bool mec_mr3_manifest_field(const struct mec_mr3_sink *sink,
+                            const struct mec_mr3_phi_origin *origin,
+                            uint32_t type, uint8_t action, uint32_t offset,
+                            const void *bytes, uint32_t len,
+                            const uint64_t *digest) {
+  unsigned char hdr[RECORD_SIZE];
+  const uint64_t pos = origin->offset + offset;
+  const uint64_t d = digest ? *digest : 0;
+  hdr[0] = origin->group;
+  hdr[1] = action;
+  hdr[2] = digest ? MEC_MR3_MANIFEST_DIGEST : 0;
+  hdr[3] = 0;
+  store32(hdr + 4, origin->key);
+  store32(hdr + 8, type);
+  store32(hdr + 12, len);
+  store64(hdr + 16, pos);
+  store64(hdr + 24, d);
+  return sink->write(hdr, sizeof hdr, sink->user) &&
+         sink->write(bytes, len, sink->user);
+}
+
+// read next record, return 1 on success, 0 at the end and -1 on error
+static int read_record(struct mec_mr3_cursor *c, struct record *r) {
+  if (mec_mr3_cursor_remaining(c) == 0)
+    return 0;
+  const unsigned char *hdr =
+      (const unsigned char *)mec_mr3_cursor_take(c, RECORD_SIZE);
+  if (!hdr || hdr[3] != 0)
+    return -1;
+  r->group = hdr[0];
+  r->action = hdr[1];
+  r->flags = hdr[2];
+  r->key = load32(hdr + 4);
+  r->type = load32(hdr + 8);
+  r->len = load32(hdr + 12);
+  r->offset = load64(hdr + 16);
+  r->digest = load64(hdr + 24);
+  r->data = mec_mr3_cursor_take(c, r->len);
+  return r->data ? 1 : -1;
+}
+
+static bool check_record(const struct record *r, const unsigned char *buf,
+                         size_t len, const unsigned char *key) {
+  if (r->offset > len || r->len > len - r->offset)
+    return false;
+  if (key && (r->flags & MEC_MR3_MANIFEST_DIGEST))
+    return mec_mr3_siphash(key, buf + r->offset, r->len) == r->digest;
+  return true;
+}
+
+bool mec_mr3_manifest_apply(void *buf, size_t len, const void *manifest,
+                            size_t size, const unsigned char *key) {
+  if (size < sizeof magic || memcmp(manifest, magic, sizeof magic) != 0)
+    return false;
+  const unsigned char *start = (const unsigned char *)manifest + sizeof magic;
+  struct mec_mr3_cursor c;
+  struct record r;
+  int ret;
+  // first pass: validate everything
+  mec_mr3_cursor_init(&c, start, size - sizeof magic);
+  while ((ret = read_record(&c, &r)) == 1) {
+    if (!check_record(&r, buf, len, key))
+      return false;
+  }
+  if (ret != 0)
+    return false;
+  // second pass: write
+  mec_mr3_cursor_init(&c, start, size - sizeof magic);
+  while (read_record(&c, &r) == 1) {
+    memcpy((unsigned char *)buf + r.offset, r.data, r.len);
+  }
+  return true;
+}
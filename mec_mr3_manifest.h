@@ -0,0 +1,36 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* manifest of the bytes modified by a scrub, requested through
+ * mec_mr3_options.manifest. All integers are little endian:
+ *
+ *   header: "MR3M", u32 version (1)
+ *   record: u8 group, u8 action, u8 flags, u8 zero, u32 key, u32 type,
+ *           u32 len, u64 offset, u64 digest, then len bytes
+ *
+ * One record per modified string field: offset is the position of the field in
+ * the blob and the len bytes following the record are its new content. When
+ * flags has MEC_MR3_MANIFEST_DIGEST, digest is mec_mr3_siphash of the original
+ * len bytes with mec_mr3_options.hash_key (no digest is written without a
+ * key: phi strings are short enough to be recovered from a plain checksum).
+ *
+ * mec_mr3_scrub_ex only writes a manifest for a blob it accepted, the streaming
+ * scrubber writes records as it goes. */
+enum { MEC_MR3_MANIFEST_DIGEST = 1 << 0 };
+
+/* replay manifest over buf, a copy of the blob the manifest was made from.
+ * When key is not NULL, the digests are checked against the bytes about to be
+ * overwritten. Every record is validated before the first write: buf is left
+ * unmodified when false is returned. */
+bool mec_mr3_manifest_apply(void *buf, size_t len, const void *manifest,
+                            size_t size, const unsigned char *key);
+
+#ifdef __cplusplus
+} /* end extern "C" */
+#endif
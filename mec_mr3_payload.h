@@ -0,0 +1,105 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+/* type codes of the item payloads, and layouts of the structured ones */
+enum Type {
+  ISO_8859_1_STRING =
+      0x00000300, // ASCII string / or struct with 'ISO-8859-1' marker
+  FLOAT32_VM2N = 0x00000500, // float/32bits VM:2n
+  FLOAT32_VM3N = 0x00000600, // float/32bits VM:3n
+  DATETIME = 0x00000e00,     // Date/Time stored as ASCII
+  STRUCT_136 = 0x001f4100, // Fixed struct 136 bytes (struct with ASCII strings)
+  STRUCT_436 = 0x001f4300, // Fixed struct 436 bytes (struct with ASCII strings)
+  STRUCT_516 = 0x001f4400, // Fixed struct 516 bytes (struct with ASCII strings)
+  STRUCT_325 = 0x001f4600, // Fixed struct 325 bytes (struct with ASCII strings)
+  BOOL_04 = 0xff000400,    // bool/32bits
+  FLOAT32_VM1 = 0xff000800,      // float/32bits
+  INT32_VM1N = 0xff002400,       // int32_t (signed)
+  FLOAT32_VM1N = 0xff002800,     // float/32bits
+  FLOAT64_VM1 = 0xff002900,      // float/64bits
+  BOOL_2A = 0xff002a00,          // bool/32bits
+  SHIFT_JIS_STRING = 0xff002c00, // SHIFT-JIS string
+};
+
+/* header of an ISO_8859_1_STRING payload, when it starts with the magic */
+struct buffer19 {
+  char sig1[0x3];
+  unsigned char len2;
+  char sig2;
+  unsigned char len3;
+  char sig3;
+  char iso[0x9];
+  char sig4;
+  unsigned char len4;
+  char sig5;
+};
+
+static inline bool mec_mr3_is_iso(const void *ptr, size_t nmemb) {
+  static const char magic[] = {(char)0xdf, (char)0xff, 0x79};
+  return nmemb >= sizeof magic && memcmp(ptr, magic, sizeof(magic)) == 0;
+}
+
+// string following the header of an iso payload, NULL when it is invalid
+static inline const char *mec_mr3_iso_string(const void *ptr, size_t nmemb,
+                                             size_t *len) {
+  struct buffer19 b19;
+  if (nmemb < sizeof b19)
+    return NULL;
+  memcpy(&b19, ptr, sizeof b19);
+  if (b19.sig2 != 0x1 || b19.sig3 != 0x0 || b19.sig4 != 0x2 || b19.sig5 != 0x0)
+    return NULL;
+  const size_t diff = nmemb - sizeof b19;
+  if (b19.len2 != nmemb - 4 || b19.len3 != 9 || b19.len4 != diff)
+    return NULL;
+  if (strncmp(b19.iso, "ISO8859-1", 9) != 0)
+    return NULL;
+  *len = b19.len4;
+  return (const char *)ptr + sizeof b19;
+}
+
+typedef char str16[16 + 1];
+typedef char str64[64 + 1];
+
+struct buffer136 {
+  uint32_t zero1;
+  str64 uid1; // Detached Study Management SOP Class (1.2.840.10008.3.1.2.3.1) ?
+  str64 uid2; // 1.2.840.113745.101000.1098000.X.Y.Z
+  uint16_t zero2;
+};
+
+struct buffer436 {
+  uint32_t zero;
+  char iver[0x45];
+  char buf3[0x100]; // phi
+  str64 buf4;
+  str16 buf5;
+  char modality[0x15];
+  uint32_t val;
+};
+
+struct buffer516 {
+  str64 zero; // aka 'none'
+  char buf2[0x15];
+  char buf3[0x100]; // phi
+  str16 buf4;
+  str64 buf5; // Study Instance UID
+  str64 buf6;
+  uint32_t bools[6];
+};
+
+struct buffer325 {
+  str64 array[5];
+};
+
+// the payload is stored packed, make sure the layout matches:
+_Static_assert(offsetof(struct buffer136, zero2) + sizeof(uint16_t) == 136,
+               "buffer136");
+_Static_assert(offsetof(struct buffer436, val) + sizeof(uint32_t) == 436,
+               "buffer436");
+_Static_assert(offsetof(struct buffer516, bools) + 6 * sizeof(uint32_t) == 516,
+               "buffer516");
+_Static_assert(sizeof(struct buffer325) == 325, "buffer325");
@@ -0,0 +1,246 @@
+#include "mec_mr3_policy.h"
+
+#include "mec_mr3_private.h"
+
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// keys with phi, in any group
+enum {
+  DEFAULT_LO = 0x000055f2,
+  DEFAULT_HI = 0x00006d8a,
+};
+
+static const uint8_t default_actions[DEFAULT_HI - DEFAULT_LO + 1] = {
+    [0x000055f2 - DEFAULT_LO] = MEC_MR3_BLANK, /* !!!charset!!! */
+    [0x000055f3 - DEFAULT_LO] = MEC_MR3_BLANK, /* */
+    [0x000055fc - DEFAULT_LO] = MEC_MR3_BLANK, /* */
+    [0x0000560c - DEFAULT_LO] = MEC_MR3_BLANK, /* !!!charset!!! */
+    [0x0000560d - DEFAULT_LO] = MEC_MR3_BLANK, /* */
+    [0x00005612 - DEFAULT_LO] = MEC_MR3_BLANK, /* */
+    [0x00006d77 - DEFAULT_LO] = MEC_MR3_BLANK, /* */
+    [0x00006d80 - DEFAULT_LO] = MEC_MR3_BLANK, /* buffer */
+    [0x00006d83 - DEFAULT_LO] = MEC_MR3_BLANK, /* buffer */
+    [0x00006d8a - DEFAULT_LO] = MEC_MR3_BLANK, /* */
+};
+
+#define DEFAULT_GROUP                                                          \
+  { DEFAULT_LO, sizeof default_actions, default_actions }
+
+static const struct mec_mr3_policy default_policy = {
+    {DEFAULT_GROUP, DEFAULT_GROUP, DEFAULT_GROUP, DEFAULT_GROUP, DEFAULT_GROUP,
+     DEFAULT_GROUP, DEFAULT_GROUP, DEFAULT_GROUP, DEFAULT_GROUP, DEFAULT_GROUP,
+     DEFAULT_GROUP, DEFAULT_GROUP, DEFAULT_GROUP, DEFAULT_GROUP, DEFAULT_GROUP,
+     DEFAULT_GROUP},
+    DEFAULT_GROUP,
+    NULL,
+    NULL,
+    0,
+    0};
+
+#undef DEFAULT_GROUP
+
+const struct mec_mr3_policy *mec_mr3_policy_default(void) {
+  return &default_policy;
+}
+
+enum mec_mr3_action mec_mr3_policy_action(const struct mec_mr3_policy *policy,
+                                          uint8_t group, uint32_t key) {
+  return (enum mec_mr3_action)mec_mr3_policy_lookup(policy, group, key);
+}
+
+static const struct {
+  const char *name;
+  uint8_t action;
+} actions[] = {
+    {"keep", MEC_MR3_KEEP},
+    {"blank", MEC_MR3_BLANK},
+    {"remove", MEC_MR3_REMOVE},
+    {"hash", MEC_MR3_HASH},
+    {"shift", MEC_MR3_SHIFT},
+    {"remap", MEC_MR3_REMAP},
+};
+
+// one or more action names separated by '+'
+static bool parse_action(const char *str, uint8_t *action) {
+  *action = MEC_MR3_KEEP;
+  for (;;) {
+    const size_t len = strcspn(str, "+");
+    size_t i;
+    for (i = 0; i < sizeof actions / sizeof *actions; ++i) {
+      if (strlen(actions[i].name) == len &&
+          strncmp(str, actions[i].name, len) == 0)
+        break;
+    }
+    if (i == sizeof actions / sizeof *actions)
+      return false;
+    *action |= actions[i].action;
+    if (str[len] == 0)
+      return true;
+    str += len + 1;
+  }
+}
+
+static inline bool is_blank(char c) {
+  return c == ' ' || c == '\t' || c == '\r';
+}
+
+static bool parse_rule(const char *line,
+                       struct mec_mr3_policy_rule *rule) {
+  char group[8], key[16], action[16];
+  char extra;
+  if (sscanf(line, " %7s %15s %15s %c", group, key, action, &extra) != 3)
+    return false;
+  if (strcmp(group, "*") == 0) {
+    rule->group = -1;
+  } else {
+    char *end;
+    const unsigned long g = strtoul(group, &end, 10);
+    if (*end != 0 || g == 0 || g >= MEC_MR3_POLICY_GROUPS)
+      return false;
+    rule->group = (int)g;
+  }
+  char *end;
+  const unsigned long k = strtoul(key, &end, 16);
+  if (*end != 0 || (k & 0xfff00000) != 0x0)
+    return false;
+  rule->key = (uint32_t)k;
+  return parse_action(action, &rule->action);
+}
+
+static inline bool rule_applies(const struct mec_mr3_policy_rule *rule,
+                                int group) {
+  return rule->group == -1 || rule->group == group;
+}
+
+// table g, the wildcard one being last: no rule names its group
+static inline struct mec_mr3_policy_group *table_of(struct mec_mr3_policy *p,
+                                                    int g) {
+  return g < MEC_MR3_POLICY_GROUPS ? p->groups + g : &p->wildcard;
+}
+
+static atomic_uint_fast64_t generations = 1;
+
+// compile the rules into one direct-index table per group, plus the wildcard
+static struct mec_mr3_policy *
+compile(const struct mec_mr3_policy_rule *rules, size_t n) {
+  struct mec_mr3_policy *policy = mec_mr3_calloc(1, sizeof *policy);
+  if (!policy)
+    return NULL;
+  size_t size = 0;
+  int g;
+  for (g = 0; g <= MEC_MR3_POLICY_GROUPS; ++g) {
+    struct mec_mr3_policy_group *group = table_of(policy, g);
+    uint32_t lo = UINT32_MAX, hi = 0;
+    size_t r;
+    for (r = 0; r < n; ++r) {
+      if (rule_applies(rules + r, g) && rules[r].action != MEC_MR3_KEEP) {
+        lo = rules[r].key < lo ? rules[r].key : lo;
+        hi = rules[r].key > hi ? rules[r].key : hi;
+      }
+    }
+    group->lo = lo <= hi ? lo : 0;
+    group->n = lo <= hi ? hi - lo + 1 : 0;
+    size += group->n;
+  }
+  uint8_t *table = mec_mr3_calloc(size ? size : 1, 1);
+  if (!table) {
+    free(policy);
+    return NULL;
+  }
+  policy->table = table;
+  for (g = 0; g <= MEC_MR3_POLICY_GROUPS; ++g) {
+    struct mec_mr3_policy_group *group = table_of(policy, g);
+    size_t r;
+    // later rules override earlier ones:
+    for (r = 0; r < n; ++r) {
+      if (rule_applies(rules + r, g) && group->n != 0 &&
+          rules[r].key - group->lo < group->n)
+        table[rules[r].key - group->lo] = rules[r].action;
+    }
+    group->actions = table;
+    table += group->n;
+  }
+  policy->generation =
+      atomic_fetch_add_explicit(&generations, 1, memory_order_relaxed);
+  return policy;
+}
+
+struct mec_mr3_policy *mec_mr3_policy_parse(const char *text, size_t len) {
+  struct mec_mr3_policy_rule *rules = NULL;
+  size_t n = 0, capacity = 0;
+  bool good = true;
+  const char *end = text + len;
+  while (good && text < end) {
+    const char *eol = memchr(text, '\n', (size_t)(end - text));
+    if (!eol)
+      eol = end;
+    // the rule, without its comment and the blanks around it. Only the rule
+    // has to fit in line, comments can be of any length:
+    const char *start = text, *stop = memchr(text, '#', (size_t)(eol - text));
+    if (!stop)
+      stop = eol;
+    while (start < stop && is_blank(*start))
+      ++start;
+    while (stop > start && is_blank(stop[-1]))
+      --stop;
+    char line[128];
+    const size_t linelen = (size_t)(stop - start);
+    good = linelen < sizeof line;
+    if (good && linelen) {
+      memcpy(line, start, linelen);
+      line[linelen] = 0;
+      if (n == capacity) {
+        capacity = capacity ? 2 * capacity : 64;
+        struct mec_mr3_policy_rule *tmp =
+            mec_mr3_realloc(rules, capacity * sizeof *rules);
+        good = tmp != NULL;
+        if (good)
+          rules = tmp;
+      }
+      good = good && parse_rule(line, rules + n++);
+    }
+    text = eol + 1;
+  }
+  struct mec_mr3_policy *policy = good ? compile(rules, n) : NULL;
+  if (policy) {
+    policy->rules = rules;
+    policy->nrules = n;
+  } else {
+    free(rules);
+  }
+  return policy;
+}
+
+struct mec_mr3_policy *mec_mr3_policy_load(const char *filename) {
+  FILE *f = fopen(filename, "rb");
+  if (!f)
+    return NULL;
+  char *text = NULL;
+  size_t len = 0;
+  long fsize = -1;
+  if (fseek(f, 0, SEEK_END) == 0)
+    fsize = ftell(f);
+  if (fsize >= 0 && fseek(f, 0, SEEK_SET) == 0) {
+    text = mec_mr3_malloc((size_t)fsize + 1);
+    if (text)
+      len = fread(text, 1, (size_t)fsize, f);
+  }
+  fclose(f);
+  struct mec_mr3_policy *policy = NULL;
+  if (text && len == (size_t)fsize)
+    policy = mec_mr3_policy_parse(text, len);
+  free(text);
+  return policy;
+}
+
+void mec_mr3_policy_free(struct mec_mr3_policy *policy) {
+  if (!policy || policy == &default_policy)
+    return;
+  free(policy->table);
+  free((void *)policy->rules);
+  free(policy);
+}
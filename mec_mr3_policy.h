@@ -0,0 +1,52 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* what to do with the payload of an item */
+enum mec_mr3_action {
+  MEC_MR3_KEEP = 0,        // leave untouched
+  MEC_MR3_BLANK = 1 << 0,  // replace string with spaces up to its terminator
+  MEC_MR3_REMOVE = 1 << 1, // zero the whole string field
+  MEC_MR3_HASH = 1 << 2,   // keyed, length preserving pseudonym of the string
+  MEC_MR3_SHIFT = 1 << 3,  // move a DATETIME by mec_mr3_options.date_shift
+  MEC_MR3_REMAP = 1 << 4,  // replace UIDs through mec_mr3_options.uid_map
+};
+
+struct mec_mr3_policy;
+
+/* built-in policy: blank the known PHI keys in every group */
+const struct mec_mr3_policy *mec_mr3_policy_default(void);
+
+/* load a policy file, one rule per line:
+ *
+ *   # group key action
+ *   1 55f2 blank
+ *   * 6d80 remove
+ *   1 561a shift
+ *   * 6d80 blank+remap
+ *
+ * group is a decimal group number (1 to 15) or '*' for all groups, key is
+ * hexadecimal. A '#' starts a comment running to the end of the line, a rule
+ * without its comment must fit in 127 bytes.
+ * Actions may be combined with '+'. remap only applies to the UIDs of the
+ * fixed structs, the other actions to their other strings. Keys not listed are
+ * kept. Return NULL on error. */
+struct mec_mr3_policy *mec_mr3_policy_load(const char *filename);
+
+/* same as above from a string in memory */
+struct mec_mr3_policy *mec_mr3_policy_parse(const char *text, size_t len);
+
+void mec_mr3_policy_free(struct mec_mr3_policy *policy);
+
+/* action for an item, a single table access */
+enum mec_mr3_action mec_mr3_policy_action(const struct mec_mr3_policy *policy,
+                                          uint8_t group, uint32_t key);
+
+#ifdef __cplusplus
+} /* end extern "C" */
+#endif
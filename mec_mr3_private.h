@@ -0,0 +1,166 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+struct mec_mr3_options;
+
+/* allocation functions used internally, so that mec_mr3_allocations() can
+ * account for them */
+void *mec_mr3_malloc(size_t size);
+void *mec_mr3_calloc(size_t nmemb, size_t size);
+void *mec_mr3_realloc(void *ptr, size_t size);
+
+/* policy compiled as one direct-index table of actions per group, covering
+ * keys [lo, lo + n). Groups past the tables only get the '*' rules, from the
+ * wildcard table. */
+enum { MEC_MR3_POLICY_GROUPS = 16 };
+
+struct mec_mr3_policy_group {
+  uint32_t lo;
+  uint32_t n;
+  const uint8_t *actions;
+};
+
+/* a line of a policy file, as parsed */
+struct mec_mr3_policy_rule {
+  int group; // -1 for all groups
+  uint32_t key;
+  uint8_t action;
+};
+
+struct mec_mr3_policy {
+  struct mec_mr3_policy_group groups[MEC_MR3_POLICY_GROUPS];
+  struct mec_mr3_policy_group wildcard;
+  void *table; // storage for the actions, NULL for the built-in policy
+  // the rules the tables were compiled from, later ones override earlier
+  // ones. The verifier reads them instead of the tables:
+  const struct mec_mr3_policy_rule *rules;
+  size_t nrules;
+  // unique to each policy ever compiled, 0 for the built-in one: unlike its
+  // address, never reused by a later policy
+  uint64_t generation;
+};
+
+static inline uint8_t mec_mr3_policy_lookup(const struct mec_mr3_policy *p,
+                                            uint8_t group, uint32_t key) {
+  const struct mec_mr3_policy_group *g =
+      group < MEC_MR3_POLICY_GROUPS ? p->groups + group : &p->wildcard;
+  const uint32_t i = key - g->lo; // wraps around for key < lo
+  return i < g->n ? g->actions[i] : 0;
+}
+
+/* replace every byte of str before the first nul byte (or buf_len bytes if
+ * there is none) with a space. Vectorized, picks a kernel for the running cpu
+ * on first call. */
+void mec_mr3_blank(char *str, size_t buf_len);
+
+/* the kernels of mec_mr3_blank, for the tests */
+enum mec_mr3_blank_kernel {
+  MEC_MR3_BLANK_SCALAR,
+  MEC_MR3_BLANK_SSE2,
+  MEC_MR3_BLANK_AVX2,
+};
+
+/* same as mec_mr3_blank with the given kernel. Return false, leaving str
+ * untouched, when the build or the running cpu lacks it */
+bool mec_mr3_blank_with(enum mec_mr3_blank_kernel kernel, char *str,
+                        size_t buf_len);
+
+/* DATETIME payloads hold "dd/mm/yyyy,hh:mm:ss", possibly nul terminated.
+ * Return whether str is a valid one whose date stays within years 0000-9999
+ * once shifted by days. */
+bool mec_mr3_datetime_check(const char *str, size_t len, int days);
+
+/* shift the date of a payload accepted by mec_mr3_datetime_check by days, the
+ * time of day and the length are left as is */
+void mec_mr3_datetime_shift(char *str, size_t len, int days);
+
+enum { MEC_MR3_DATE_LEN = 10 }; // dd/mm/yyyy, the bytes modified by a shift
+
+/* location of a string field inside a phi payload */
+struct mec_mr3_field {
+  uint32_t offset;
+  uint32_t len;
+};
+
+enum { MEC_MR3_MAX_FIELDS = 5 }; // STRUCT_325 holds 5 strings
+
+/* fill fields with the strings of a phi payload of the given type. Return
+ * their number, 0 when the payload is not a valid phi payload. */
+unsigned mec_mr3_phi_fields(const void *ptr, uint32_t len, uint32_t type,
+                            struct mec_mr3_field *fields);
+
+/* validate a payload of the given type against the action that will be
+ * applied on it, must be called before mec_mr3_clean_phi */
+bool mec_mr3_check_phi(const void *ptr, uint32_t len, uint32_t type,
+                       uint8_t action, const struct mec_mr3_options *options);
+
+/* where a phi payload sits in the blob, as reported in the manifest */
+struct mec_mr3_phi_origin {
+  uint8_t group;
+  uint32_t key;
+  uint64_t offset; // of the payload
+};
+
+/* clean a payload accepted by mec_mr3_check_phi. When options has a manifest
+ * sink, one record per modified field is written to it. Return false when the
+ * sink failed. */
+bool mec_mr3_clean_phi(void *ptr, uint32_t len, uint32_t type, uint8_t action,
+                       const struct mec_mr3_options *options,
+                       const struct mec_mr3_phi_origin *origin);
+
+/* location of a phi payload, relative to the start of the blob */
+struct mec_mr3_span {
+  uint32_t offset;
+  uint32_t len;
+  uint32_t type;
+  uint32_t key;
+  uint8_t group;
+  uint8_t action;
+};
+
+// in the wild there is less than a dozen phi items per blob:
+enum { MEC_MR3_MAX_SPANS = 128 };
+
+struct mec_mr3_spans {
+  uint32_t n;
+  struct mec_mr3_span spans[MEC_MR3_MAX_SPANS];
+};
+
+/* first phase, one item at a time: record the span of item when the policy
+ * selects it. Return false when the payload is invalid or there are too many
+ * spans. */
+struct mec_mr3_walk;
+struct mec_mr3_item;
+bool mec_mr3_add_span(struct mec_mr3_spans *spans,
+                      const struct mec_mr3_policy *policy,
+                      const struct mec_mr3_options *options,
+                      const struct mec_mr3_walk *w,
+                      const struct mec_mr3_item *item);
+
+/* between the phases: record in options->uid_map the replacement of every uid
+ * the spans of input remap, so that the second phase can not run out of room
+ * in the map half way. Return false when the map is full. */
+bool mec_mr3_reserve_uids(const void *input, const struct mec_mr3_spans *spans,
+                          const struct mec_mr3_options *options);
+
+/* second phase: clean the recorded spans of output */
+bool mec_mr3_patch_spans(void *output, const struct mec_mr3_spans *spans,
+                         const struct mec_mr3_options *options);
+
+/* mec_mr3_scrub_ex through a layout cache, see mec_mr3_layout.h */
+struct mec_mr3_layout_cache;
+bool mec_mr3_layout_scrub(struct mec_mr3_layout_cache *cache, void *output,
+                          const void *input, size_t len,
+                          const struct mec_mr3_options *options);
+
+/* manifest writers, see mec_mr3_manifest.h for the format */
+struct mec_mr3_sink;
+bool mec_mr3_manifest_begin(const struct mec_mr3_sink *sink);
+bool mec_mr3_manifest_field(const struct mec_mr3_sink *sink,
+                            const struct mec_mr3_phi_origin *origin,
+                            uint32_t type, uint8_t action, uint32_t offset,
+                            const void *bytes, uint32_t len,
+                            const uint64_t *digest);
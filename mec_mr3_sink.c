@@ -0,0 +1,43 @@
+#include "mec_mr3_sink.h"
+
+#include "mec_mr3.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+static bool write_file(const void *buf, size_t n, void *user) {
+  return fwrite(buf, 1, n, user) == n;
+}
+
+void mec_mr3_sink_file(struct mec_mr3_sink *sink, FILE *f) {
+  sink->write = write_file;
+  sink->user = f;
+}
+
+static bool write_memory(const void *ptr, size_t n, void *user) {
+  struct mec_mr3_membuf *buf = user;
+  if (n > buf->capacity - buf->len) {
+    size_t capacity = buf->capacity ? buf->capacity : 64 * 1024;
+    while (n > capacity - buf->len) {
+      if (capacity > SIZE_MAX / 2)
+        return false;
+      capacity *= 2;
+    }
+    char *data = realloc(buf->data, capacity);
+    if (!data)
+      return false;
+    buf->data = data;
+    buf->capacity = capacity;
+  }
+  memcpy(buf->data + buf->len, ptr, n);
+  buf->len += n;
+  return true;
+}
+
+void mec_mr3_sink_memory(struct mec_mr3_sink *sink,
+                         struct mec_mr3_membuf *buf) {
+  sink->write = write_memory;
+  sink->user = buf;
+}
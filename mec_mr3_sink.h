@@ -0,0 +1,28 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdio.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+struct mec_mr3_sink;
+
+/* sink writing to f, which stays owned by the caller */
+void mec_mr3_sink_file(struct mec_mr3_sink *sink, FILE *f);
+
+/* growable memory buffer, zero initialize before use and free data after */
+struct mec_mr3_membuf {
+  char *data;
+  size_t len;
+  size_t capacity;
+};
+
+/* sink appending to buf */
+void mec_mr3_sink_memory(struct mec_mr3_sink *sink,
+                         struct mec_mr3_membuf *buf);
+
+#ifdef __cplusplus
+} /* end extern "C" */
+#endif
@@ -0,0 +1,218 @@
+#include "mec_mr3_stream.h"
+
+#include "mec_mr3_cursor.h"
+#include "mec_mr3_policy.h"
+#include "mec_mr3_private.h"
+
+#include <string.h>
+
+enum State {
+  COUNT,   // accumulating a 4 bytes group count
+  HEADER,  // accumulating a 32 bytes item header
+  PAYLOAD, // passing a payload through
+  PHI,     // accumulating a phi payload
+  TRAILER, // all groups read, optional nul byte
+  DONE,    // nul byte read
+  ERROR,
+};
+
+enum CountKind {
+  FIRST,    // read until last set of group found
+  LAST,     // count following the last set marker
+  REMAINING // remaining groups
+};
+
+void mec_mr3_scrub_init(struct mec_mr3_scrub_ctx *ctx,
+                        const struct mec_mr3_options *options) {
+  ctx->options = options;
+  ctx->policy = options && options->policy ? options->policy
+                                           : mec_mr3_policy_default();
+  ctx->state = COUNT;
+  ctx->count_kind = FIRST;
+  ctx->nitems = 0;
+  ctx->remain = 1;
+  ctx->group = 0;
+  ctx->need = sizeof(uint32_t);
+  ctx->fill = 0;
+  ctx->offset = 0;
+}
+
+static bool emit(const struct mec_mr3_sink *sink, const void *buf, size_t n) {
+  return n == 0 || sink->write(buf, n, sink->user);
+}
+
+// accumulate up to ctx->need bytes into ctx->buf, return whether complete
+static bool accumulate(struct mec_mr3_scrub_ctx *ctx, const unsigned char **p,
+                       size_t *n) {
+  size_t len = ctx->need - ctx->fill;
+  if (len > *n)
+    len = *n;
+  memcpy(ctx->buf + ctx->fill, *p, len);
+  ctx->fill += (uint32_t)len;
+  ctx->offset += len;
+  *p += len;
+  *n -= len;
+  return ctx->fill == ctx->need;
+}
+
+static void expect(struct mec_mr3_scrub_ctx *ctx, int state, uint32_t need) {
+  ctx->state = state;
+  ctx->need = need;
+  ctx->fill = 0;
+}
+
+// an item is complete, move on to the next item or group
+static void next_item(struct mec_mr3_scrub_ctx *ctx) {
+  if (--ctx->nitems != 0) {
+    expect(ctx, HEADER, MEC_MR3_ITEM_HEADER_SIZE);
+  } else if (ctx->count_kind == FIRST) {
+    expect(ctx, COUNT, sizeof(uint32_t));
+  } else if (--ctx->remain != 0) {
+    ctx->count_kind = REMAINING;
+    expect(ctx, COUNT, sizeof(uint32_t));
+  } else {
+    expect(ctx, TRAILER, 0);
+  }
+}
+
+static bool read_count(struct mec_mr3_scrub_ctx *ctx) {
+  uint32_t nitems;
+  memcpy(&nitems, ctx->buf, sizeof nitems);
+  switch (ctx->count_kind) {
+  case FIRST:
+    if (nitems == 0)
+      return false;
+    if (nitems <= 3) {
+      // special case to handle last element
+      ctx->remain = nitems;
+      ctx->count_kind = LAST;
+      expect(ctx, COUNT, sizeof(uint32_t));
+      return true;
+    }
+    break;
+  case LAST:
+    if (nitems == 0)
+      return false;
+    break;
+  case REMAINING:
+    if (nitems <= 3)
+      return false;
+    break;
+  }
+  if (ctx->group == UINT8_MAX)
+    return false; // see mec_mr3_walk_next
+  ++ctx->group;
+  ctx->nitems = nitems;
+  expect(ctx, HEADER, MEC_MR3_ITEM_HEADER_SIZE);
+  return true;
+}
+
+static bool phi_done(struct mec_mr3_scrub_ctx *ctx,
+                     const struct mec_mr3_sink *sink) {
+  if (!mec_mr3_check_phi(ctx->buf, ctx->len, ctx->type, ctx->action,
+                         ctx->options))
+    return false;
+  struct mec_mr3_phi_origin origin;
+  origin.group = ctx->group;
+  origin.key = ctx->key;
+  origin.offset = ctx->offset - ctx->len;
+  if (!mec_mr3_clean_phi(ctx->buf, ctx->len, ctx->type, ctx->action,
+                         ctx->options, &origin))
+    return false;
+  if (!emit(sink, ctx->buf, ctx->len))
+    return false;
+  next_item(ctx);
+  return true;
+}
+
+static bool read_header(struct mec_mr3_scrub_ctx *ctx,
+                        const struct mec_mr3_sink *sink) {
+  struct mec_mr3_item item;
+  if (!mec_mr3_item_header(ctx->buf, &item))
+    return false;
+  if (!emit(sink, ctx->buf, MEC_MR3_ITEM_HEADER_SIZE))
+    return false;
+  ctx->key = item.key;
+  ctx->type = item.type;
+  ctx->len = item.len;
+  ctx->action = mec_mr3_policy_lookup(ctx->policy, ctx->group, item.key);
+  if (ctx->action != MEC_MR3_KEEP) {
+    if (item.len > sizeof ctx->buf)
+      return false;
+    expect(ctx, PHI, item.len);
+    if (item.len == 0)
+      return phi_done(ctx, sink);
+  } else {
+    expect(ctx, PAYLOAD, item.len);
+    if (item.len == 0)
+      next_item(ctx);
+  }
+  return true;
+}
+
+static bool feed(struct mec_mr3_scrub_ctx *ctx, const unsigned char *p,
+                 size_t n, const struct mec_mr3_sink *sink) {
+  while (n != 0) {
+    switch (ctx->state) {
+    case COUNT:
+      if (accumulate(ctx, &p, &n)) {
+        if (!emit(sink, ctx->buf, sizeof(uint32_t)) || !read_count(ctx))
+          return false;
+      }
+      break;
+    case HEADER:
+      if (accumulate(ctx, &p, &n) && !read_header(ctx, sink))
+        return false;
+      break;
+    case PAYLOAD: {
+      // no phi, pass through without buffering:
+      size_t len = ctx->need - ctx->fill;
+      if (len > n)
+        len = n;
+      if (!emit(sink, p, len))
+        return false;
+      ctx->fill += (uint32_t)len;
+      ctx->offset += len;
+      p += len;
+      n -= len;
+      if (ctx->fill == ctx->need)
+        next_item(ctx);
+    } break;
+    case PHI:
+      if (accumulate(ctx, &p, &n) && !phi_done(ctx, sink))
+        return false;
+      break;
+    case TRAILER:
+      // it may be missing one byte (nul byte):
+      if (*p != 0 || !emit(sink, p, 1))
+        return false;
+      ++p;
+      --n;
+      ++ctx->offset;
+      ctx->state = DONE;
+      break;
+    default:
+      // trailing garbage, or fed after an error:
+      return false;
+    }
+  }
+  return true;
+}
+
+bool mec_mr3_scrub_feed(struct mec_mr3_scrub_ctx *ctx, const void *chunk,
+                        size_t n, const struct mec_mr3_sink *sink) {
+  const struct mec_mr3_sink *manifest =
+      ctx->options ? ctx->options->manifest : NULL;
+  bool good = true;
+  if (manifest && ctx->offset == 0 && ctx->fill == 0 && n != 0)
+    good = mec_mr3_manifest_begin(manifest);
+  if (!good || !feed(ctx, (const unsigned char *)chunk, n, sink)) {
+    ctx->state = ERROR;
+    return false;
+  }
+  return true;
+}
+
+bool mec_mr3_scrub_finish(struct mec_mr3_scrub_ctx *ctx) {
+  return ctx->state == TRAILER || ctx->state == DONE;
+}
@@ -0,0 +1,54 @@
+#pragma once
+
+#include "mec_mr3.h"
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* largest PHI payload the streaming scrubber can hold, PHI payloads are
+ * buffered so that they can be validated and cleaned as a whole. In the wild
+ * the largest one is the 516 bytes struct. */
+enum { MEC_MR3_STREAM_MAX_PHI = 4096 };
+
+/* state of the streaming scrubber, treat as opaque */
+struct mec_mr3_scrub_ctx {
+  const struct mec_mr3_options *options;
+  const struct mec_mr3_policy *policy;
+  int state;
+  int count_kind; // meaning of the next group count
+  uint32_t nitems; // items left in current group
+  uint32_t remain; // groups left once the last set of groups was found
+  uint8_t group;
+  uint32_t key;
+  uint32_t type;
+  uint32_t len;  // length of current payload
+  uint8_t action;
+  uint32_t need; // bytes needed to complete current state
+  uint32_t fill; // bytes accumulated in buf
+  uint64_t offset; // bytes consumed so far
+  unsigned char buf[MEC_MR3_STREAM_MAX_PHI];
+};
+
+/* options may be NULL, it must outlive ctx. The manifest sink of options, if
+ * any, is written to as the phi payloads are cleaned. */
+void mec_mr3_scrub_init(struct mec_mr3_scrub_ctx *ctx,
+                        const struct mec_mr3_options *options);
+
+/* feed the next n bytes of the blob, chunks can be split anywhere. Scrubbed
+ * bytes are passed to sink as soon as they are known to be final. Return false
+ * on invalid layout or when the sink failed, the ctx can not be fed anymore.
+ */
+bool mec_mr3_scrub_feed(struct mec_mr3_scrub_ctx *ctx, const void *chunk,
+                        size_t n, const struct mec_mr3_sink *sink);
+
+/* return whether the blob was complete */
+bool mec_mr3_scrub_finish(struct mec_mr3_scrub_ctx *ctx);
+
+#ifdef __cplusplus
+} /* end extern "C" */
+#endif
@@ -0,0 +1,429 @@
+#include "mec_mr3_uid.h"
+
+#include "mec_mr3_hash.h"
+#include "mec_mr3_private.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <sched.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+static const unsigned char magic[] = {'M', 'R', '3', 'U', 2, 0, 0, 0};
+
+static const char root[] = "2.25.";
+
+enum {
+  UID_LEN = 64,
+  UUID_DIGITS = 39, // of 2^128 - 1
+  DEFAULT_CAPACITY = 1 << 20,
+  // a writer killed in the middle of an insert never publishes its slot, see
+  // recover:
+  SPIN_LIMIT = 1 << 20,
+  // replacements drawn for a uid before giving up, each one collides with
+  // probability nslots / (9 * 10^10) at most:
+  MAX_DRAWS = 64,
+};
+
+// owners hold a slot index + 1 on 32 bits:
+#define MAX_SLOTS (UINT64_C(1) << 31)
+
+/* slot states: an inserter claims an empty slot with a compare-and-swap,
+ * fills it, then publishes it. Readers finding a busy slot wait for it. */
+enum { SLOT_EMPTY = 0, SLOT_BUSY = 1, SLOT_READY = 2 };
+
+struct slot {
+  _Atomic uint32_t state;
+  uint32_t len;
+  uint64_t hash; // of uid
+  char uid[UID_LEN];
+  char new_uid[UID_LEN];
+};
+
+/* layout of the file, in native byte order: the header, the slots then the
+ * owners. owners is a second table indexed by the hash of the replacements,
+ * holding the index + 1 of the slot each replacement was given to (0: free).
+ */
+struct header {
+  unsigned char magic[8];
+  uint64_t nslots; // power of two
+  unsigned char key[MEC_MR3_HASH_KEY_SIZE];
+  _Atomic uint64_t size;
+  _Atomic uint64_t inserting; // inserts in progress, left over by a crash
+  unsigned char reserved[16];
+};
+
+_Static_assert(sizeof(struct header) == 64, "header");
+
+struct mec_mr3_uid_map {
+  struct header *header;
+  struct slot *slots;
+  _Atomic uint32_t *owners;
+  uint64_t mask;
+  size_t len; // of the mapping
+  int fd;     // holds a shared lock on the file, -1 in memory
+};
+
+static bool random_key(unsigned char *key) {
+  const int fd = open("/dev/urandom", O_RDONLY);
+  if (fd < 0)
+    return false;
+  const bool good =
+      read(fd, key, MEC_MR3_HASH_KEY_SIZE) == MEC_MR3_HASH_KEY_SIZE;
+  close(fd);
+  return good;
+}
+
+static inline size_t mapping_len(uint64_t nslots) {
+  return sizeof(struct header) +
+         (size_t)nslots * (sizeof(struct slot) + sizeof(uint32_t));
+}
+
+// keep the table at most half full:
+static uint64_t slots_for(size_t capacity) {
+  uint64_t nslots = 1;
+  while (nslots < 2 * (uint64_t)capacity)
+    nslots *= 2;
+  return nslots;
+}
+
+static bool init_header(struct header *header, uint64_t nslots) {
+  memcpy(header->magic, magic, sizeof magic);
+  header->nslots = nslots;
+  atomic_init(&header->size, 0);
+  atomic_init(&header->inserting, 0);
+  return random_key(header->key);
+}
+
+/* give back the slots of the inserts that never completed: the process making
+ * them died. Only called by the single process having the file open, which
+ * holds an exclusive lock. Such a slot can simply be emptied: no uid was
+ * inserted past it in a probe sequence, as that waits for the slot to be
+ * published. The replacement it may have claimed stays taken, harmlessly. */
+static void recover(void *addr) {
+  struct header *header = addr;
+  if (atomic_load_explicit(&header->inserting, memory_order_relaxed) == 0)
+    return;
+  struct slot *slots = (struct slot *)(header + 1);
+  uint64_t i;
+  for (i = 0; i < header->nslots; ++i) {
+    if (atomic_load_explicit(&slots[i].state, memory_order_relaxed) ==
+        SLOT_BUSY)
+      atomic_store_explicit(&slots[i].state, SLOT_EMPTY,
+                            memory_order_relaxed);
+  }
+  atomic_store_explicit(&header->inserting, 0, memory_order_relaxed);
+}
+
+// map the table of a file that has a header already
+static void *map_existing(int fd, const struct stat *st, int flags,
+                          size_t *len) {
+  struct header header;
+  if ((size_t)st->st_size < sizeof header ||
+      pread(fd, &header, sizeof header, 0) != (ssize_t)sizeof header)
+    return MAP_FAILED;
+  if (memcmp(header.magic, magic, sizeof magic) != 0 || header.nslots == 0 ||
+      (header.nslots & (header.nslots - 1)) != 0 ||
+      header.nslots > MAX_SLOTS ||
+      header.nslots > SIZE_MAX / (sizeof(struct slot) + sizeof(uint32_t)) ||
+      (uint64_t)st->st_size != mapping_len(header.nslots))
+    return MAP_FAILED;
+  *len = (size_t)st->st_size;
+  return mmap(NULL, *len, PROT_READ | PROT_WRITE, flags, fd, 0);
+}
+
+// map the table of fd, initializing it when the file is empty
+static void *map_table(int fd, size_t capacity, size_t *len) {
+  struct stat st;
+  if (fstat(fd, &st) != 0)
+    return MAP_FAILED;
+  if (st.st_size == 0) {
+    const uint64_t nslots = slots_for(capacity);
+    *len = mapping_len(nslots);
+    // sparse, slots are zero (empty) until written:
+    if (ftruncate(fd, (off_t)*len) != 0)
+      return MAP_FAILED;
+    void *addr = mmap(NULL, *len, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (addr != MAP_FAILED && !init_header(addr, nslots)) {
+      munmap(addr, *len);
+      return MAP_FAILED;
+    }
+    return addr;
+  }
+  return map_existing(fd, &st, MAP_SHARED, len);
+}
+
+/* every process using the file holds a shared lock on it for as long as the
+ * map is open. The one taking the exclusive lock is alone: it creates the
+ * table or recovers it from a crash, then downgrades its lock. */
+static void *map_file(const char *filename, size_t capacity, size_t *len,
+                      int *fd) {
+  *fd = open(filename, O_RDWR | O_CREAT | O_CLOEXEC, 0666);
+  if (*fd < 0)
+    return MAP_FAILED;
+  void *addr = MAP_FAILED;
+  if (flock(*fd, LOCK_EX | LOCK_NB) == 0) {
+    addr = map_table(*fd, capacity, len);
+    if (addr != MAP_FAILED)
+      recover(addr);
+    if (flock(*fd, LOCK_SH) != 0 && addr != MAP_FAILED) {
+      munmap(addr, *len);
+      addr = MAP_FAILED;
+    }
+  } else if (flock(*fd, LOCK_SH) == 0) {
+    // waited for the creator, if any:
+    struct stat st;
+    if (fstat(*fd, &st) == 0)
+      addr = map_existing(*fd, &st, MAP_SHARED, len);
+  }
+  if (addr == MAP_FAILED) {
+    close(*fd);
+    *fd = -1;
+  }
+  return addr;
+}
+
+static void *map_memory(size_t capacity, size_t *len) {
+  const uint64_t nslots = slots_for(capacity);
+  *len = mapping_len(nslots);
+  void *addr = mmap(NULL, *len, PROT_READ | PROT_WRITE,
+                    MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (addr != MAP_FAILED && !init_header(addr, nslots)) {
+    munmap(addr, *len);
+    return MAP_FAILED;
+  }
+  return addr;
+}
+
+// copy-on-write mapping of the table of filename, never written back
+static void *map_private(const char *filename, size_t *len) {
+  const int fd = open(filename, O_RDONLY);
+  if (fd < 0)
+    return errno == ENOENT ? map_memory(DEFAULT_CAPACITY, len) : MAP_FAILED;
+  void *addr = MAP_FAILED;
+  struct stat st;
+  // alone, the copy can be recovered; otherwise wait for a creator to be done
+  // with the header:
+  const bool alone = flock(fd, LOCK_EX | LOCK_NB) == 0;
+  if (alone || flock(fd, LOCK_SH) == 0) {
+    if (fstat(fd, &st) == 0)
+      addr = st.st_size == 0 ? map_memory(DEFAULT_CAPACITY, len)
+                             : map_existing(fd, &st, MAP_PRIVATE, len);
+    if (alone && addr != MAP_FAILED)
+      recover(addr);
+    flock(fd, LOCK_UN);
+  }
+  close(fd);
+  return addr;
+}
+
+static struct mec_mr3_uid_map *attach(struct mec_mr3_uid_map *map,
+                                      void *addr) {
+  if (addr == MAP_FAILED) {
+    free(map);
+    return NULL;
+  }
+  map->header = addr;
+  map->slots = (struct slot *)(map->header + 1);
+  map->owners = (_Atomic uint32_t *)(map->slots + map->header->nslots);
+  map->mask = map->header->nslots - 1;
+  return map;
+}
+
+struct mec_mr3_uid_map *mec_mr3_uid_map_open(const char *filename,
+                                             size_t capacity) {
+  if (capacity == 0)
+    capacity = DEFAULT_CAPACITY;
+  if (capacity > MAX_SLOTS / 2 ||
+      capacity > (SIZE_MAX - sizeof(struct header)) /
+                     (sizeof(struct slot) + sizeof(uint32_t)) / 2)
+    return NULL;
+  struct mec_mr3_uid_map *map = mec_mr3_malloc(sizeof *map);
+  if (!map)
+    return NULL;
+  map->fd = -1;
+  void *addr = filename ? map_file(filename, capacity, &map->len, &map->fd)
+                        : map_memory(capacity, &map->len);
+  return attach(map, addr);
+}
+
+struct mec_mr3_uid_map *mec_mr3_uid_map_open_private(const char *filename) {
+  struct mec_mr3_uid_map *map = mec_mr3_malloc(sizeof *map);
+  if (!map)
+    return NULL;
+  map->fd = -1;
+  return attach(map, map_private(filename, &map->len));
+}
+
+void mec_mr3_uid_map_close(struct mec_mr3_uid_map *map) {
+  if (!map)
+    return;
+  munmap(map->header, map->len);
+  if (map->fd >= 0)
+    close(map->fd); // releases the lock
+  free(map);
+}
+
+size_t mec_mr3_uid_map_size(const struct mec_mr3_uid_map *map) {
+  return (size_t)atomic_load_explicit(&map->header->size,
+                                      memory_order_relaxed);
+}
+
+/* decimal digits out of siphash(key, hash, draw, counter), all little endian:
+ * each hash gives 19 digits */
+struct digits {
+  const unsigned char *key;
+  unsigned char block[24];
+  uint64_t counter;
+  uint64_t bits;
+  int n;
+};
+
+static unsigned next_digit(struct digits *d) {
+  if (d->n == 0) {
+    int b;
+    for (b = 0; b < 8; ++b)
+      d->block[16 + b] = (unsigned char)(d->counter >> 8 * b);
+    ++d->counter;
+    d->bits = mec_mr3_siphash(d->key, d->block, sizeof d->block);
+    d->n = 19; // 10^19 < 2^64
+  }
+  const unsigned digit = (unsigned)(d->bits % 10);
+  d->bits /= 10;
+  --d->n;
+  return digit;
+}
+
+// n digits of a uid component, the first one in [1, first]: no leading zero
+static void component(struct digits *d, char *out, size_t n, unsigned first) {
+  out[0] = (char)('1' + next_digit(d) % first);
+  size_t i;
+  for (i = 1; i < n; ++i)
+    out[i] = (char)('0' + next_digit(d));
+}
+
+// draw number draw of the replacement, of len characters: the root and the
+// number of a uuid, at most UUID_DIGITS digits below 2^128. The rest of a long
+// uid goes to a second component.
+static void make_uid(const unsigned char *key, uint64_t hash, uint64_t draw,
+                     size_t len, char *out) {
+  struct digits d;
+  d.key = key;
+  d.counter = 0;
+  d.n = 0;
+  int b;
+  for (b = 0; b < 8; ++b) {
+    d.block[b] = (unsigned char)(hash >> 8 * b);
+    d.block[8 + b] = (unsigned char)(draw >> 8 * b);
+  }
+  memcpy(out, root, sizeof root - 1);
+  out += sizeof root - 1;
+  const size_t n = len - (sizeof root - 1);
+  // 2^128 has 39 digits, starting with 3:
+  if (n <= UUID_DIGITS) {
+    component(&d, out, n, n == UUID_DIGITS ? 2 : 9);
+    return;
+  }
+  // one digit at least after the dot:
+  const size_t first = n - 2 < UUID_DIGITS ? n - 2 : UUID_DIGITS;
+  component(&d, out, first, first == UUID_DIGITS ? 2 : 9);
+  out[first] = '.';
+  component(&d, out + first + 1, n - first - 1, 9);
+}
+
+// record that the replacement in slot index is taken, false when another
+// slot has it already
+static bool claim(struct mec_mr3_uid_map *map, uint64_t index) {
+  const struct slot *s = map->slots + index;
+  const uint64_t hash = mec_mr3_siphash(map->header->key, s->new_uid, s->len);
+  uint64_t n;
+  for (n = 0; n <= map->mask; ++n) {
+    _Atomic uint32_t *owner = map->owners + ((hash + n) & map->mask);
+    uint32_t o = atomic_load_explicit(owner, memory_order_acquire);
+    // publishes new_uid along with the owner:
+    while (o == 0 && !atomic_compare_exchange_weak_explicit(
+                         owner, &o, (uint32_t)index + 1,
+                         memory_order_acq_rel, memory_order_acquire)) {
+    }
+    if (o == 0)
+      return true;
+    const struct slot *other = map->slots + (o - 1);
+    if (other->len == s->len && memcmp(other->new_uid, s->new_uid, s->len) == 0)
+      return false;
+  }
+  return false; // not reached, there are as many owners as slots
+}
+
+static uint32_t wait_ready(struct slot *s) {
+  uint32_t state = SLOT_BUSY;
+  int n;
+  for (n = 0; n < SPIN_LIMIT && state == SLOT_BUSY; ++n) {
+    sched_yield();
+    state = atomic_load_explicit(&s->state, memory_order_acquire);
+  }
+  return state;
+}
+
+// fill slot index, claimed for uid, and publish it
+static bool insert(struct mec_mr3_uid_map *map, uint64_t index, const char *uid,
+                   size_t len, uint64_t hash, char *out) {
+  struct slot *s = map->slots + index;
+  s->len = (uint32_t)len;
+  s->hash = hash;
+  memcpy(s->uid, uid, len);
+  uint64_t draw = 0;
+  do {
+    make_uid(map->header->key, hash, draw, len, s->new_uid);
+  } while (!claim(map, index) && ++draw < MAX_DRAWS);
+  if (draw == MAX_DRAWS) {
+    // give the slot back, readers waiting on it fail:
+    atomic_store_explicit(&s->state, SLOT_EMPTY, memory_order_release);
+    return false;
+  }
+  atomic_store_explicit(&s->state, SLOT_READY, memory_order_release);
+  atomic_fetch_add_explicit(&map->header->size, 1, memory_order_relaxed);
+  memcpy(out, s->new_uid, len);
+  return true;
+}
+
+bool mec_mr3_uid_map_get(struct mec_mr3_uid_map *map, const char *uid,
+                         size_t len, char *out) {
+  if (len < MEC_MR3_UID_MIN_LEN || len > UID_LEN)
+    return false;
+  const uint64_t hash = mec_mr3_siphash(map->header->key, uid, len);
+  _Atomic uint64_t *inserting = &map->header->inserting;
+  uint64_t n;
+  for (n = 0; n <= map->mask; ++n) {
+    const uint64_t index = (hash + n) & map->mask;
+    struct slot *s = map->slots + index;
+    uint32_t state = atomic_load_explicit(&s->state, memory_order_acquire);
+    if (state == SLOT_EMPTY) {
+      // counted before the slot is taken, a crash in between is then seen:
+      atomic_fetch_add_explicit(inserting, 1, memory_order_relaxed);
+      if (atomic_compare_exchange_strong_explicit(&s->state, &state, SLOT_BUSY,
+                                                  memory_order_acquire,
+                                                  memory_order_acquire)) {
+        const bool good = insert(map, index, uid, len, hash, out);
+        atomic_fetch_sub_explicit(inserting, 1, memory_order_relaxed);
+        return good;
+      }
+      atomic_fetch_sub_explicit(inserting, 1, memory_order_relaxed);
+    }
+    // the slot is (or just got) taken, by this uid maybe:
+    if (state == SLOT_BUSY)
+      state = wait_ready(s);
+    if (state != SLOT_READY)
+      return false;
+    if (s->hash == hash && s->len == len && memcmp(s->uid, uid, len) == 0) {
+      memcpy(out, s->new_uid, len);
+      return true;
+    }
+  }
+  return false;
+}
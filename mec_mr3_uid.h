@@ -0,0 +1,61 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+struct mec_mr3_uid_map;
+
+enum { MEC_MR3_UID_MIN_LEN = 16 }; // "2.25." and 11 digits
+
+/* map of original to replacement UIDs, to be set in mec_mr3_options.uid_map
+ * for the remap action. A replacement has the length of the original UID so
+ * that it is written in place: "2.25." followed by digits derived from a keyed
+ * hash of the original, the key being drawn at random when the map is created.
+ * The 2.25 component is a uuid, at most 39 digits and below 2^128, the rest of
+ * a longer uid is a second component: "2.25.<39 digits>.<digits>".
+ * Replacements are unique: one already given to another UID is drawn again.
+ * UIDs shorter than MEC_MR3_UID_MIN_LEN leave too few digits for that and are
+ * refused.
+ *
+ * The map is an open addressing table of a fixed number of slots, inserts and
+ * lookups are lock free so one map is shared by all the scrubbing threads.
+ * With a filename, the table lives in that file (created when missing) through
+ * a shared mapping: mappings survive restarts and processes using the same
+ * file concurrently agree on them. The file stays locked (shared) while the
+ * map is open: a process opening it alone gives back the slots left
+ * half-written by a process that crashed, which would otherwise block every
+ * later lookup reaching them. NULL keeps the map in memory.
+ *
+ * capacity is only used on creation (0: 1 << 20): the table gets 2 * capacity
+ * slots rounded up to a power of two, one per UID, so that it stays at most
+ * half full with capacity UIDs. Lookups slow down past that load, the map is
+ * full when every slot is taken. Return NULL on error. */
+struct mec_mr3_uid_map *mec_mr3_uid_map_open(const char *filename,
+                                             size_t capacity);
+
+/* open the map of filename for a dry run: the file is mapped copy-on-write, so
+ * replacements recorded from then on are only seen by this process and the
+ * file is never modified. A missing or empty file gives an empty map. Return
+ * NULL on error. */
+struct mec_mr3_uid_map *mec_mr3_uid_map_open_private(const char *filename);
+
+void mec_mr3_uid_map_close(struct mec_mr3_uid_map *map);
+
+/* write to out the replacement of the len bytes of uid, out may be equal to
+ * uid. A new replacement is recorded on first use. Return false when len is
+ * not in [MEC_MR3_UID_MIN_LEN, 64], or for a new uid once all the slots are
+ * taken (see mec_mr3_uid_map_open), or in the unlikely case where no unique
+ * replacement was found. */
+bool mec_mr3_uid_map_get(struct mec_mr3_uid_map *map, const char *uid,
+                         size_t len, char *out);
+
+/* number of UIDs in the map */
+size_t mec_mr3_uid_map_size(const struct mec_mr3_uid_map *map);
+
+#ifdef __cplusplus
+} /* end extern "C" */
+#endif
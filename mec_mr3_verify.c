@@ -0,0 +1,257 @@
+#include "mec_mr3_verify.h"
+
+#include "mec_mr3.h"
+#include "mec_mr3_cursor.h"
+#include "mec_mr3_payload.h"
+#include "mec_mr3_policy.h"
+#include "mec_mr3_private.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+/* each check returns the offset of the first offending byte in str, len when
+ * the field is fine. The loops have no early exit on the common path so that
+ * they get vectorized. */
+
+static size_t check_zeros(const unsigned char *str, size_t len) {
+  unsigned char acc = 0;
+  size_t i;
+  for (i = 0; i < len; ++i)
+    acc |= str[i];
+  if (acc == 0)
+    return len;
+  for (i = 0; str[i] == 0; ++i) {
+  }
+  return i;
+}
+
+static size_t check_spaces(const unsigned char *str, size_t len) {
+  const size_t n = strnlen((const char *)str, len);
+  unsigned char acc = 0;
+  size_t i;
+  for (i = 0; i < n; ++i)
+    acc |= str[i] ^ ' ';
+  if (acc == 0)
+    return len;
+  for (i = 0; str[i] == ' '; ++i) {
+  }
+  return i;
+}
+
+// same alphabet as hash_buffer: A-Z 2-7
+static inline bool is_token(unsigned char c) {
+  return (unsigned char)(c - 'A') < 26 || (unsigned char)(c - '2') < 6;
+}
+
+static size_t check_token(const unsigned char *str, size_t len) {
+  const size_t n = strnlen((const char *)str, len);
+  bool good = true;
+  size_t i;
+  for (i = 0; i < n; ++i)
+    good &= is_token(str[i]);
+  if (good)
+    return len;
+  for (i = 0; is_token(str[i]); ++i) {
+  }
+  return i;
+}
+
+static size_t check_field(const unsigned char *str, size_t len,
+                          uint8_t action) {
+  // same precedence as clean_buffer:
+  if (action & MEC_MR3_REMOVE)
+    return check_zeros(str, len);
+  if (action & MEC_MR3_HASH)
+    return check_token(str, len);
+  if (action & MEC_MR3_SHIFT)
+    return mec_mr3_datetime_check((const char *)str, len, 0) ? len : 0;
+  return check_spaces(str, len);
+}
+
+/* the tables below are kept apart from the ones of the scrubber on purpose:
+ * a key or a field the scrubber misses must not be missed here as well */
+
+// keys of the built-in policy, blanked in every group
+static const uint32_t default_keys[] = {
+    0x55f2, 0x55f3, 0x55fc, 0x560c, 0x560d,
+    0x5612, 0x6d77, 0x6d80, 0x6d83, 0x6d8a,
+};
+
+/* actions of the keys named by the rules of a policy, sorted by key. Built
+ * once per call from the rules so that each item costs a binary search */
+struct key_actions {
+  uint32_t key;
+  // one per group of the tables, then the groups past them:
+  uint8_t actions[MEC_MR3_POLICY_GROUPS + 1];
+};
+
+struct actions {
+  const struct mec_mr3_policy *policy;
+  struct key_actions *keys; // NULL for the built-in policy
+  size_t n;
+};
+
+static int compare_keys(const void *a, const void *b) {
+  const uint32_t x = ((const struct key_actions *)a)->key;
+  const uint32_t y = ((const struct key_actions *)b)->key;
+  return (x > y) - (x < y);
+}
+
+static struct key_actions *find_key(const struct actions *a, uint32_t key) {
+  const struct key_actions k = {key, {0}};
+  return bsearch(&k, a->keys, a->n, sizeof k, compare_keys);
+}
+
+static bool actions_init(struct actions *a,
+                         const struct mec_mr3_policy *policy) {
+  a->policy = policy;
+  a->keys = NULL;
+  a->n = 0;
+  if (policy == mec_mr3_policy_default() || policy->nrules == 0)
+    return true;
+  a->keys = mec_mr3_calloc(policy->nrules, sizeof *a->keys);
+  if (!a->keys)
+    return false;
+  size_t i;
+  for (i = 0; i < policy->nrules; ++i)
+    a->keys[i].key = policy->rules[i].key;
+  qsort(a->keys, policy->nrules, sizeof *a->keys, compare_keys);
+  for (i = 0; i < policy->nrules; ++i) {
+    if (a->n == 0 || a->keys[a->n - 1].key != a->keys[i].key)
+      a->keys[a->n++] = a->keys[i];
+  }
+  // replay the rules, the last one for a key and group wins:
+  for (i = 0; i < policy->nrules; ++i) {
+    const struct mec_mr3_policy_rule *rule = policy->rules + i;
+    struct key_actions *k = find_key(a, rule->key);
+    if (rule->group == -1)
+      memset(k->actions, rule->action, sizeof k->actions);
+    else
+      k->actions[rule->group] = rule->action;
+  }
+  return true;
+}
+
+static uint8_t action_of(const struct actions *a, uint8_t group,
+                         uint32_t key) {
+  size_t i;
+  if (a->policy == mec_mr3_policy_default()) {
+    for (i = 0; i < sizeof default_keys / sizeof *default_keys; ++i) {
+      if (default_keys[i] == key)
+        return MEC_MR3_BLANK;
+    }
+    return MEC_MR3_KEEP;
+  }
+  const struct key_actions *k = find_key(a, key);
+  if (!k)
+    return MEC_MR3_KEEP;
+  return k->actions[group < MEC_MR3_POLICY_GROUPS ? group
+                                                  : MEC_MR3_POLICY_GROUPS];
+}
+
+// strings of the phi payloads: len 0 runs to the end of the payload
+static const struct {
+  uint32_t type;
+  uint32_t size; // of the payload, 0 for any
+  uint32_t offset;
+  uint32_t len;
+} phi_fields[] = {
+    {STRUCT_436, 436, 0x49, 0x100},   {STRUCT_516, 516, 0x56, 0x100},
+    {STRUCT_325, 325, 0, 65},         {STRUCT_325, 325, 65, 65},
+    {STRUCT_325, 325, 130, 65},       {STRUCT_325, 325, 195, 65},
+    {STRUCT_325, 325, 260, 65},       {SHIFT_JIS_STRING, 0, 0, 0},
+    {DATETIME, 0, 0, 0},
+};
+
+_Static_assert(offsetof(struct buffer436, buf3) == 0x49, "buffer436");
+_Static_assert(offsetof(struct buffer516, buf3) == 0x56, "buffer516");
+
+// fill fields for an item of a phi key, 0 when its payload is not a phi one
+static unsigned fields_of(const struct mec_mr3_item *item,
+                          struct mec_mr3_field *fields) {
+  if (item->type == ISO_8859_1_STRING) {
+    size_t len;
+    if (!mec_mr3_is_iso(item->data, item->len)) {
+      fields[0].offset = 0;
+      fields[0].len = item->len;
+    } else if (mec_mr3_iso_string(item->data, item->len, &len)) {
+      fields[0].offset = (uint32_t)(item->len - len);
+      fields[0].len = (uint32_t)len;
+    } else {
+      return 0;
+    }
+    return 1;
+  }
+  unsigned n = 0;
+  size_t i;
+  for (i = 0; i < sizeof phi_fields / sizeof *phi_fields; ++i) {
+    if (phi_fields[i].type != item->type ||
+        (phi_fields[i].size != 0 && phi_fields[i].size != item->len))
+      continue;
+    fields[n].offset = phi_fields[i].offset;
+    fields[n].len = phi_fields[i].len ? phi_fields[i].len : item->len;
+    ++n;
+  }
+  return n;
+}
+
+bool mec_mr3_verify_scrubbed(const void *buf, size_t len,
+                             const struct mec_mr3_options *options,
+                             struct mec_mr3_verify_report *report) {
+  struct mec_mr3_verify_report r;
+  memset(&r, 0, sizeof r);
+  const struct mec_mr3_policy *policy =
+      options && options->policy ? options->policy : mec_mr3_policy_default();
+  struct actions actions;
+  if (!actions_init(&actions, policy)) {
+    if (report)
+      *report = r;
+    return false;
+  }
+
+  struct mec_mr3_walk w;
+  mec_mr3_walk_init(&w, buf, len);
+  struct mec_mr3_item item;
+  int ret = -1;
+  while ((ret = mec_mr3_walk_next(&w, &item)) == 1) {
+    ++r.items;
+    // a remapped uid can not be told from the original one:
+    const uint8_t action =
+        action_of(&actions, item.group, item.key) & ~MEC_MR3_REMAP;
+    if (action == MEC_MR3_KEEP)
+      continue;
+    const unsigned char *data = (const unsigned char *)item.data;
+    struct mec_mr3_field fields[MEC_MR3_MAX_FIELDS];
+    const unsigned n = fields_of(&item, fields);
+    if (n == 0 && r.failures++ == 0) {
+      // the scrubber would have refused this payload
+      r.group = item.group;
+      r.key = item.key;
+      r.offset = (size_t)(data - w.cursor.start);
+    }
+    unsigned f;
+    for (f = 0; f < n; ++f) {
+      ++r.fields;
+      const unsigned char *str = data + fields[f].offset;
+      const size_t bad = check_field(str, fields[f].len, action);
+      if (bad == fields[f].len) {
+        // a pseudonym or a shifted date looks like any other value of
+        // the same alphabet or format: only the format was checked
+        if (!(action & MEC_MR3_REMOVE) &&
+            (action & (MEC_MR3_HASH | MEC_MR3_SHIFT)))
+          ++r.unverifiable;
+        continue;
+      }
+      if (r.failures++ == 0) {
+        r.group = item.group;
+        r.key = item.key;
+        r.offset = (size_t)(str + bad - w.cursor.start);
+      }
+    }
+  }
+  free(actions.keys);
+  r.valid = ret == 0;
+  if (report)
+    *report = r;
+  return r.valid && r.failures == 0;
+}
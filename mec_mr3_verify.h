@@ -0,0 +1,43 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+struct mec_mr3_options;
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* outcome of mec_mr3_verify_scrubbed */
+struct mec_mr3_verify_report {
+  bool valid;        // false when the blob layout itself is invalid
+  uint32_t items;    // items walked
+  uint32_t fields;   // phi string fields checked
+  uint32_t failures; // phi string fields with unexpected content
+  // fields hashed or shifted: in the expected format, but there is no telling
+  // the original from the replacement
+  uint32_t unverifiable;
+  // first failure, when failures != 0:
+  uint8_t group;
+  uint32_t key;
+  size_t offset; // of the first offending byte in the blob
+};
+
+/* check that buf was scrubbed with the policy of options (may be NULL): every
+ * phi string must be spaces (blank) or zeros (remove) up to its terminator.
+ * The phi keys and fields come from tables of the verifier, not the ones of
+ * the scrubber. Hashed strings only have their alphabet checked (a name in
+ * capitals passes) and shifted dates their format, they are counted in
+ * report->unverifiable. Only the headers and the phi payloads are read.
+ * The rules of the policy are compiled into a table of their own on each
+ * call, the only allocation. Return true when the layout is valid and no phi
+ * was found, false as well on allocation failure. report may be NULL. */
+bool mec_mr3_verify_scrubbed(const void *buf, size_t len,
+                             const struct mec_mr3_options *options,
+                             struct mec_mr3_verify_report *report);
+
+#ifdef __cplusplus
+} /* end extern "C" */
+#endif
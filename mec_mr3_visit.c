@@ -0,0 +1,193 @@
+#include "mec_mr3_visit.h"
+
+#include "mec_mr3_payload.h"
+#include "mec_mr3_private.h"
+
+#include <stddef.h>
+#include <string.h>
+
+// view of a fixed size field of a struct laid over the payload
+#define FIELD(data, type, member)                                              \
+  field((const char *)(data) + offsetof(type, member),                        \
+        sizeof(((type *)0)->member))
+
+static struct mec_mr3_str field(const char *ptr, size_t size) {
+  struct mec_mr3_str str = {ptr, strnlen(ptr, size)};
+  return str;
+}
+
+static bool visit_struct136(const struct mec_mr3_item *item,
+                            const struct mec_mr3_visitor *v, void *user) {
+  if (item->len != sizeof(struct buffer136))
+    return false;
+  if (!v->on_struct136)
+    return true;
+  struct mec_mr3_struct136 s;
+  s.uid1 = FIELD(item->data, struct buffer136, uid1);
+  s.uid2 = FIELD(item->data, struct buffer136, uid2);
+  return v->on_struct136(item, &s, user);
+}
+
+static bool visit_struct436(const struct mec_mr3_item *item,
+                            const struct mec_mr3_visitor *v, void *user) {
+  if (item->len != sizeof(struct buffer436))
+    return false;
+  if (!v->on_struct436)
+    return true;
+  struct mec_mr3_struct436 s;
+  s.iver = FIELD(item->data, struct buffer436, iver);
+  s.buf3 = FIELD(item->data, struct buffer436, buf3);
+  s.buf4 = FIELD(item->data, struct buffer436, buf4);
+  s.buf5 = FIELD(item->data, struct buffer436, buf5);
+  s.modality = FIELD(item->data, struct buffer436, modality);
+  memcpy(&s.val, (const char *)item->data + offsetof(struct buffer436, val),
+         sizeof s.val);
+  return v->on_struct436(item, &s, user);
+}
+
+static bool visit_struct516(const struct mec_mr3_item *item,
+                            const struct mec_mr3_visitor *v, void *user) {
+  if (item->len != sizeof(struct buffer516))
+    return false;
+  if (!v->on_struct516)
+    return true;
+  struct mec_mr3_struct516 s;
+  s.zero = FIELD(item->data, struct buffer516, zero);
+  s.buf2 = FIELD(item->data, struct buffer516, buf2);
+  s.buf3 = FIELD(item->data, struct buffer516, buf3);
+  s.buf4 = FIELD(item->data, struct buffer516, buf4);
+  s.buf5 = FIELD(item->data, struct buffer516, buf5);
+  s.buf6 = FIELD(item->data, struct buffer516, buf6);
+  memcpy(s.bools,
+         (const char *)item->data + offsetof(struct buffer516, bools),
+         sizeof s.bools);
+  return v->on_struct516(item, &s, user);
+}
+
+static bool visit_struct325(const struct mec_mr3_item *item,
+                            const struct mec_mr3_visitor *v, void *user) {
+  if (item->len != sizeof(struct buffer325))
+    return false;
+  if (!v->on_struct325)
+    return true;
+  struct mec_mr3_struct325 s;
+  const str64 *array = (const str64 *)item->data;
+  int c;
+  for (c = 0; c < 5; ++c)
+    s.array[c] = field(array[c], sizeof array[c]);
+  return v->on_struct325(item, &s, user);
+}
+
+#undef FIELD
+
+static bool visit_string(const struct mec_mr3_item *item,
+                         const struct mec_mr3_visitor *v, void *user) {
+  const char *ptr = item->data;
+  size_t len = item->len;
+  if (item->type == ISO_8859_1_STRING && mec_mr3_is_iso(ptr, len)) {
+    ptr = mec_mr3_iso_string(item->data, item->len, &len);
+    if (!ptr)
+      return false;
+  }
+  if (!v->on_string)
+    return true;
+  const struct mec_mr3_str str = field(ptr, len);
+  return v->on_string(item, &str, user);
+}
+
+static bool visit_datetime(const struct mec_mr3_item *item,
+                           const struct mec_mr3_visitor *v, void *user) {
+  if (!mec_mr3_datetime_check(item->data, item->len, 0))
+    return false;
+  if (!v->on_datetime)
+    return true;
+  const struct mec_mr3_str str = field(item->data, item->len);
+  return v->on_datetime(item, &str, user);
+}
+
+// n float32 values, n being a multiple of vm
+static bool visit_float32(const struct mec_mr3_item *item, uint32_t vm,
+                          const struct mec_mr3_visitor *v, void *user) {
+  const size_t n = item->len / sizeof(float);
+  if (item->len % (vm * sizeof(float)) != 0)
+    return false;
+  return !v->on_float32_array ||
+         v->on_float32_array(item, item->data, n, user);
+}
+
+static bool visit_int32(const struct mec_mr3_item *item,
+                        const struct mec_mr3_visitor *v, void *user) {
+  const size_t n = item->len / sizeof(int32_t);
+  if (item->len % sizeof(int32_t) != 0)
+    return false;
+  return !v->on_int32_array || v->on_int32_array(item, item->data, n, user);
+}
+
+static bool visit_float64(const struct mec_mr3_item *item,
+                          const struct mec_mr3_visitor *v, void *user) {
+  double d;
+  if (item->len != sizeof d)
+    return false;
+  memcpy(&d, item->data, sizeof d);
+  return !v->on_float64 || v->on_float64(item, d, user);
+}
+
+static bool visit_bool(const struct mec_mr3_item *item,
+                       const struct mec_mr3_visitor *v, void *user) {
+  uint32_t u;
+  if (item->len != sizeof u)
+    return false;
+  memcpy(&u, item->data, sizeof u);
+  if (u != 0x0 && u != 0x1)
+    return false;
+  return !v->on_bool || v->on_bool(item, u != 0, user);
+}
+
+bool mec_mr3_visit_item(const struct mec_mr3_item *item,
+                        const struct mec_mr3_visitor *v, void *user) {
+  switch (item->type) {
+  case ISO_8859_1_STRING:
+  case SHIFT_JIS_STRING:
+    return visit_string(item, v, user);
+  case DATETIME:
+    return visit_datetime(item, v, user);
+  case FLOAT32_VM1:
+    return item->len == sizeof(float) && visit_float32(item, 1, v, user);
+  case FLOAT32_VM1N:
+    return visit_float32(item, 1, v, user);
+  case FLOAT32_VM2N:
+    return visit_float32(item, 2, v, user);
+  case FLOAT32_VM3N:
+    return visit_float32(item, 3, v, user);
+  case INT32_VM1N:
+    return visit_int32(item, v, user);
+  case FLOAT64_VM1:
+    return visit_float64(item, v, user);
+  case BOOL_04:
+  case BOOL_2A:
+    return visit_bool(item, v, user);
+  case STRUCT_136:
+    return visit_struct136(item, v, user);
+  case STRUCT_436:
+    return visit_struct436(item, v, user);
+  case STRUCT_516:
+    return visit_struct516(item, v, user);
+  case STRUCT_325:
+    return visit_struct325(item, v, user);
+  default:
+    return !v->on_other || v->on_other(item, user);
+  }
+}
+
+bool mec_mr3_visit(const void *input, size_t len,
+                   const struct mec_mr3_visitor *v, void *user) {
+  struct mec_mr3_walk w;
+  struct mec_mr3_item item;
+  int ret;
+  mec_mr3_walk_init(&w, input, len);
+  while ((ret = mec_mr3_walk_next(&w, &item)) == 1) {
+    if (!mec_mr3_visit_item(&item, v, user))
+      return false;
+  }
+  return ret == 0;
+}
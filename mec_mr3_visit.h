@@ -0,0 +1,108 @@
+#pragma once
+
+#include "mec_mr3_cursor.h"
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* string view into the blob, not nul terminated */
+struct mec_mr3_str {
+  const char *ptr;
+  size_t len;
+};
+
+/* string fields of the fixed size structs, each one cut at its first nul */
+struct mec_mr3_struct136 {
+  struct mec_mr3_str uid1;
+  struct mec_mr3_str uid2;
+};
+
+struct mec_mr3_struct436 {
+  struct mec_mr3_str iver;
+  struct mec_mr3_str buf3;
+  struct mec_mr3_str buf4;
+  struct mec_mr3_str buf5;
+  struct mec_mr3_str modality;
+  uint32_t val;
+};
+
+struct mec_mr3_struct516 {
+  struct mec_mr3_str zero;
+  struct mec_mr3_str buf2;
+  struct mec_mr3_str buf3;
+  struct mec_mr3_str buf4;
+  struct mec_mr3_str buf5;
+  struct mec_mr3_str buf6;
+  uint32_t bools[6];
+};
+
+struct mec_mr3_struct325 {
+  struct mec_mr3_str array[5];
+};
+
+/* typed callbacks, all of them optional. Pointers are into the input, valid
+ * as long as it is, values of the arrays are not aligned: read them with
+ * mec_mr3_float32_at() and mec_mr3_int32_at(). Returning false stops the
+ * visit. */
+struct mec_mr3_visitor {
+  // FLOAT32_VM1, FLOAT32_VM1N, FLOAT32_VM2N and FLOAT32_VM3N: n floats, n may
+  // be 0
+  bool (*on_float32_array)(const struct mec_mr3_item *item, const void *values,
+                           size_t n, void *user);
+  // INT32_VM1N: n signed integers
+  bool (*on_int32_array)(const struct mec_mr3_item *item, const void *values,
+                         size_t n, void *user);
+  bool (*on_float64)(const struct mec_mr3_item *item, double value,
+                     void *user);
+  bool (*on_bool)(const struct mec_mr3_item *item, bool value, void *user);
+  // SHIFT_JIS_STRING (shift-jis) and ISO_8859_1_STRING (latin-1, without the
+  // ISO8859-1 header when there is one), cut at the first nul
+  bool (*on_string)(const struct mec_mr3_item *item,
+                    const struct mec_mr3_str *str, void *user);
+  // DATETIME: 11/12/2002,11:27:32
+  bool (*on_datetime)(const struct mec_mr3_item *item,
+                      const struct mec_mr3_str *str, void *user);
+  bool (*on_struct136)(const struct mec_mr3_item *item,
+                       const struct mec_mr3_struct136 *s, void *user);
+  bool (*on_struct436)(const struct mec_mr3_item *item,
+                       const struct mec_mr3_struct436 *s, void *user);
+  bool (*on_struct516)(const struct mec_mr3_item *item,
+                       const struct mec_mr3_struct516 *s, void *user);
+  bool (*on_struct325)(const struct mec_mr3_item *item,
+                       const struct mec_mr3_struct325 *s, void *user);
+  // any other type, payload is item->data
+  bool (*on_other)(const struct mec_mr3_item *item, void *user);
+};
+
+/* call the callbacks of v on every item of input, in order. Payloads are
+ * checked whether or not there is a callback for them: array lengths, bool
+ * values, dates, struct sizes and ISO8859-1 headers. Return false on invalid
+ * input or when a callback returned false. */
+bool mec_mr3_visit(const void *input, size_t len,
+                   const struct mec_mr3_visitor *v, void *user);
+
+/* same as above for a single item, e.g. one found with mec_mr3_doc_get() */
+bool mec_mr3_visit_item(const struct mec_mr3_item *item,
+                        const struct mec_mr3_visitor *v, void *user);
+
+static inline float mec_mr3_float32_at(const void *values, size_t i) {
+  float f;
+  memcpy(&f, (const char *)values + i * sizeof f, sizeof f);
+  return f;
+}
+
+static inline int32_t mec_mr3_int32_at(const void *values, size_t i) {
+  int32_t v;
+  memcpy(&v, (const char *)values + i * sizeof v, sizeof v);
+  return v;
+}
+
+#ifdef __cplusplus
+} /* end extern "C" */
+#endif
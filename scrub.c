@@ -0,0 +1,189 @@
+#include "mec_mr3.h"
+#include "mec_mr3_file.h"
+#include "mec_mr3_hash.h"
+#include "mec_mr3_manifest.h"
+#include "mec_mr3_policy.h"
+#include "mec_mr3_uid.h"
+#include "mec_mr3_verify.h"
+
+#include <limits.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+static void usage(const char *name) {
+  fprintf(stderr,
+          "usage: %s [-p policy] [-k keyfile] [-d days] [-u uidmap] "
+          "[-m manifest] [--link] input output\n"
+          "       %s [-p policy] [-k keyfile] [-d days] [-u uidmap] "
+          "[-m manifest] --inplace file\n"
+          "       %s [-p policy] --verify file\n"
+          "       %s [-k keyfile] --apply manifest file\n",
+          name, name, name, name);
+}
+
+static bool write_file(const void *buf, size_t n, void *user) {
+  return fwrite(buf, 1, n, user) == n;
+}
+
+// read a whole file in memory, NULL on error
+static void *read_file(const char *filename, size_t *size) {
+  FILE *f = fopen(filename, "rb");
+  if (!f)
+    return NULL;
+  char *buf = NULL;
+  long fsize = -1;
+  if (fseek(f, 0, SEEK_END) == 0)
+    fsize = ftell(f);
+  if (fsize >= 0 && fseek(f, 0, SEEK_SET) == 0) {
+    buf = malloc((size_t)fsize + 1);
+    if (buf && fread(buf, 1, (size_t)fsize, f) != (size_t)fsize) {
+      free(buf);
+      buf = NULL;
+    }
+  }
+  fclose(f);
+  *size = (size_t)fsize;
+  return buf;
+}
+
+int main(int argc, char *argv[]) {
+  bool inplace = false;
+  bool hardlink = false; // output of a clean input links to it
+  bool verify = false;
+  const char *applyfilename = NULL;
+  const char *manifestfilename = NULL;
+  const char *policyfilename = NULL;
+  const char *keyfilename = NULL;
+  const char *shiftarg = NULL;
+  const char *uidmapfilename = NULL;
+  const char *files[2];
+  int nfiles = 0;
+  int i;
+  for (i = 1; i < argc; ++i) {
+    const char *arg = argv[i];
+    if (strcmp(arg, "--inplace") == 0) {
+      inplace = true;
+    } else if (strcmp(arg, "--link") == 0) {
+      hardlink = true;
+    } else if (strcmp(arg, "--verify") == 0) {
+      verify = true;
+    } else if (strcmp(arg, "--apply") == 0 && i + 1 < argc) {
+      applyfilename = argv[++i];
+    } else if (strcmp(arg, "-m") == 0 && i + 1 < argc) {
+      manifestfilename = argv[++i];
+    } else if (strcmp(arg, "-p") == 0 && i + 1 < argc) {
+      policyfilename = argv[++i];
+    } else if (strcmp(arg, "-k") == 0 && i + 1 < argc) {
+      keyfilename = argv[++i];
+    } else if (strcmp(arg, "-d") == 0 && i + 1 < argc) {
+      shiftarg = argv[++i];
+    } else if (strcmp(arg, "-u") == 0 && i + 1 < argc) {
+      uidmapfilename = argv[++i];
+    } else if (arg[0] != '-' && nfiles < 2) {
+      files[nfiles++] = arg;
+    } else {
+      usage(argv[0]);
+      return 1;
+    }
+  }
+  const int modes = inplace + verify + (applyfilename != NULL);
+  if (modes > 1 || (manifestfilename && (verify || applyfilename)) ||
+      (hardlink && modes != 0) || nfiles != (modes ? 1 : 2)) {
+    usage(argv[0]);
+    return 1;
+  }
+
+  struct mec_mr3_options options = {0};
+  if (shiftarg) {
+    char *end;
+    const long days = strtol(shiftarg, &end, 10);
+    if (*end != 0 || days < -INT_MAX || days > INT_MAX) {
+      fprintf(stderr, "invalid date shift %s\n", shiftarg);
+      return 1;
+    }
+    options.date_shift = (int)days;
+  }
+  unsigned char key[MEC_MR3_HASH_KEY_SIZE];
+  if (keyfilename) {
+    if (!mec_mr3_hash_key_load(keyfilename, key)) {
+      fprintf(stderr, "invalid key %s\n", keyfilename);
+      return 1;
+    }
+    options.hash_key = key;
+  }
+  struct mec_mr3_policy *policy = NULL;
+  if (policyfilename) {
+    policy = mec_mr3_policy_load(policyfilename);
+    if (!policy) {
+      fprintf(stderr, "invalid policy %s\n", policyfilename);
+      return 1;
+    }
+    options.policy = policy;
+  }
+  struct mec_mr3_uid_map *uid_map = NULL;
+  if (uidmapfilename) {
+    uid_map = mec_mr3_uid_map_open(uidmapfilename, 0);
+    if (!uid_map) {
+      fprintf(stderr, "invalid uid map %s\n", uidmapfilename);
+      mec_mr3_policy_free(policy);
+      return 1;
+    }
+    options.uid_map = uid_map;
+  }
+
+  FILE *manifest = NULL;
+  struct mec_mr3_sink sink;
+  if (manifestfilename) {
+    manifest = fopen(manifestfilename, "wb");
+    if (!manifest) {
+      fprintf(stderr, "can not create %s\n", manifestfilename);
+      mec_mr3_uid_map_close(uid_map);
+      mec_mr3_policy_free(policy);
+      return 1;
+    }
+    sink.write = write_file;
+    sink.user = manifest;
+    options.manifest = &sink;
+  }
+
+  bool good;
+  if (applyfilename) {
+    size_t size;
+    void *buf = read_file(applyfilename, &size);
+    good = buf &&
+           mec_mr3_manifest_apply_file(files[0], buf, size, options.hash_key);
+    free(buf);
+  } else if (verify) {
+    struct mec_mr3_verify_report report;
+    report.valid = false;
+    good = mec_mr3_verify_file(files[0], &options, &report);
+    if (!report.valid)
+      fprintf(stderr, "%s: invalid layout\n", files[0]);
+    else if (report.failures != 0)
+      fprintf(stderr,
+              "%s: %u of %u phi fields not scrubbed, first in group %u key "
+              "%04x at offset %zu\n",
+              files[0], report.failures, report.fields, report.group,
+              report.key, report.offset);
+    if (report.valid && report.unverifiable != 0)
+      fprintf(stderr,
+              "%s: %u phi fields hashed or shifted, can not be verified\n",
+              files[0], report.unverifiable);
+  } else if (inplace)
+    good = mec_mr3_scrub_file_inplace(files[0], &options);
+  else if (hardlink)
+    good = mec_mr3_scrub_file_link(files[0], files[1], &options);
+  else
+    good = mec_mr3_scrub_file(files[0], files[1], &options);
+  if (manifest) {
+    good = fclose(manifest) == 0 && good;
+    if (!good)
+      remove(manifestfilename);
+  }
+  mec_mr3_uid_map_close(uid_map);
+  mec_mr3_policy_free(policy);
+
+  return good ? 0 : 1;
+}
@@ -0,0 +1,527 @@
+#define _XOPEN_SOURCE 700 /* pread, pwrite */
+
+#include "mec_mr3.h"
+#include "mec_mr3_hash.h"
+#include "mec_mr3_leak.h"
+#include "mec_mr3_policy.h"
+#include "mec_mr3_uid.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+/* scrub the MEC_MR3 blob stored in (700d,1008) directly inside a DICOM file.
+ * Only the data elements up to (700d,1008) are visited, pixel data is never
+ * read, and only the byte ranges that changed are written back. The name and
+ * id of the patient are then searched for in the text fields of the blob, to
+ * report the ones typed in free text (and blank them with -b). With a uid map,
+ * the instance UIDs of the header, (0002,0003) of the file meta information
+ * included, are remapped in place through the same map as the UIDs of the
+ * blob. */
+
+enum {
+  TAG_MEC_MR3 = 0x700d1008,
+  TAG_MEDIA_SOP_INSTANCE_UID = 0x00020003,
+  TAG_TRANSFER_SYNTAX = 0x00020010,
+  TAG_PATIENT_NAME = 0x00100010,
+  TAG_PATIENT_ID = 0x00100020,
+  TAG_SOP_INSTANCE_UID = 0x00080018,
+  TAG_STUDY_INSTANCE_UID = 0x0020000d,
+  TAG_SERIES_INSTANCE_UID = 0x0020000e,
+  TAG_FRAME_OF_REFERENCE_UID = 0x00200052,
+  TAG_ITEM = 0xfffee000,
+  TAG_ITEM_DELIMITER = 0xfffee00d,
+  TAG_SEQUENCE_DELIMITER = 0xfffee0dd,
+  UNDEFINED_LENGTH = 0xffffffff,
+  MAX_DEPTH = 32, // nesting of sequences
+};
+
+/* pread based reader, with a small cache for the element headers */
+struct reader {
+  int fd;
+  off_t size;
+  off_t start; // file offset of buf
+  size_t len;  // valid bytes in buf
+  unsigned char buf[64 * 1024];
+};
+
+static bool pread_full(int fd, void *dst, size_t n, off_t pos) {
+  unsigned char *p = dst;
+  while (n != 0) {
+    const ssize_t r = pread(fd, p, n, pos);
+    if (r < 0 && errno == EINTR)
+      continue;
+    if (r <= 0)
+      return false;
+    p += r;
+    n -= (size_t)r;
+    pos += r;
+  }
+  return true;
+}
+
+static bool read_at(struct reader *r, off_t pos, void *dst, size_t n) {
+  if (pos < 0 || pos > r->size || (off_t)n > r->size - pos)
+    return false;
+  if (n > sizeof r->buf)
+    return pread_full(r->fd, dst, n, pos);
+  if (pos < r->start || pos + (off_t)n > r->start + (off_t)r->len) {
+    const off_t avail = r->size - pos;
+    r->len = avail < (off_t)sizeof r->buf ? (size_t)avail : sizeof r->buf;
+    r->start = pos;
+    if (!pread_full(r->fd, r->buf, r->len, pos)) {
+      r->len = 0;
+      return false;
+    }
+  }
+  memcpy(dst, r->buf + (pos - r->start), n);
+  return true;
+}
+
+struct element {
+  uint32_t tag; // group << 16 | element
+  char vr[2];   // zeros when implicit
+  uint32_t len;
+  off_t value; // file offset of the value
+};
+
+static inline uint16_t le16(const unsigned char *p) {
+  return (uint16_t)(p[0] | p[1] << 8);
+}
+
+static inline uint32_t le32(const unsigned char *p) {
+  return (uint32_t)p[0] | (uint32_t)p[1] << 8 | (uint32_t)p[2] << 16 |
+         (uint32_t)p[3] << 24;
+}
+
+// VRs with a 2 bytes reserved field and a 4 bytes length:
+static bool long_vr(const char vr[2]) {
+  static const char *const vrs[] = {"OB", "OD", "OF", "OL", "OV", "OW", "SQ",
+                                    "SV", "UC", "UN", "UR", "UT", "UV"};
+  size_t i;
+  for (i = 0; i < sizeof vrs / sizeof *vrs; ++i) {
+    if (vr[0] == vrs[i][0] && vr[1] == vrs[i][1])
+      return true;
+  }
+  return false;
+}
+
+static bool read_element(struct reader *r, off_t pos, bool explicit,
+                         struct element *e) {
+  unsigned char hdr[12];
+  if (!read_at(r, pos, hdr, 8))
+    return false;
+  e->tag = (uint32_t)le16(hdr) << 16 | le16(hdr + 2);
+  // items and delimiters never have a VR:
+  if (!explicit || (e->tag >> 16) == 0xfffe) {
+    e->vr[0] = e->vr[1] = 0;
+    e->len = le32(hdr + 4);
+    e->value = pos + 8;
+    return true;
+  }
+  e->vr[0] = (char)hdr[4];
+  e->vr[1] = (char)hdr[5];
+  if (!long_vr(e->vr)) {
+    e->len = le16(hdr + 6);
+    e->value = pos + 8;
+    return true;
+  }
+  if (!read_at(r, pos + 8, hdr + 8, 4))
+    return false;
+  e->len = le32(hdr + 8);
+  e->value = pos + 12;
+  return true;
+}
+
+static bool skip_element(struct reader *r, const struct element *e,
+                         bool explicit, int depth, off_t *next);
+
+// skip a dataset of undefined length, up to and including its delimiter
+static bool skip_dataset(struct reader *r, off_t pos, bool explicit, int depth,
+                         uint32_t delimiter, off_t *next) {
+  if (depth > MAX_DEPTH)
+    return false;
+  for (;;) {
+    struct element e;
+    if (!read_element(r, pos, explicit, &e))
+      return false;
+    if (e.tag == delimiter) {
+      *next = e.value;
+      return true;
+    }
+    if (!skip_element(r, &e, explicit, depth, &pos))
+      return false;
+  }
+}
+
+static bool skip_element(struct reader *r, const struct element *e,
+                         bool explicit, int depth, off_t *next) {
+  if (e->len != UNDEFINED_LENGTH) {
+    *next = e->value + e->len;
+    return *next <= r->size;
+  }
+  if (e->tag == TAG_ITEM)
+    return skip_dataset(r, e->value, explicit, depth + 1, TAG_ITEM_DELIMITER,
+                        next);
+  // sequence or encapsulated pixel data, a sequence of undefined length in a
+  // UN element is encoded as implicit VR:
+  const bool un = e->vr[0] == 'U' && e->vr[1] == 'N';
+  return skip_dataset(r, e->value, explicit && !un, depth + 1,
+                      TAG_SEQUENCE_DELIMITER, next);
+}
+
+/* instance uids of the file meta information and of the top level dataset.
+ * (0002,0003) has the value of (0008,0018), so both get the same replacement
+ * from the uid map */
+struct uids {
+  struct element elements[5];
+  char values[5][64 + 1];
+  char replacements[5][64 + 1];
+  size_t n;
+};
+
+static void add_uid(struct uids *uids, const struct element *e) {
+  if (uids->n < sizeof uids->elements / sizeof *uids->elements)
+    uids->elements[uids->n++] = *e;
+}
+
+static inline bool is_instance_uid(uint32_t tag) {
+  return tag == TAG_SOP_INSTANCE_UID || tag == TAG_STUDY_INSTANCE_UID ||
+         tag == TAG_SERIES_INSTANCE_UID || tag == TAG_FRAME_OF_REFERENCE_UID;
+}
+
+// check the preamble, read the file meta information and return the offset of
+// the dataset along with its encoding
+static bool read_meta(struct reader *r, off_t *pos, bool *explicit,
+                      struct uids *uids) {
+  char dicm[4];
+  if (!read_at(r, 128, dicm, sizeof dicm) || memcmp(dicm, "DICM", 4) != 0)
+    return false;
+  char ts[65] = {0};
+  off_t p = 132;
+  struct element e;
+  // file meta information is always explicit VR little endian:
+  while (read_element(r, p, true, &e) && (e.tag >> 16) == 0x0002) {
+    if (e.tag == TAG_TRANSFER_SYNTAX) {
+      if (e.len >= sizeof ts || !read_at(r, e.value, ts, e.len))
+        return false;
+      // value is padded with a nul byte or a space:
+      size_t n = e.len;
+      while (n > 0 && (ts[n - 1] == 0 || ts[n - 1] == ' '))
+        ts[--n] = 0;
+    }
+    if (e.tag == TAG_MEDIA_SOP_INSTANCE_UID)
+      add_uid(uids, &e);
+    if (!skip_element(r, &e, true, 0, &p))
+      return false;
+  }
+  *pos = p;
+  *explicit = strcmp(ts, "1.2.840.10008.1.2") != 0;
+  // big endian and deflated datasets can not be walked in place:
+  return ts[0] != 0 && strcmp(ts, "1.2.840.10008.1.2.2") != 0 &&
+         strcmp(ts, "1.2.840.10008.1.2.1.99") != 0;
+}
+
+/* identifiers of the patient, as found in the header */
+struct patient {
+  char name[5 * 64 + 1]; // up to 3 component groups
+  char id[64 + 1];
+  const char *needles[16];
+  size_t n;
+};
+
+enum { MIN_NEEDLE = 3 }; // shorter ones would mostly hit by chance
+
+static bool read_string(struct reader *r, const struct element *e, char *str,
+                        size_t size) {
+  if (e->len >= size)
+    return false;
+  if (!read_at(r, e->value, str, e->len))
+    return false;
+  str[e->len] = 0;
+  return true;
+}
+
+static void add_needle(struct patient *p, const char *needle) {
+  if (strlen(needle) >= MIN_NEEDLE &&
+      p->n < sizeof p->needles / sizeof *p->needles)
+    p->needles[p->n++] = needle;
+}
+
+// split the name on component and group separators, trim the id
+static void make_needles(struct patient *p) {
+  char *save = NULL;
+  char *token;
+  p->n = 0;
+  for (token = strtok_r(p->name, "^= ", &save); token;
+       token = strtok_r(NULL, "^= ", &save)) {
+    add_needle(p, token);
+  }
+  size_t n = strlen(p->id);
+  while (n > 0 && p->id[n - 1] == ' ')
+    p->id[--n] = 0;
+  add_needle(p, p->id);
+}
+
+// locate the value of (700d,1008) in the top level dataset, collecting the
+// identifiers of the patient and the instance uids on the way
+static bool find_mec_mr3(struct reader *r, struct element *found,
+                         struct patient *patient, struct uids *uids) {
+  off_t pos;
+  bool explicit;
+  if (!read_meta(r, &pos, &explicit, uids))
+    return false;
+  while (pos < r->size) {
+    struct element e;
+    if (!read_element(r, pos, explicit, &e) || e.tag > TAG_MEC_MR3)
+      return false; // tags are sorted, we are past it
+    if (e.tag == TAG_PATIENT_NAME &&
+        !read_string(r, &e, patient->name, sizeof patient->name))
+      return false;
+    if (e.tag == TAG_PATIENT_ID &&
+        !read_string(r, &e, patient->id, sizeof patient->id))
+      return false;
+    if (is_instance_uid(e.tag))
+      add_uid(uids, &e);
+    if (e.tag == TAG_MEC_MR3) {
+      *found = e;
+      return e.len != UNDEFINED_LENGTH && e.value + e.len <= r->size;
+    }
+    if (!skip_element(r, &e, explicit, 0, &pos))
+      return false;
+  }
+  return false;
+}
+
+struct stats {
+  size_t ranges;
+  size_t bytes;
+};
+
+/* write back the ranges where out differs from in. Ranges closer than a few
+ * bytes are merged, a single pwrite is cheaper than two. */
+static bool write_changes(int fd, off_t base, const unsigned char *in,
+                          const unsigned char *out, size_t len, bool dryrun,
+                          struct stats *stats) {
+  enum { GAP = 16 };
+  size_t i = 0;
+  while (i < len) {
+    if (in[i] == out[i]) {
+      ++i;
+      continue;
+    }
+    const size_t start = i;
+    size_t end = i + 1; // one past the last differing byte
+    for (i = end; i < len && i < end + GAP; ++i) {
+      if (in[i] != out[i])
+        end = i + 1;
+    }
+    i = end;
+    ++stats->ranges;
+    stats->bytes += end - start;
+    if (dryrun)
+      continue;
+    const unsigned char *p = out + start;
+    size_t n = end - start;
+    off_t pos = base + (off_t)start;
+    while (n != 0) {
+      const ssize_t w = pwrite(fd, p, n, pos);
+      if (w < 0 && errno == EINTR)
+        continue;
+      if (w <= 0)
+        return false;
+      p += w;
+      n -= (size_t)w;
+      pos += w;
+    }
+  }
+  return true;
+}
+
+// look up the replacements of the uids, they are padded to an even length
+static bool remap_uids(struct reader *r, struct uids *uids,
+                       struct mec_mr3_uid_map *map) {
+  size_t i;
+  for (i = 0; i < uids->n; ++i) {
+    const struct element *e = uids->elements + i;
+    char *in = uids->values[i];
+    char *out = uids->replacements[i];
+    if (e->len > sizeof uids->values[i] || !read_at(r, e->value, in, e->len))
+      return false;
+    size_t len = e->len;
+    while (len > 0 && (in[len - 1] == 0 || in[len - 1] == ' '))
+      --len;
+    memcpy(out, in, e->len);
+    if (len != 0 && !mec_mr3_uid_map_get(map, in, len, out))
+      return false;
+  }
+  return true;
+}
+
+// write the replacements of remap_uids in place
+static bool write_uids(int fd, const struct uids *uids, bool dryrun,
+                       struct stats *stats) {
+  size_t i;
+  for (i = 0; i < uids->n; ++i) {
+    const struct element *e = uids->elements + i;
+    if (!write_changes(fd, e->value, (const unsigned char *)uids->values[i],
+                       (const unsigned char *)uids->replacements[i], e->len,
+                       dryrun, stats))
+      return false;
+  }
+  return true;
+}
+
+static void report_leak(const struct mec_mr3_leak *leak, void *user) {
+  const char *filename = user;
+  fprintf(stderr, "%s: patient identifier in group %u key %04x at offset %zu\n",
+          filename, leak->group, leak->key, leak->offset);
+}
+
+// blank (or only report) the patient identifiers left in out
+static bool scan_leaks(const char *filename, struct patient *patient,
+                       unsigned char *out, size_t len, bool blank) {
+  make_needles(patient);
+  if (patient->n == 0)
+    return true;
+  struct mec_mr3_leak_scanner *scanner =
+      mec_mr3_leak_scanner_create(patient->needles, patient->n);
+  size_t hits;
+  const bool good =
+      scanner && mec_mr3_leak_scan(scanner, out, len, blank, report_leak,
+                                   (void *)filename, &hits);
+  mec_mr3_leak_scanner_free(scanner);
+  return good;
+}
+
+static bool scrub_dicom(const char *filename,
+                        const struct mec_mr3_options *options, bool dryrun,
+                        bool blank_leaks) {
+  struct reader *r = malloc(sizeof *r);
+  if (!r)
+    return false;
+  r->fd = open(filename, dryrun ? O_RDONLY : O_RDWR);
+  r->start = 0;
+  r->len = 0;
+  struct stat st;
+  bool good = r->fd >= 0 && fstat(r->fd, &st) == 0;
+  r->size = good ? st.st_size : 0;
+
+  struct element e;
+  struct patient patient;
+  patient.name[0] = patient.id[0] = 0;
+  struct uids uids;
+  uids.n = 0;
+  good = good && find_mec_mr3(r, &e, &patient, &uids);
+  if (!good)
+    fprintf(stderr, "%s: no 700d,1008 element\n", filename);
+  unsigned char *in = good ? malloc(e.len ? e.len : 1) : NULL;
+  unsigned char *out = good ? malloc(e.len ? e.len : 1) : NULL;
+  good = good && in && out && read_at(r, e.value, in, e.len);
+  if (good && !mec_mr3_scrub_ex(out, in, e.len, options)) {
+    fprintf(stderr, "%s: invalid MEC_MR3 blob\n", filename);
+    good = false;
+  }
+  good = good && scan_leaks(filename, &patient, out, e.len, blank_leaks);
+  // all the replacements are known before the first write:
+  if (good && options->uid_map && !remap_uids(r, &uids, options->uid_map)) {
+    fprintf(stderr, "%s: can not remap the uids\n", filename);
+    good = false;
+  }
+  struct stats stats = {0, 0};
+  good = good && write_changes(r->fd, e.value, in, out, e.len, dryrun, &stats);
+  if (options->uid_map)
+    good = good && write_uids(r->fd, &uids, dryrun, &stats);
+  if (good)
+    printf("%s: %zu bytes in %zu ranges%s\n", filename, stats.bytes,
+           stats.ranges, dryrun ? " (dry run)" : "");
+  free(in);
+  free(out);
+  if (r->fd >= 0)
+    good = close(r->fd) == 0 && good;
+  free(r);
+  return good;
+}
+
+static void usage(const char *name) {
+  fprintf(stderr,
+          "usage: %s [-p policy] [-k keyfile] [-d days] [-u uidmap] [-n] [-b] "
+          "file...\n",
+          name);
+}
+
+int main(int argc, char *argv[]) {
+  struct mec_mr3_options options = {0};
+  struct mec_mr3_policy *policy = NULL;
+  unsigned char key[MEC_MR3_HASH_KEY_SIZE];
+  bool dryrun = false;
+  bool blank_leaks = false; // -b: blank them, they are only reported
+  const char *uid_map = NULL;
+  int i;
+  for (i = 1; i < argc && argv[i][0] == '-'; ++i) {
+    const char *arg = argv[i];
+    if (strcmp(arg, "-n") == 0) {
+      dryrun = true;
+    } else if (strcmp(arg, "-b") == 0) {
+      blank_leaks = true;
+    } else if (strcmp(arg, "-p") == 0 && i + 1 < argc && !policy) {
+      policy = mec_mr3_policy_load(argv[++i]);
+      if (!policy) {
+        fprintf(stderr, "invalid policy %s\n", argv[i]);
+        return 1;
+      }
+      options.policy = policy;
+    } else if (strcmp(arg, "-k") == 0 && i + 1 < argc) {
+      if (!mec_mr3_hash_key_load(argv[++i], key)) {
+        fprintf(stderr, "invalid key %s\n", argv[i]);
+        mec_mr3_policy_free(policy);
+        return 1;
+      }
+      options.hash_key = key;
+    } else if (strcmp(arg, "-d") == 0 && i + 1 < argc) {
+      char *end;
+      const long days = strtol(argv[++i], &end, 10);
+      if (*end != 0 || days < -INT_MAX || days > INT_MAX) {
+        fprintf(stderr, "invalid date shift %s\n", argv[i]);
+        mec_mr3_policy_free(policy);
+        return 1;
+      }
+      options.date_shift = (int)days;
+    } else if (strcmp(arg, "-u") == 0 && i + 1 < argc && !uid_map) {
+      uid_map = argv[++i];
+    } else {
+      usage(argv[0]);
+      mec_mr3_policy_free(policy);
+      return 1;
+    }
+  }
+  if (i == argc) {
+    usage(argv[0]);
+    mec_mr3_policy_free(policy);
+    return 1;
+  }
+  if (uid_map) {
+    // a dry run leaves the map file as it is:
+    options.uid_map = dryrun ? mec_mr3_uid_map_open_private(uid_map)
+                             : mec_mr3_uid_map_open(uid_map, 0);
+    if (!options.uid_map) {
+      fprintf(stderr, "invalid uid map %s\n", uid_map);
+      mec_mr3_policy_free(policy);
+      return 1;
+    }
+  }
+  bool good = true;
+  for (; i < argc; ++i) {
+    good = scrub_dicom(argv[i], &options, dryrun, blank_leaks) && good;
+  }
+  mec_mr3_uid_map_close(options.uid_map);
+  mec_mr3_policy_free(policy);
+  return good ? 0 : 1;
+}
@@ -0,0 +1,328 @@
+#define _XOPEN_SOURCE 700 /* nftw */
+
+#include "mec_mr3.h"
+#include "mec_mr3_batch.h"
+#include "mec_mr3_file.h"
+#include "mec_mr3_hash.h"
+#include "mec_mr3_layout.h"
+#include "mec_mr3_policy.h"
+#include "mec_mr3_uid.h"
+
+#include <errno.h>
+#include <ftw.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+
+struct file {
+  char *path;    // input
+  size_t prefix; // of path left out of the output path
+  char *rel;     // output, relative to outdir. Set by check_outputs
+  size_t size;
+};
+
+struct files {
+  struct file *files;
+  size_t n;
+  size_t capacity;
+};
+
+// nftw does not pass any user data to its callback:
+static struct files list;
+static size_t root_len;
+
+// path with empty and "." components dropped, NULL when it has a ".."
+// component (the output would escape outdir) or nothing is left
+static char *normalize(const char *path) {
+  char *rel = malloc(strlen(path) + 1);
+  if (!rel)
+    return NULL;
+  size_t len = 0;
+  while (*path) {
+    const size_t n = strcspn(path, "/");
+    if (n == 2 && path[0] == '.' && path[1] == '.') {
+      free(rel);
+      return NULL;
+    }
+    if (n != 0 && !(n == 1 && path[0] == '.')) {
+      if (len != 0)
+        rel[len++] = '/';
+      memcpy(rel + len, path, n);
+      len += n;
+    }
+    path += n;
+    path += *path == '/';
+  }
+  rel[len] = 0;
+  if (len == 0) {
+    free(rel);
+    return NULL;
+  }
+  return rel;
+}
+
+static bool add_file(const char *path, size_t prefix, size_t size) {
+  if (list.n == list.capacity) {
+    const size_t capacity = list.capacity ? 2 * list.capacity : 1024;
+    struct file *files = realloc(list.files, capacity * sizeof *files);
+    if (!files)
+      return false;
+    list.files = files;
+    list.capacity = capacity;
+  }
+  struct file *f = list.files + list.n;
+  f->path = strdup(path);
+  if (!f->path)
+    return false;
+  f->prefix = prefix;
+  f->rel = NULL;
+  f->size = size;
+  ++list.n;
+  return true;
+}
+
+static int visit(const char *path, const struct stat *st, int flag,
+                 struct FTW *ftw) {
+  (void)ftw;
+  if (flag == FTW_F && S_ISREG(st->st_mode))
+    return add_file(path, root_len, (size_t)st->st_size) ? 0 : -1;
+  return 0;
+}
+
+// length of path up to its last component, trailing slashes and "." aside
+static size_t dirname_len(const char *path) {
+  size_t len = strlen(path);
+  for (; len > 0; --len) {
+    const bool dot =
+        path[len - 1] == '.' && (len == 1 || path[len - 2] == '/');
+    if (path[len - 1] != '/' && !dot)
+      break;
+  }
+  while (len > 0 && path[len - 1] != '/')
+    --len;
+  return len;
+}
+
+// files and directories from the command line are written to outdir under
+// their last component: the files of tree/a/ go to outdir/a/. Files from a
+// list keep their whole path below outdir
+static bool add_path(const char *path, bool flatten) {
+  struct stat st;
+  if (stat(path, &st) != 0) {
+    fprintf(stderr, "%s: %s\n", path, strerror(errno));
+    return false;
+  }
+  if (S_ISDIR(st.st_mode)) {
+    root_len = flatten ? dirname_len(path) : 0;
+    return nftw(path, visit, 64, FTW_PHYS) == 0;
+  }
+  return add_file(path, flatten ? dirname_len(path) : 0, (size_t)st.st_size);
+}
+
+static int compare_rel(const void *a, const void *b) {
+  return strcmp(((const struct file *)a)->rel, ((const struct file *)b)->rel);
+}
+
+/* the output of each file is outdir/normalize(path + prefix). Check they all
+ * stay below outdir and are distinct, two inputs writing the same output would
+ * clobber (or unlink) each other's */
+static bool check_outputs(void) {
+  size_t i;
+  for (i = 0; i < list.n; ++i) {
+    struct file *f = list.files + i;
+    f->rel = normalize(f->path + f->prefix);
+    if (!f->rel) {
+      fprintf(stderr, "%s: no output path below outdir\n", f->path);
+      return false;
+    }
+  }
+  qsort(list.files, list.n, sizeof *list.files, compare_rel);
+  bool good = true;
+  for (i = 1; i < list.n; ++i) {
+    if (strcmp(list.files[i - 1].rel, list.files[i].rel) == 0) {
+      fprintf(stderr, "%s and %s: same output %s\n", list.files[i - 1].path,
+              list.files[i].path, list.files[i].rel);
+      good = false;
+    }
+  }
+  return good;
+}
+
+static bool add_list(const char *listfilename) {
+  FILE *f = strcmp(listfilename, "-") == 0 ? stdin : fopen(listfilename, "r");
+  if (!f) {
+    fprintf(stderr, "%s: %s\n", listfilename, strerror(errno));
+    return false;
+  }
+  bool good = true;
+  char *line = NULL;
+  size_t cap = 0;
+  ssize_t len;
+  while (good && (len = getline(&line, &cap, f)) != -1) {
+    if (len > 0 && line[len - 1] == '\n')
+      line[--len] = 0;
+    if (len > 0)
+      good = add_path(line, false);
+  }
+  free(line);
+  if (f != stdin)
+    fclose(f);
+  return good;
+}
+
+// create all the parent directories of path
+static bool make_parents(char *path) {
+  char *p;
+  for (p = strchr(path + 1, '/'); p; p = strchr(p + 1, '/')) {
+    *p = 0;
+    const bool good = mkdir(path, 0777) == 0 || errno == EEXIST;
+    *p = '/';
+    if (!good)
+      return false;
+  }
+  return true;
+}
+
+struct job {
+  const char *outdir; // NULL to scrub in place
+  bool hardlink;      // outputs of clean inputs link to them
+  struct mec_mr3_options options;
+  atomic_size_t failures;
+  atomic_size_t bytes;
+};
+
+static void scrub_one(size_t i, void *user) {
+  struct job *job = user;
+  const struct file *f = list.files + i;
+  bool good;
+  if (!job->outdir) {
+    good = mec_mr3_scrub_file_inplace(f->path, &job->options);
+  } else {
+    const char *rel = f->rel;
+    const size_t len = strlen(job->outdir) + 1 + strlen(rel) + 1;
+    char *outpath = malloc(len);
+    good = outpath != NULL;
+    if (good) {
+      snprintf(outpath, len, "%s/%s", job->outdir, rel);
+      good = make_parents(outpath) &&
+             (job->hardlink
+                  ? mec_mr3_scrub_file_link(f->path, outpath, &job->options)
+                  : mec_mr3_scrub_file(f->path, outpath, &job->options));
+    }
+    free(outpath);
+  }
+  if (good) {
+    atomic_fetch_add_explicit(&job->bytes, f->size, memory_order_relaxed);
+  } else {
+    atomic_fetch_add_explicit(&job->failures, 1, memory_order_relaxed);
+    fprintf(stderr, "failed: %s\n", f->path);
+  }
+}
+
+static void usage(const char *name) {
+  fprintf(stderr,
+          "usage: %s [-j threads] [-p policy] [-k keyfile] [-u uidmap] "
+          "(-o outdir [--link] | --inplace) [-l list] [path...]\n",
+          name);
+}
+
+int main(int argc, char *argv[]) {
+  unsigned nthreads = 0;
+  bool inplace = false;
+  struct job job;
+  job.outdir = NULL;
+  job.hardlink = false;
+  job.options.policy = NULL;
+  job.options.hash_key = NULL;
+  job.options.manifest = NULL;
+  job.options.date_shift = 0;
+  job.options.uid_map = NULL;
+  // the files of a tree mostly come from a handful of scanners:
+  job.options.layouts = mec_mr3_layout_cache_create(64);
+  unsigned char key[MEC_MR3_HASH_KEY_SIZE];
+  struct mec_mr3_policy *policy = NULL;
+  atomic_init(&job.failures, 0);
+  atomic_init(&job.bytes, 0);
+
+  bool good = true;
+  int i;
+  for (i = 1; i < argc && good; ++i) {
+    const char *arg = argv[i];
+    if (strcmp(arg, "-j") == 0 && i + 1 < argc) {
+      nthreads = (unsigned)strtoul(argv[++i], NULL, 10);
+    } else if (strcmp(arg, "-o") == 0 && i + 1 < argc) {
+      job.outdir = argv[++i];
+    } else if (strcmp(arg, "-p") == 0 && i + 1 < argc && !policy) {
+      policy = mec_mr3_policy_load(argv[++i]);
+      if (!policy)
+        fprintf(stderr, "invalid policy %s\n", argv[i]);
+      good = policy != NULL;
+      job.options.policy = policy;
+    } else if (strcmp(arg, "-k") == 0 && i + 1 < argc &&
+               !job.options.hash_key) {
+      good = mec_mr3_hash_key_load(argv[++i], key);
+      if (!good)
+        fprintf(stderr, "invalid key %s\n", argv[i]);
+      else
+        job.options.hash_key = key;
+    } else if (strcmp(arg, "-u") == 0 && i + 1 < argc &&
+               !job.options.uid_map) {
+      // shared by all the threads:
+      job.options.uid_map = mec_mr3_uid_map_open(argv[++i], 0);
+      if (!job.options.uid_map)
+        fprintf(stderr, "invalid uid map %s\n", argv[i]);
+      good = job.options.uid_map != NULL;
+    } else if (strcmp(arg, "--link") == 0) {
+      job.hardlink = true;
+    } else if (strcmp(arg, "--inplace") == 0) {
+      inplace = true;
+    } else if (strcmp(arg, "-l") == 0 && i + 1 < argc) {
+      good = add_list(argv[++i]);
+    } else if (arg[0] == '-' && arg[1] != 0) {
+      usage(argv[0]);
+      return 1;
+    } else {
+      good = add_path(arg, true);
+    }
+  }
+  if (good && inplace == (job.outdir != NULL)) {
+    usage(argv[0]);
+    good = false;
+  }
+  good = good && (inplace || check_outputs());
+  if (!good) {
+    mec_mr3_uid_map_close(job.options.uid_map);
+    mec_mr3_layout_cache_free(job.options.layouts);
+    mec_mr3_policy_free(policy);
+    return 1;
+  }
+
+  struct timespec start, stop;
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  good = mec_mr3_parallel_for(list.n, nthreads, scrub_one, &job);
+  clock_gettime(CLOCK_MONOTONIC, &stop);
+  const double elapsed = (double)(stop.tv_sec - start.tv_sec) +
+                         (double)(stop.tv_nsec - start.tv_nsec) * 1e-9;
+
+  const size_t failures = atomic_load(&job.failures);
+  const double mb = (double)atomic_load(&job.bytes) / (1024 * 1024);
+  fprintf(stderr, "%zu files, %zu failures in %.3fs: %.1f files/s, %.1f MB/s\n",
+          list.n, failures, elapsed, elapsed > 0 ? list.n / elapsed : 0.,
+          elapsed > 0 ? mb / elapsed : 0.);
+
+  size_t f;
+  for (f = 0; f < list.n; ++f) {
+    free(list.files[f].path);
+    free(list.files[f].rel);
+  }
+  free(list.files);
+  mec_mr3_uid_map_close(job.options.uid_map);
+  mec_mr3_layout_cache_free(job.options.layouts);
+  mec_mr3_policy_free(policy);
+
+  return good && failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,82 @@
+#include "mec_mr3.h"
+#include "mec_mr3_batch.h"
+#include "test_util.h"
+
+#include <stdatomic.h>
+
+enum { N = 100000 };
+
+struct counts {
+  atomic_uint runs[N];
+  atomic_uint slow; // spins of the slow indices
+};
+
+// the first indices are much slower, so that their range gets stolen over
+// and over by the threads done with theirs
+static void count(size_t i, void *user) {
+  struct counts *c = user;
+  atomic_fetch_add_explicit(c->runs + i, 1, memory_order_relaxed);
+  if (i < N / 8) {
+    int k;
+    for (k = 0; k < 200; ++k)
+      atomic_fetch_add_explicit(&c->slow, 1, memory_order_relaxed);
+  }
+}
+
+static void test_parallel_for(void) {
+  static struct counts c;
+  static const unsigned threads[] = {1, 2, 3, 8, 16};
+  size_t t;
+  for (t = 0; t < sizeof threads / sizeof *threads; ++t) {
+    int round;
+    for (round = 0; round < 4; ++round) {
+      size_t i;
+      for (i = 0; i < N; ++i)
+        atomic_init(c.runs + i, 0);
+      CHECK(mec_mr3_parallel_for(N, threads[t], count, &c));
+      size_t bad = 0;
+      for (i = 0; i < N; ++i)
+        bad += atomic_load(c.runs + i) != 1;
+      CHECK(bad == 0);
+    }
+  }
+  // more threads than indices, and none:
+  atomic_init(c.runs, 0);
+  atomic_init(c.runs + 1, 0);
+  CHECK(mec_mr3_parallel_for(2, 8, count, &c));
+  CHECK(atomic_load(c.runs) == 1 && atomic_load(c.runs + 1) == 1);
+  CHECK(mec_mr3_parallel_for(0, 8, count, &c));
+}
+
+static void test_scrub_batch(void) {
+  enum { NJOBS = 64 };
+  static struct test_blob b;
+  b.len = 0;
+  test_blob_group(&b, 0, 1, 2);
+  test_blob_filler(&b, 0x13ec);
+  test_blob_item(&b, 0x55f2, 0x300, "TANAKA^TARO", 12);
+  static unsigned char out[NJOBS][sizeof b.data];
+  struct mec_mr3_job jobs[NJOBS];
+  bool status[NJOBS];
+  int j;
+  for (j = 0; j < NJOBS; ++j) {
+    jobs[j].dest = out[j];
+    jobs[j].src = b.data;
+    jobs[j].len = j % 16 == 5 ? b.len - 1 : b.len; // invalid layout
+    jobs[j].options = NULL;
+  }
+  CHECK(mec_mr3_scrub_batch(jobs, NJOBS, 4, status) == NJOBS / 16);
+  static unsigned char expected[sizeof b.data];
+  CHECK(mec_mr3_scrub_ex(expected, b.data, b.len, NULL));
+  for (j = 0; j < NJOBS; ++j) {
+    CHECK(status[j] == (j % 16 != 5));
+    CHECK(!status[j] || memcmp(out[j], expected, b.len) == 0);
+  }
+}
+
+int main(int argc, char *argv[]) {
+  (void)argc;
+  test_parallel_for();
+  test_scrub_batch();
+  return test_result(argv[0]);
+}
@@ -0,0 +1,72 @@
+#include "mec_mr3_private.h"
+#include "test_util.h"
+
+enum { MAX_LEN = 100, GUARD = 40, SIZE = MAX_LEN + 2 * GUARD };
+
+static const char *const kernels[] = {"scalar", "sse2", "avx2"};
+
+// a field of len bytes at offset in buf of SIZE bytes, no nul byte unless
+// nul < len
+static void make_field(unsigned char *buf, size_t offset, size_t len,
+                       size_t nul) {
+  size_t i;
+  for (i = 0; i < SIZE; ++i)
+    buf[i] = (unsigned char)(0x80 + i % 97); // guards, never nul
+  for (i = 0; i < len; ++i)
+    buf[offset + i] = (unsigned char)(1 + (i * 37) % 255);
+  if (nul < len)
+    buf[offset + nul] = 0;
+}
+
+// every kernel against the scalar one, guard bytes included
+static void test_kernels(void) {
+  unsigned tested[sizeof kernels / sizeof *kernels] = {0};
+  size_t len;
+  for (len = 0; len <= MAX_LEN; ++len) {
+    const size_t nuls[] = {len, 0, len / 2, len ? len - 1 : 0, 17, 33};
+    size_t offset;
+    for (offset = GUARD - 7; offset <= GUARD; ++offset) {
+      size_t k;
+      for (k = 0; k < sizeof nuls / sizeof *nuls; ++k) {
+        unsigned char expected[SIZE];
+        make_field(expected, offset, len, nuls[k]);
+        mec_mr3_blank_with(MEC_MR3_BLANK_SCALAR, (char *)expected + offset,
+                           len);
+        unsigned kernel;
+        for (kernel = MEC_MR3_BLANK_SSE2; kernel <= MEC_MR3_BLANK_AVX2;
+             ++kernel) {
+          unsigned char buf[SIZE];
+          make_field(buf, offset, len, nuls[k]);
+          if (!mec_mr3_blank_with(kernel, (char *)buf + offset, len))
+            continue;
+          ++tested[kernel];
+          if (memcmp(buf, expected, sizeof buf) != 0) {
+            fprintf(stderr, "%s: len %zu, offset %zu, nul at %zu\n",
+                    kernels[kernel], len, offset, nuls[k]);
+            CHECK(false);
+          }
+        }
+        // and the one picked for this cpu:
+        unsigned char buf[SIZE];
+        make_field(buf, offset, len, nuls[k]);
+        mec_mr3_blank((char *)buf + offset, len);
+        CHECK(memcmp(buf, expected, sizeof buf) == 0);
+      }
+    }
+  }
+  unsigned kernel;
+  for (kernel = MEC_MR3_BLANK_SSE2; kernel <= MEC_MR3_BLANK_AVX2; ++kernel) {
+    if (tested[kernel] == 0)
+      fprintf(stderr, "%s: not supported, skipped\n", kernels[kernel]);
+  }
+  // the scalar kernel itself:
+  char str[] = "TANAKA\0TARO";
+  mec_mr3_blank_with(MEC_MR3_BLANK_SCALAR, str, sizeof str);
+  CHECK(memcmp(str, "      \0TARO", sizeof str) == 0);
+}
+
+int main(int argc, char *argv[]) {
+  (void)argc;
+  test_kernels();
+  return test_result(argv[0]);
+}
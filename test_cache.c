@@ -0,0 +1,92 @@
+#include "mec_mr3.h"
+#include "mec_mr3_cache.h"
+#include "mec_mr3_hash.h"
+#include "mec_mr3_policy.h"
+#include "test_util.h"
+
+static const unsigned char key[MEC_MR3_HASH_KEY_SIZE] = {3};
+
+static void make_blob(struct test_blob *b, const char *name) {
+  b->len = 0;
+  test_blob_group(b, 0, 1, 3);
+  test_blob_filler(b, 0x13ec);
+  test_blob_item(b, 0x55f2, 0x300, name, (uint32_t)strlen(name) + 1);
+  test_blob_item(b, 0x55f5, 0x300, "YAMADA", 7);
+}
+
+// scrub b through the cache, and check the output against a fresh scrub
+static bool same_as_fresh(struct mec_mr3_cache *cache,
+                          const struct test_blob *b,
+                          const struct mec_mr3_options *options) {
+  static unsigned char cached[sizeof b->data], fresh[sizeof b->data];
+  memset(cached, 0xee, sizeof cached);
+  const bool good = mec_mr3_scrub_cached(cache, cached, b->data, b->len);
+  return good == mec_mr3_scrub_ex(fresh, b->data, b->len, options) &&
+         (!good || memcmp(cached, fresh, b->len) == 0);
+}
+
+static void test_hits(void) {
+  static const char text[] = "* 55f2 hash\n* 55f5 blank\n";
+  struct mec_mr3_policy *policy = mec_mr3_policy_parse(text, strlen(text));
+  CHECK(policy != NULL);
+  struct mec_mr3_options options = {0};
+  options.policy = policy;
+  options.hash_key = key;
+  struct mec_mr3_cache *cache = mec_mr3_cache_create(1 << 20, &options);
+  CHECK(cache != NULL);
+  if (!cache)
+    return;
+  static struct test_blob b, other;
+  make_blob(&b, "TANAKA^TARO");
+  make_blob(&other, "TANAKA^JIRO");
+  CHECK(same_as_fresh(cache, &b, &options));
+  CHECK(mec_mr3_cache_hits(cache) == 0);
+  CHECK(same_as_fresh(cache, &b, &options));
+  CHECK(mec_mr3_cache_hits(cache) == 1);
+  // same length, other content:
+  CHECK(same_as_fresh(cache, &other, &options));
+  CHECK(mec_mr3_cache_hits(cache) == 1);
+  CHECK(same_as_fresh(cache, &other, &options));
+  CHECK(mec_mr3_cache_hits(cache) == 2);
+
+  // in place, the hit gives the output of a fresh scrub:
+  static struct test_blob copy;
+  copy = b;
+  static unsigned char fresh[sizeof b.data];
+  CHECK(mec_mr3_scrub_ex(fresh, b.data, b.len, &options));
+  CHECK(mec_mr3_scrub_cached(cache, copy.data, copy.data, copy.len));
+  CHECK(mec_mr3_cache_hits(cache) == 3);
+  CHECK(memcmp(copy.data, fresh, b.len) == 0);
+  // an output is not taken for an input:
+  CHECK(same_as_fresh(cache, &copy, &options));
+  CHECK(mec_mr3_cache_hits(cache) == 3);
+
+  // failures are cached as well:
+  --b.len;
+  CHECK(same_as_fresh(cache, &b, &options));
+  CHECK(same_as_fresh(cache, &b, &options));
+  CHECK(mec_mr3_cache_hits(cache) == 4);
+  mec_mr3_cache_free(cache);
+  mec_mr3_policy_free(policy);
+}
+
+// blobs that do not fit are scrubbed every time
+static void test_small(void) {
+  struct mec_mr3_cache *cache = mec_mr3_cache_create(64, NULL);
+  CHECK(cache != NULL);
+  if (!cache)
+    return;
+  static struct test_blob b;
+  make_blob(&b, "TANAKA^TARO");
+  CHECK(same_as_fresh(cache, &b, NULL));
+  CHECK(same_as_fresh(cache, &b, NULL));
+  CHECK(mec_mr3_cache_hits(cache) == 0);
+  mec_mr3_cache_free(cache);
+}
+
+int main(int argc, char *argv[]) {
+  (void)argc;
+  test_hits();
+  test_small();
+  return test_result(argv[0]);
+}
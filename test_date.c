@@ -0,0 +1,78 @@
+#include "mec_mr3_private.h"
+#include "test_util.h"
+
+// whether shifting date (dd/mm/yyyy) by days gives expected, "" when the
+// shifted date must be refused
+static bool shifted(const char *date, int days, const char *expected) {
+  char str[32];
+  snprintf(str, sizeof str, "%s,11:27:32", date);
+  const size_t len = strlen(str) + 1; // nul terminated
+  if (!mec_mr3_datetime_check(str, len, days))
+    return *expected == '\0';
+  mec_mr3_datetime_shift(str, len, days);
+  char want[32];
+  snprintf(want, sizeof want, "%s,11:27:32", expected);
+  return *expected != '\0' && strcmp(str, want) == 0;
+}
+
+static void test_shift(void) {
+  CHECK(shifted("11/12/2002", 0, "11/12/2002"));
+  CHECK(shifted("11/12/2002", 5, "16/12/2002"));
+  // month and year rollover:
+  CHECK(shifted("28/01/2002", 4, "01/02/2002"));
+  CHECK(shifted("30/12/2002", 3, "02/01/2003"));
+  CHECK(shifted("11/12/2002", 365, "11/12/2003"));
+  // 29/02 on leap years only, including 2000 but not 1900:
+  CHECK(shifted("28/02/2004", 1, "29/02/2004"));
+  CHECK(shifted("28/02/2003", 1, "01/03/2003"));
+  CHECK(shifted("28/02/2000", 1, "29/02/2000"));
+  CHECK(shifted("28/02/1900", 1, "01/03/1900"));
+  CHECK(shifted("29/02/2004", 365, "28/02/2005"));
+  // negative shifts:
+  CHECK(shifted("01/03/2004", -1, "29/02/2004"));
+  CHECK(shifted("01/01/2003", -1, "31/12/2002"));
+  CHECK(shifted("16/12/2002", -5, "11/12/2002"));
+  CHECK(shifted("01/01/2003", -730, "01/01/2001"));
+}
+
+static void test_bounds(void) {
+  CHECK(shifted("01/01/0000", 0, "01/01/0000"));
+  CHECK(shifted("02/01/0000", -1, "01/01/0000"));
+  CHECK(shifted("01/01/0000", -1, ""));
+  CHECK(shifted("31/12/9999", 0, "31/12/9999"));
+  CHECK(shifted("30/12/9999", 1, "31/12/9999"));
+  CHECK(shifted("31/12/9999", 1, ""));
+}
+
+static bool valid(const char *str) {
+  return mec_mr3_datetime_check(str, strlen(str), 0);
+}
+
+static void test_invalid(void) {
+  CHECK(valid("30/04/2002,11:27:32"));
+  CHECK(!valid("31/04/2002,11:27:32"));
+  CHECK(!valid("00/00/0000,11:27:32"));
+  CHECK(!valid("00/01/2002,11:27:32"));
+  CHECK(!valid("01/13/2002,11:27:32"));
+  CHECK(!valid("29/02/2003,11:27:32"));
+  CHECK(valid("29/02/2004,11:27:32"));
+  // format:
+  CHECK(!valid("1/12/2002,11:27:32"));
+  CHECK(!valid("11-12-2002,11:27:32"));
+  CHECK(!valid("11/12/2002 11:27:32"));
+  CHECK(!valid("11/12/2002,11:27:3"));
+  CHECK(!valid("11/12/2002,11:27:32x"));
+  CHECK(!mec_mr3_datetime_check("11/12/2002,11:27:32", 18, 0));
+  // invalid dates are left alone by the shift:
+  char str[] = "31/04/2002,11:27:32";
+  mec_mr3_datetime_shift(str, sizeof str, 1);
+  CHECK(strcmp(str, "31/04/2002,11:27:32") == 0);
+}
+
+int main(int argc, char *argv[]) {
+  (void)argc;
+  test_shift();
+  test_bounds();
+  test_invalid();
+  return test_result(argv[0]);
+}
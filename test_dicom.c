@@ -0,0 +1,154 @@
+#define _XOPEN_SOURCE 700 /* mkdtemp */
+
+#include "test_util.h"
+
+#include <stdbool.h>
+#include <unistd.h>
+
+/* runs scrub_dicom on a small Part-10 file: explicit VR little endian, with
+ * the instance uids in the file meta information and in the dataset */
+
+static const char sop_uid[] = "1.2.392.200036.9116.2.6.1.48"; // even length
+static const char study_uid[] = "1.2.392.200036.9116.2.6.1.7";
+
+struct file {
+  unsigned char data[2048];
+  size_t len;
+  size_t media_uid; // offsets of the values
+  size_t sop_uid;
+  size_t study_uid;
+};
+
+static void put(struct file *f, const void *p, size_t n) {
+  memcpy(f->data + f->len, p, n);
+  f->len += n;
+}
+
+static void put16(struct file *f, uint32_t v) {
+  const unsigned char b[2] = {(unsigned char)v, (unsigned char)(v >> 8)};
+  put(f, b, sizeof b);
+}
+
+static void put32(struct file *f, uint32_t v) {
+  put16(f, v & 0xffff);
+  put16(f, v >> 16);
+}
+
+// value padded to an even length with pad, return its offset
+static size_t element(struct file *f, uint32_t tag, const char *vr,
+                      const void *value, size_t n, char pad) {
+  put16(f, tag >> 16);
+  put16(f, tag & 0xffff);
+  put(f, vr, 2);
+  const size_t len = n + (n & 1);
+  if (strcmp(vr, "OB") == 0) {
+    put16(f, 0);
+    put32(f, (uint32_t)len);
+  } else {
+    put16(f, (uint32_t)len);
+  }
+  const size_t offset = f->len;
+  put(f, value, n);
+  if (n & 1)
+    put(f, &pad, 1);
+  return offset;
+}
+
+static void make_file(struct file *f) {
+  static const char ts[] = "1.2.840.10008.1.2.1";
+  memset(f->data, 0, 128);
+  f->len = 128;
+  put(f, "DICM", 4);
+  const size_t group_len = element(f, 0x00020000, "UL", "\0\0\0\0", 4, 0);
+  const size_t meta = f->len;
+  f->media_uid =
+      element(f, 0x00020003, "UI", sop_uid, strlen(sop_uid), '\0');
+  element(f, 0x00020010, "UI", ts, strlen(ts), '\0');
+  const size_t n = f->len - meta;
+  int i;
+  for (i = 0; i < 4; ++i)
+    f->data[group_len + i] = (unsigned char)(n >> 8 * i);
+
+  f->sop_uid = element(f, 0x00080018, "UI", sop_uid, strlen(sop_uid), '\0');
+  element(f, 0x00100010, "PN", "TANAKA^TARO", 11, ' ');
+  element(f, 0x00100020, "LO", "12345", 5, ' ');
+  f->study_uid =
+      element(f, 0x0020000d, "UI", study_uid, strlen(study_uid), '\0');
+  static struct test_blob b;
+  b.len = 0;
+  test_blob_group(&b, 0, 1, 4);
+  test_blob_filler(&b, 0x13ec);
+  test_blob_filler(&b, 0x13ed);
+  test_blob_filler(&b, 0x13ee);
+  test_blob_filler(&b, 0x13ef);
+  element(f, 0x700d1008, "OB", b.data, b.len, 0);
+}
+
+static bool write_file(const char *filename, const struct file *f) {
+  FILE *out = fopen(filename, "wb");
+  if (!out)
+    return false;
+  const bool good = fwrite(f->data, 1, f->len, out) == f->len;
+  return fclose(out) == 0 && good;
+}
+
+static int run(const char *tool, const char *args, const char *filename) {
+  char command[4096];
+  snprintf(command, sizeof command, "'%s' %s '%s' > /dev/null", tool, args,
+           filename);
+  return system(command);
+}
+
+static void test_remap(const char *tool) {
+  char dir[] = "/tmp/test_dicom.XXXXXX";
+  CHECK(mkdtemp(dir) != NULL);
+  char filename[64], copy[64], map[64], args[128];
+  snprintf(filename, sizeof filename, "%s/a.dcm", dir);
+  snprintf(copy, sizeof copy, "%s/b.dcm", dir);
+  snprintf(map, sizeof map, "%s/uids", dir);
+  static struct file f;
+  make_file(&f);
+  CHECK(write_file(filename, &f));
+  CHECK(write_file(copy, &f));
+
+  // a dry run leaves the file and the map alone:
+  snprintf(args, sizeof args, "-n -u '%s'", map);
+  CHECK(run(tool, args, filename) == 0);
+  size_t len;
+  unsigned char *data = test_read_file(filename, &len);
+  CHECK(data && len == f.len && memcmp(data, f.data, len) == 0);
+  free(data);
+  CHECK(access(map, F_OK) != 0);
+
+  snprintf(args, sizeof args, "-u '%s'", map);
+  CHECK(run(tool, args, filename) == 0);
+  data = test_read_file(filename, &len);
+  CHECK(data && len == f.len);
+  if (data && len == f.len) {
+    const size_t n = strlen(sop_uid);
+    // (0002,0003) stays equal to (0008,0018):
+    CHECK(memcmp(data + f.sop_uid, sop_uid, n) != 0);
+    CHECK(memcmp(data + f.media_uid, data + f.sop_uid, n) == 0);
+    CHECK(memcmp(data + f.study_uid, study_uid, strlen(study_uid)) != 0);
+  }
+  // another file of the same instance gets the same uids:
+  CHECK(run(tool, args, copy) == 0);
+  unsigned char *again = test_read_file(copy, &len);
+  CHECK(data && again && len == f.len && memcmp(data, again, len) == 0);
+  free(data);
+  free(again);
+
+  unlink(filename);
+  unlink(copy);
+  unlink(map);
+  rmdir(dir);
+}
+
+int main(int argc, char *argv[]) {
+  if (argc != 2) {
+    fprintf(stderr, "usage: %s scrub_dicom\n", argv[0]);
+    return 1;
+  }
+  test_remap(argv[1]);
+  return test_result(argv[0]);
+}
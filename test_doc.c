@@ -0,0 +1,88 @@
+#include "mec_mr3_doc.h"
+#include "mec_mr3_payload.h"
+#include "test_util.h"
+
+static void make_blob(struct test_blob *b) {
+  b->len = 0;
+  test_blob_group(b, 0, 2, 5);
+  test_blob_item(b, 0x55f2, SHIFT_JIS_STRING, "FIRST", 6);
+  test_blob_filler(b, 0x13ec);
+  test_blob_item(b, 0x55f2, SHIFT_JIS_STRING, "SECOND", 7);
+  test_blob_filler(b, 0x13ee);
+  test_blob_item(b, 0x55f2, SHIFT_JIS_STRING, "THIRD", 6);
+  test_blob_group(b, 1, 2, 4);
+  test_blob_filler(b, 0x13ed);
+  test_blob_item(b, 0x55f2, SHIFT_JIS_STRING, "OTHER", 6);
+  test_blob_filler(b, 0x13ee);
+  test_blob_filler(b, 0x13ef);
+}
+
+static bool get_string(const struct mec_mr3_doc *doc, uint8_t group,
+                       uint32_t key, const char *expected) {
+  struct mec_mr3_item item;
+  if (!mec_mr3_doc_get(doc, group, key, &item))
+    return expected == NULL;
+  return expected && item.group == group && item.key == key &&
+         item.len == strlen(expected) + 1 &&
+         memcmp(item.data, expected, item.len) == 0;
+}
+
+static void test_get(void) {
+  static struct test_blob b;
+  make_blob(&b);
+  struct mec_mr3_doc *doc = mec_mr3_doc_parse(b.data, b.len);
+  CHECK(doc != NULL);
+  if (!doc)
+    return;
+  CHECK(doc->n == 9);
+  CHECK(doc->groups[0] == 1 && doc->groups[8] == 2);
+  // the first of the repeated keys, each group on its own:
+  CHECK(get_string(doc, 1, 0x55f2, "FIRST"));
+  CHECK(get_string(doc, 2, 0x55f2, "OTHER"));
+  CHECK(mec_mr3_doc_find(doc, 1, 0x55f2) == 0);
+  CHECK(mec_mr3_doc_find(doc, 2, 0x13ee) == 7);
+  // missing keys, groups past the last one and group 0:
+  CHECK(get_string(doc, 1, 0x13ed, NULL));
+  CHECK(get_string(doc, 3, 0x55f2, NULL));
+  CHECK(get_string(doc, 255, 0x55f2, NULL));
+  CHECK(get_string(doc, 0, 0x55f2, NULL));
+  CHECK(mec_mr3_doc_find(doc, 3, 0x13ee) == doc->n);
+  mec_mr3_doc_free(doc);
+
+  // invalid layout:
+  CHECK(mec_mr3_doc_parse(b.data, b.len - 1) == NULL);
+}
+
+// more items than the first allocation, every key is found
+static void test_large(void) {
+  enum { NITEMS = 1500 };
+  static struct test_blob b;
+  b.len = 0;
+  test_blob_group(&b, 0, 1, NITEMS);
+  uint32_t k;
+  for (k = 0; k < NITEMS; ++k)
+    test_blob_item(&b, 0x10000 + 7 * k, SHIFT_JIS_STRING, &k, sizeof k);
+  struct mec_mr3_doc *doc = mec_mr3_doc_parse(b.data, b.len);
+  CHECK(doc != NULL && doc->n == NITEMS);
+  if (!doc)
+    return;
+  size_t bad = 0;
+  for (k = 0; k < NITEMS; ++k) {
+    struct mec_mr3_item item;
+    uint32_t v = UINT32_MAX;
+    if (mec_mr3_doc_get(doc, 1, 0x10000 + 7 * k, &item) &&
+        item.len == sizeof v)
+      memcpy(&v, item.data, sizeof v);
+    bad += v != k;
+  }
+  CHECK(bad == 0);
+  CHECK(mec_mr3_doc_find(doc, 1, 0x10001) == doc->n);
+  mec_mr3_doc_free(doc);
+}
+
+int main(int argc, char *argv[]) {
+  (void)argc;
+  test_get();
+  test_large();
+  return test_result(argv[0]);
+}
@@ -0,0 +1,92 @@
+#include "mec_mr3.h"
+#include "mec_mr3_hash.h"
+#include "mec_mr3_policy.h"
+#include "test_util.h"
+
+static unsigned char key[MEC_MR3_HASH_KEY_SIZE];
+
+static void store64(unsigned char *p, uint64_t v) {
+  int b;
+  for (b = 0; b < 8; ++b)
+    p[b] = (unsigned char)(v >> 8 * b);
+}
+
+static void test_siphash(void) {
+  // reference vector of SipHash-2-4, 15 bytes 00..0e:
+  unsigned char msg[15];
+  size_t i;
+  for (i = 0; i < sizeof msg; ++i)
+    msg[i] = (unsigned char)i;
+  CHECK(mec_mr3_siphash(key, msg, sizeof msg) == 0xa129ca6149be45e5ULL);
+}
+
+static void test_counter(void) {
+  const uint64_t seed = 0x0123456789abcdefULL;
+  uint64_t out[30];
+  mec_mr3_siphash_counter(key, seed, 7, 30, out);
+  unsigned char block[16];
+  store64(block, seed);
+  size_t i;
+  for (i = 0; i < 30; ++i) {
+    store64(block + 8, 7 + i);
+    CHECK(out[i] == mec_mr3_siphash(key, block, sizeof block));
+  }
+}
+
+// the pseudonym of str: 5 bits per character out of the hashes of the blocks
+// (seed, counter), the seed being the hash of str
+static void pseudonym(const char *str, char *out) {
+  static const char alphabet[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZ234567";
+  const size_t len = strlen(str);
+  unsigned char block[16];
+  store64(block, mec_mr3_siphash(key, str, len));
+  size_t i;
+  for (i = 0; i < len; ++i) {
+    if (i % 12 == 0)
+      store64(block + 8, i / 12);
+    const uint64_t bits = mec_mr3_siphash(key, block, sizeof block);
+    out[i] = alphabet[(bits >> 5 * (i % 12)) & 31];
+  }
+  out[len] = '\0';
+}
+
+// hashed names keep their pseudonyms, also past the first 12 characters
+static void test_scrub(void) {
+  static const char *const names[] = {"TANAKA", "TANAKA^TARO^^^",
+                                      "YAMADA^HANAKO^MIDDLE^NAME^OF^SOME^SORT"};
+  static const char text[] = "* 55f2 hash\n";
+  struct mec_mr3_policy *policy = mec_mr3_policy_parse(text, strlen(text));
+  CHECK(policy != NULL);
+  struct mec_mr3_options options = {0};
+  options.policy = policy;
+  options.hash_key = key;
+  size_t n;
+  for (n = 0; n < sizeof names / sizeof *names; ++n) {
+    static struct test_blob b;
+    static unsigned char out[sizeof b.data];
+    b.len = 0;
+    test_blob_group(&b, 0, 1, 4);
+    test_blob_filler(&b, 0x13ec);
+    const size_t len = strlen(names[n]);
+    const size_t offset = b.len + 32; // after the item header
+    test_blob_item(&b, 0x55f2, 0x300, names[n], (uint32_t)len + 1);
+    test_blob_filler(&b, 0x13ee);
+    test_blob_filler(&b, 0x13ef);
+    CHECK(mec_mr3_scrub_ex(out, b.data, b.len, &options));
+    char expected[64];
+    pseudonym(names[n], expected);
+    CHECK(memcmp(out + offset, expected, len + 1) == 0);
+  }
+  mec_mr3_policy_free(policy);
+}
+
+int main(int argc, char *argv[]) {
+  (void)argc;
+  size_t i;
+  for (i = 0; i < sizeof key; ++i)
+    key[i] = (unsigned char)i;
+  test_siphash();
+  test_counter();
+  test_scrub();
+  return test_result(argv[0]);
+}
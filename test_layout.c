@@ -0,0 +1,107 @@
+#include "mec_mr3.h"
+#include "mec_mr3_layout.h"
+#include "mec_mr3_policy.h"
+#include "mec_mr3_private.h"
+#include "test_util.h"
+
+// groups of 3 fillers and a name, filler is the key of the last one. The
+// names are past the bytes the cache hashes to find the candidates
+static void make_blob(struct test_blob *b, const char *name, uint32_t filler) {
+  enum { NGROUPS = 3 };
+  b->len = 0;
+  int g;
+  for (g = 0; g < NGROUPS; ++g) {
+    test_blob_group(b, g, NGROUPS, 4);
+    test_blob_filler(b, 0x13ec);
+    test_blob_filler(b, 0x13ee);
+    test_blob_item(b, 0x55f2, 0x300, name, (uint32_t)strlen(name) + 1);
+    test_blob_filler(b, filler);
+  }
+}
+
+// scrub b through the cache, and check the output against a plain scrub
+static bool same_as_uncached(const struct test_blob *b,
+                             const struct mec_mr3_options *options) {
+  static unsigned char cached[sizeof b->data], plain[sizeof b->data];
+  struct mec_mr3_options uncached = *options;
+  uncached.layouts = NULL;
+  const bool good = mec_mr3_scrub_ex(cached, b->data, b->len, options);
+  return good == mec_mr3_scrub_ex(plain, b->data, b->len, &uncached) &&
+         (!good || memcmp(cached, plain, b->len) == 0);
+}
+
+static void test_hits(void) {
+  struct mec_mr3_layout_cache *cache = mec_mr3_layout_cache_create(16);
+  CHECK(cache != NULL);
+  if (!cache)
+    return;
+  struct mec_mr3_options options = {0};
+  options.layouts = cache;
+  static struct test_blob b;
+  make_blob(&b, "TANAKA^TARO", 0x13ef);
+  CHECK(same_as_uncached(&b, &options));
+  CHECK(mec_mr3_layout_hits(cache) == 0);
+  // same structure, other payloads:
+  make_blob(&b, "YAMADA^HANA", 0x13ef);
+  CHECK(same_as_uncached(&b, &options));
+  CHECK(mec_mr3_layout_hits(cache) == 1);
+  // same length and first bytes, another item header past them:
+  make_blob(&b, "YAMADA^HANA", 0x13ed);
+  CHECK(same_as_uncached(&b, &options));
+  CHECK(mec_mr3_layout_hits(cache) == 1);
+  CHECK(same_as_uncached(&b, &options));
+  CHECK(mec_mr3_layout_hits(cache) == 2);
+  // in place:
+  static struct test_blob copy;
+  copy = b;
+  static unsigned char plain[sizeof b.data];
+  CHECK(mec_mr3_scrub_ex(plain, b.data, b.len, NULL));
+  CHECK(mec_mr3_scrub_ex(copy.data, copy.data, copy.len, &options));
+  CHECK(mec_mr3_layout_hits(cache) == 3);
+  CHECK(memcmp(copy.data, plain, b.len) == 0);
+  // invalid layout:
+  --b.len;
+  CHECK(!mec_mr3_scrub_ex(plain, b.data, b.len, &options));
+  mec_mr3_layout_cache_free(cache);
+}
+
+static struct mec_mr3_policy *parse(const char *text) {
+  struct mec_mr3_policy *policy = mec_mr3_policy_parse(text, strlen(text));
+  CHECK(policy != NULL);
+  return policy;
+}
+
+// a policy allocated where a freed one was does not get its layouts. The
+// allocator seldom hands out the same address here, so swap the contents
+static void test_policies(void) {
+  struct mec_mr3_layout_cache *cache = mec_mr3_layout_cache_create(16);
+  CHECK(cache != NULL);
+  if (!cache)
+    return;
+  struct mec_mr3_options options = {0};
+  options.layouts = cache;
+  static struct test_blob b;
+  make_blob(&b, "TANAKA^TARO", 0x13ef);
+  struct mec_mr3_policy *keep = parse("* 55f2 keep\n");
+  struct mec_mr3_policy *blank = parse("* 55f2 blank\n");
+  options.policy = keep;
+  CHECK(same_as_uncached(&b, &options));
+  CHECK(same_as_uncached(&b, &options));
+  CHECK(mec_mr3_layout_hits(cache) == 1);
+  const struct mec_mr3_policy tmp = *keep;
+  *keep = *blank;
+  *blank = tmp;
+  CHECK(same_as_uncached(&b, &options));
+  CHECK(same_as_uncached(&b, &options));
+  CHECK(mec_mr3_layout_hits(cache) == 2);
+  mec_mr3_policy_free(keep);
+  mec_mr3_policy_free(blank);
+  mec_mr3_layout_cache_free(cache);
+}
+
+int main(int argc, char *argv[]) {
+  (void)argc;
+  test_hits();
+  test_policies();
+  return test_result(argv[0]);
+}
@@ -0,0 +1,82 @@
+#include "mec_mr3.h"
+#include "mec_mr3_lazy.h"
+#include "mec_mr3_payload.h"
+#include "test_util.h"
+
+#include <math.h>
+
+static void make_blob(struct test_blob *b) {
+  static const float floats[] = {1.5f, -2};
+  const float nan = NAN;
+  static const uint32_t two = 2;
+  b->len = 0;
+  test_blob_group(b, 0, 1, 6);
+  test_blob_item(b, 0x0001, FLOAT32_VM1N, floats, sizeof floats);
+  test_blob_item(b, 0x0002, SHIFT_JIS_STRING, "TANAKA\xb1", 8);
+  test_blob_item(b, 0x0003, FLOAT32_VM1, &nan, sizeof nan);
+  test_blob_item(b, 0x0004, BOOL_04, &two, sizeof two);
+  test_blob_item(b, 0x0005, DATETIME, "11/12/2002,11:27:32", 19);
+  test_blob_item(b, 0x0006, 0x1200, "xyz", 3);
+}
+
+static void test_values(void) {
+  static struct test_blob b;
+  make_blob(&b);
+  struct mec_mr3_lazy *lazy = mec_mr3_lazy_parse(b.data, b.len);
+  CHECK(lazy != NULL);
+  if (!lazy)
+    return;
+  CHECK(mec_mr3_lazy_doc(lazy)->n == 6);
+  const struct mec_mr3_value *v = mec_mr3_lazy_get(lazy, 1, 0x0001);
+  CHECK(v && v->kind == MEC_MR3_VALUE_FLOAT32 && v->n == 2);
+  CHECK(v && v->f32[0] == 1.5f && v->f32[1] == -2);
+  // a half-width katakana, 3 bytes of utf-8:
+  v = mec_mr3_lazy_get(lazy, 1, 0x0002);
+  CHECK(v && v->kind == MEC_MR3_VALUE_STRING && v->n == 9);
+  CHECK(v && strcmp(v->str, "TANAKA\xef\xbd\xb1") == 0);
+  v = mec_mr3_lazy_get(lazy, 1, 0x0005);
+  CHECK(v && v->kind == MEC_MR3_VALUE_DATETIME &&
+        strcmp(v->str, "11/12/2002,11:27:32") == 0);
+  v = mec_mr3_lazy_get(lazy, 1, 0x0006);
+  CHECK(v && v->kind == MEC_MR3_VALUE_OTHER && v->n == 3 &&
+        memcmp(v->data, "xyz", 3) == 0);
+
+  // invalid payloads: not finite, bool of 2:
+  CHECK(mec_mr3_lazy_get(lazy, 1, 0x0003) == NULL);
+  CHECK(mec_mr3_lazy_get(lazy, 1, 0x0004) == NULL);
+  // no such item:
+  CHECK(mec_mr3_lazy_get(lazy, 1, 0x0007) == NULL);
+  CHECK(mec_mr3_lazy_get(lazy, 2, 0x0001) == NULL);
+  CHECK(mec_mr3_lazy_at(lazy, 6) == NULL);
+  mec_mr3_lazy_free(lazy);
+}
+
+// each value is decoded once: the same pointer, no more allocations
+static void test_memoized(void) {
+  static struct test_blob b;
+  make_blob(&b);
+  struct mec_mr3_lazy *lazy = mec_mr3_lazy_parse(b.data, b.len);
+  CHECK(lazy != NULL);
+  if (!lazy)
+    return;
+  const struct mec_mr3_value *first[6];
+  size_t i;
+  for (i = 0; i < 6; ++i)
+    first[i] = mec_mr3_lazy_at(lazy, i);
+  const size_t allocations = mec_mr3_allocations();
+  int round;
+  for (round = 0; round < 3; ++round) {
+    for (i = 0; i < 6; ++i)
+      CHECK(mec_mr3_lazy_at(lazy, i) == first[i]);
+    CHECK(mec_mr3_lazy_get(lazy, 1, 0x0003) == NULL);
+  }
+  CHECK(mec_mr3_allocations() == allocations);
+  mec_mr3_lazy_free(lazy);
+}
+
+int main(int argc, char *argv[]) {
+  (void)argc;
+  test_values();
+  test_memoized();
+  return test_result(argv[0]);
+}
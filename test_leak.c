@@ -0,0 +1,118 @@
+#include "mec_mr3_leak.h"
+#include "mec_mr3_payload.h"
+#include "test_util.h"
+
+#include <strings.h>
+
+static const char *const needles[] = {"TANAKA", "TARO", "12345", "ANN"};
+enum { NNEEDLES = sizeof needles / sizeof *needles };
+
+static const char uid[] = "1.2.840.113745.12345.6";
+
+struct hits {
+  const unsigned char *blob;
+  size_t n;
+  bool good; // each offset points at its needle
+};
+
+static void report(const struct mec_mr3_leak *leak, void *user) {
+  struct hits *hits = user;
+  ++hits->n;
+  if (leak->len != strlen(needles[leak->needle]) ||
+      strncasecmp((const char *)hits->blob + leak->offset,
+                  needles[leak->needle], leak->len) != 0)
+    hits->good = false;
+}
+
+// an ISO_8859_1_STRING payload with its header
+static size_t make_iso(unsigned char *payload, const char *str) {
+  const size_t len = strlen(str);
+  struct buffer19 b19 = {{(char)0xdf, (char)0xff, 0x79}, 0, 1, 9, 0, {0},
+                         2, 0, 0};
+  memcpy(b19.iso, "ISO8859-1", 9);
+  b19.len2 = (unsigned char)(sizeof b19 + len - 4);
+  b19.len4 = (unsigned char)len;
+  memcpy(payload, &b19, sizeof b19);
+  memcpy(payload + sizeof b19, str, len);
+  return sizeof b19 + len;
+}
+
+static void make_blob(struct test_blob *b) {
+  b->len = 0;
+  test_blob_group(b, 0, 1, 6);
+  struct buffer136 b136;
+  memset(&b136, 0, sizeof b136);
+  strcpy(b136.uid2, uid);
+  test_blob_item(b, 0x0001, STRUCT_136, &b136, sizeof b136);
+  static const char free_text[] = "ID 12345 TANAKA";
+  test_blob_item(b, 0x0002, ISO_8859_1_STRING, free_text,
+                 sizeof free_text - 1);
+  // not whole numbers:
+  static const char numbers[] = "X 123456 1.2.12345 A12345";
+  test_blob_item(b, 0x0003, SHIFT_JIS_STRING, numbers, sizeof numbers - 1);
+  struct buffer516 b516;
+  memset(&b516, 0, sizeof b516);
+  strcpy(b516.buf3, "tanaka taro");
+  strcpy(b516.buf5, "1.2.12345");
+  test_blob_item(b, 0x0004, STRUCT_516, &b516, sizeof b516);
+  unsigned char iso[64];
+  test_blob_item(b, 0x0005, ISO_8859_1_STRING, iso, make_iso(iso, "TARO"));
+  // not a whole word, then a whole one:
+  static const char words[] = "SCANNER ANN";
+  test_blob_item(b, 0x0006, SHIFT_JIS_STRING, words, sizeof words - 1);
+}
+
+static bool contains(const void *buf, size_t len, const char *str) {
+  const size_t n = strlen(str);
+  size_t i;
+  for (i = 0; i + n <= len; ++i) {
+    if (memcmp((const char *)buf + i, str, n) == 0)
+      return true;
+  }
+  return false;
+}
+
+static void test_scan(void) {
+  struct mec_mr3_leak_scanner *scanner =
+      mec_mr3_leak_scanner_create(needles, NNEEDLES);
+  CHECK(scanner != NULL);
+  if (!scanner)
+    return;
+  static struct test_blob b, copy;
+  make_blob(&b);
+  copy = b;
+
+  // report only, the blob is left alone:
+  struct hits hits = {b.data, 0, true};
+  size_t nhits;
+  CHECK(mec_mr3_leak_scan(scanner, b.data, b.len, false, report, &hits,
+                          &nhits));
+  CHECK(nhits == 6 && hits.n == 6 && hits.good);
+  CHECK(memcmp(b.data, copy.data, b.len) == 0);
+
+  CHECK(mec_mr3_leak_scan(scanner, b.data, b.len, true, NULL, NULL, &nhits));
+  CHECK(nhits == 6);
+  CHECK(contains(b.data, b.len, "ID             "));
+  CHECK(!contains(b.data, b.len, "TARO"));
+  CHECK(!contains(b.data, b.len, "tanaka taro"));
+  // the uids and the numbers that only contain the id are left alone:
+  CHECK(contains(b.data, b.len, uid));
+  CHECK(contains(b.data, b.len, "1.2.12345"));
+  CHECK(contains(b.data, b.len, "X 123456 1.2.12345 A12345"));
+  CHECK(contains(b.data, b.len, "SCANNER    "));
+  CHECK(mec_mr3_leak_scan(scanner, b.data, b.len, false, NULL, NULL, &nhits));
+  CHECK(nhits == 0);
+
+  // invalid layout, nothing written:
+  copy = b;
+  CHECK(!mec_mr3_leak_scan(scanner, b.data, b.len - 1, true, NULL, NULL,
+                           &nhits));
+  CHECK(memcmp(b.data, copy.data, b.len) == 0);
+  mec_mr3_leak_scanner_free(scanner);
+}
+
+int main(int argc, char *argv[]) {
+  (void)argc;
+  test_scan();
+  return test_result(argv[0]);
+}
@@ -0,0 +1,98 @@
+#include "mec_mr3.h"
+#include "mec_mr3_hash.h"
+#include "mec_mr3_manifest.h"
+#include "mec_mr3_policy.h"
+#include "test_util.h"
+
+static unsigned char key[MEC_MR3_HASH_KEY_SIZE] = {7};
+
+struct buffer {
+  unsigned char data[4096];
+  size_t len;
+};
+
+static bool append(const void *buf, size_t n, void *user) {
+  struct buffer *b = user;
+  if (n > sizeof b->data - b->len)
+    return false;
+  memcpy(b->data + b->len, buf, n);
+  b->len += n;
+  return true;
+}
+
+static uint32_t le32(const unsigned char *p) {
+  return (uint32_t)p[0] | (uint32_t)p[1] << 8 | (uint32_t)p[2] << 16 |
+         (uint32_t)p[3] << 24;
+}
+
+static uint64_t le64(const unsigned char *p) {
+  return (uint64_t)le32(p) | (uint64_t)le32(p + 4) << 32;
+}
+
+static void make_blob(struct test_blob *b, size_t *offsets) {
+  b->len = 0;
+  test_blob_group(b, 0, 1, 4);
+  test_blob_filler(b, 0x13ec);
+  offsets[0] = b->len + 32;
+  test_blob_item(b, 0x55f2, 0x300, "TANAKA^TARO", 12);
+  test_blob_filler(b, 0x13ee);
+  offsets[1] = b->len + 32;
+  test_blob_item(b, 0x55f5, 0x300, "YAMADA", 7);
+}
+
+// the records are little endian on any host, and replay the scrub
+static void test_round_trip(void) {
+  static const char text[] = "* 55f2 hash\n* 55f5 blank\n";
+  struct mec_mr3_policy *policy = mec_mr3_policy_parse(text, strlen(text));
+  CHECK(policy != NULL);
+  static struct buffer manifest;
+  struct mec_mr3_sink sink = {append, &manifest};
+  struct mec_mr3_options options = {0};
+  options.policy = policy;
+  options.hash_key = key;
+  options.manifest = &sink;
+  static struct test_blob b;
+  static unsigned char out[sizeof b.data], copy[sizeof b.data];
+  size_t offsets[2];
+  make_blob(&b, offsets);
+  CHECK(mec_mr3_scrub_ex(out, b.data, b.len, &options));
+  mec_mr3_policy_free(policy);
+
+  // header, then one record per field:
+  static const unsigned char magic[] = {'M', 'R', '3', 'M', 1, 0, 0, 0};
+  CHECK(manifest.len == sizeof magic + 2 * 32 + 11 + 6);
+  CHECK(memcmp(manifest.data, magic, sizeof magic) == 0);
+  const unsigned char *r = manifest.data + sizeof magic;
+  CHECK(r[0] == 1 && r[1] == MEC_MR3_HASH && r[2] == MEC_MR3_MANIFEST_DIGEST);
+  CHECK(le32(r + 4) == 0x55f2 && le32(r + 8) == 0x300 && le32(r + 12) == 11);
+  CHECK(le64(r + 16) == offsets[0]);
+  CHECK(le64(r + 24) == mec_mr3_siphash(key, "TANAKA^TARO", 11));
+  CHECK(memcmp(r + 32, out + offsets[0], 11) == 0);
+  r += 32 + 11;
+  CHECK(r[0] == 1 && r[1] == MEC_MR3_BLANK);
+  CHECK(le32(r + 4) == 0x55f5 && le32(r + 12) == 6);
+  CHECK(le64(r + 16) == offsets[1]);
+  CHECK(memcmp(r + 32, "      ", 6) == 0);
+
+  memcpy(copy, b.data, b.len);
+  CHECK(mec_mr3_manifest_apply(copy, b.len, manifest.data, manifest.len, key));
+  CHECK(memcmp(copy, out, b.len) == 0);
+
+  // digests are checked before the first write:
+  memcpy(copy, b.data, b.len);
+  copy[offsets[0]] = 'X';
+  CHECK(!mec_mr3_manifest_apply(copy, b.len, manifest.data, manifest.len,
+                                key));
+  CHECK(memcmp(copy + offsets[1], "YAMADA", 6) == 0);
+  // truncated:
+  memcpy(copy, b.data, b.len);
+  CHECK(!mec_mr3_manifest_apply(copy, b.len, manifest.data, manifest.len - 1,
+                                key));
+  CHECK(memcmp(copy, b.data, b.len) == 0);
+}
+
+int main(int argc, char *argv[]) {
+  (void)argc;
+  test_round_trip();
+  return test_result(argv[0]);
+}
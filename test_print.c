@@ -0,0 +1,159 @@
+#include "mec_mr3.h"
+#include "mec_mr3_io.h"
+#include "mec_mr3_payload.h"
+#include "mec_mr3_sink.h"
+#include "test_util.h"
+
+#define BOOL_ITEM                                                              \
+  "{\"group\":1,\"key\":\"055f7\",\"type\":\"ff000400\",\"name\":\"\","        \
+  "\"len\":4,\"value\":true}"
+#define SIZE_ITEM                                                              \
+  "{\"group\":1,\"key\":\"055f8\",\"type\":\"ff000800\","                      \
+  "\"name\":\"Patient Size (cm)\",\"len\":4,\"value\":[1.5]}"
+
+static bool ends_with(const char *str, const char *end) {
+  const size_t n = strlen(str), m = strlen(end);
+  return n >= m && strcmp(str + n - m, end) == 0;
+}
+
+// the output of mode, as a string
+static bool print(const struct test_blob *b, enum mec_mr3_print_mode mode,
+                  char *out, size_t size) {
+  struct mec_mr3_membuf buf = {0};
+  struct mec_mr3_sink sink;
+  mec_mr3_sink_memory(&sink, &buf);
+  const bool good = mec_mr3_print_as(b->data, b->len, &sink, mode);
+  CHECK(buf.len < size);
+  const size_t n = buf.len < size ? buf.len : size - 1;
+  if (n)
+    memcpy(out, buf.data, n);
+  out[n] = '\0';
+  free(buf.data);
+  return good;
+}
+
+// the keys are checked against the dictionary. Patient Weight of 3 bytes can
+// not be printed as json
+static void make_blob(struct test_blob *b, bool bad) {
+  static const uint32_t yes = 1;
+  static const float weight = 1.5f;
+  b->len = 0;
+  test_blob_group(b, 0, 1, 4);
+  test_blob_item(b, 0x55f7, BOOL_04, &yes, sizeof yes);
+  test_blob_item(b, 0x55f8, FLOAT32_VM1, &weight, sizeof weight);
+  test_blob_item(b, 0x55f9, FLOAT32_VM1, &weight, bad ? 3 : sizeof weight);
+  test_blob_item(b, 0x55fa, ISO_8859_1_STRING, "AB", 3);
+}
+
+static void test_json(void) {
+  static struct test_blob b;
+  static char out[4096];
+  make_blob(&b, false);
+  CHECK(print(&b, MEC_MR3_PRINT_NDJSON_BLOB, out, sizeof out));
+  CHECK(strncmp(out, "{\"items\":[{", 11) == 0);
+  CHECK(ends_with(out, ":\"AB\"}]}\n"));
+
+  // only the items before the failure, and no closing brackets:
+  make_blob(&b, true);
+  CHECK(!print(&b, MEC_MR3_PRINT_NDJSON_BLOB, out, sizeof out));
+  CHECK(strcmp(out, "{\"items\":[" BOOL_ITEM "," SIZE_ITEM) == 0);
+  CHECK(!print(&b, MEC_MR3_PRINT_NDJSON, out, sizeof out));
+  CHECK(strcmp(out, BOOL_ITEM "\n" SIZE_ITEM "\n") == 0);
+
+  // invalid layout:
+  make_blob(&b, false);
+  --b.len;
+  CHECK(!print(&b, MEC_MR3_PRINT_NDJSON_BLOB, out, sizeof out));
+  CHECK(ends_with(out, "[1.5]}"));
+}
+
+static bool contains(const char *str, const char *part) {
+  return strstr(str, part) != NULL;
+}
+
+static void test_struct(void) {
+  static const uint32_t yes = 1;
+  static const float weight = 1.5f;
+  static struct test_blob b;
+  static char out[4096];
+  struct buffer516 b516;
+  memset(&b516, 0, sizeof b516);
+  strcpy(b516.buf5, "1.2.3");
+  b516.bools[0] = b516.bools[2] = b516.bools[5] = 1;
+  b.len = 0;
+  test_blob_group(&b, 0, 1, 4);
+  test_blob_item(&b, 0x55f7, BOOL_04, &yes, sizeof yes);
+  test_blob_item(&b, 0x55f8, FLOAT32_VM1, &weight, sizeof weight);
+  test_blob_item(&b, 0x55f9, FLOAT32_VM1, &weight, sizeof weight);
+  test_blob_item(&b, 0x6d80, STRUCT_516, &b516, sizeof b516);
+  CHECK(print(&b, MEC_MR3_PRINT_NDJSON, out, sizeof out));
+  CHECK(contains(out, "\"buf6\":\"\",\"bools\":[1,0,1,0,0,1]}"));
+}
+
+// one item of each numeric type, the one of key has len bytes and the others
+// valid lengths
+static bool print_numbers(uint32_t key, uint32_t len, char *out,
+                          size_t size) {
+  static const float values[] = {1, 2, 3, 4, 5, 6};
+  static const struct {
+    uint32_t key;
+    uint32_t type;
+    uint32_t len;
+  } items[] = {
+      {0x55f8, FLOAT32_VM1, 4}, {0x1004, INT32_VM1N, 8},
+      {0x13ec, FLOAT64_VM1, 8}, {0x55f9, FLOAT32_VM1, 4},
+      {0x1006, FLOAT32_VM1N, 12}, {0xa806, FLOAT32_VM2N, 8},
+      {0xa8fd, FLOAT32_VM3N, 12}, {0x1007, FLOAT32_VM1N, 4},
+  };
+  static struct test_blob b;
+  b.len = 0;
+  int i;
+  for (i = 0; i < 8; ++i) {
+    if (i % 4 == 0)
+      test_blob_group(&b, i / 4, 2, 4);
+    test_blob_item(&b, items[i].key, items[i].type, values,
+                   items[i].key == key ? len : items[i].len);
+  }
+  return print(&b, MEC_MR3_PRINT_NDJSON, out, size);
+}
+
+// whether the value printed for key starts with value
+static bool printed(const char *out, const char *key, const char *value) {
+  char part[32];
+  snprintf(part, sizeof part, "\"key\":\"%s\"", key);
+  const char *p = strstr(out, part);
+  p = p ? strstr(p, "\"value\":") : NULL;
+  return p && strncmp(p + 8, value, strlen(value)) == 0;
+}
+
+// same lengths as mec_mr3_visit_item
+static void test_numbers(void) {
+  static char out[4096];
+  CHECK(print_numbers(0, 0, out, sizeof out));
+  CHECK(printed(out, "055f8", "[1]}"));
+  CHECK(printed(out, "01004", "[1065353216,1073741824]}"));
+  CHECK(printed(out, "01006", "[1,2,3]}"));
+  CHECK(printed(out, "0a806", "[1,2]}"));
+  CHECK(printed(out, "0a8fd", "[1,2,3]}"));
+  CHECK(!print_numbers(0x55f8, 8, out, sizeof out));
+  CHECK(!print_numbers(0x55f8, 0, out, sizeof out));
+  CHECK(!print_numbers(0x1004, 6, out, sizeof out));
+  CHECK(!print_numbers(0x13ec, 16, out, sizeof out));
+  CHECK(!print_numbers(0x1006, 6, out, sizeof out));
+  CHECK(print_numbers(0xa806, 16, out, sizeof out));
+  CHECK(printed(out, "0a806", "[1,2,3,4]}"));
+  CHECK(!print_numbers(0xa806, 12, out, sizeof out));
+  CHECK(print_numbers(0xa8fd, 24, out, sizeof out));
+  CHECK(printed(out, "0a8fd", "[1,2,3,4,5,6]}"));
+  CHECK(!print_numbers(0xa8fd, 16, out, sizeof out));
+  CHECK(print_numbers(0xa8fd, 0, out, sizeof out));
+  CHECK(printed(out, "0a8fd", "[]}"));
+}
+
+int main(int argc, char *argv[]) {
+  (void)argc;
+  test_json();
+  test_struct();
+  test_numbers();
+  return test_result(argv[0]);
+}
@@ -0,0 +1,217 @@
+#include "mec_mr3.h"
+#include "mec_mr3_policy.h"
+#include "mec_mr3_sink.h"
+#include "mec_mr3_stream.h"
+#include "mec_mr3_uid.h"
+#include "test_util.h"
+
+// fnv-1a of sample.raw scrubbed by the baseline mec_mr3_memcpy
+static const uint64_t sample_scrubbed = UINT64_C(0xaf4f4ba8a2326531);
+
+static const char name[] = "TANAKA^TARO";
+
+static bool contains(const void *buf, size_t len, const char *str) {
+  const size_t n = strlen(str);
+  size_t i;
+  for (i = 0; i + n <= len; ++i) {
+    if (memcmp((const char *)buf + i, str, n) == 0)
+      return true;
+  }
+  return false;
+}
+
+// scrub through the streaming api, in chunks of step bytes
+static bool stream(const void *input, size_t len, size_t step,
+                   const struct mec_mr3_options *options,
+                   struct mec_mr3_membuf *out) {
+  static struct mec_mr3_scrub_ctx ctx;
+  struct mec_mr3_sink sink;
+  mec_mr3_sink_memory(&sink, out);
+  mec_mr3_scrub_init(&ctx, options);
+  size_t i;
+  for (i = 0; i < len; i += step) {
+    const size_t n = len - i < step ? len - i : step;
+    if (!mec_mr3_scrub_feed(&ctx, (const char *)input + i, n, &sink))
+      return false;
+  }
+  return mec_mr3_scrub_finish(&ctx);
+}
+
+static void test_sample(const char *filename) {
+  size_t len;
+  char *input = test_read_file(filename, &len);
+  CHECK(input != NULL);
+  if (!input)
+    return;
+  char *output = malloc(len);
+  CHECK(mec_mr3_memcpy(output, input, len) == output);
+  CHECK(test_fnv1a(output, len) == sample_scrubbed);
+
+  struct mec_mr3_membuf out = {0};
+  CHECK(stream(input, len, 7, NULL, &out));
+  CHECK(out.len == len && memcmp(out.data, output, len) == 0);
+  free(out.data);
+
+  CHECK(mec_mr3_scrub_inplace(input, len));
+  CHECK(memcmp(input, output, len) == 0);
+  free(output);
+  free(input);
+}
+
+// ngroups groups of 4 items, the patient name in each of the last 20 ones
+// (a blob holds at most MEC_MR3_MAX_SPANS phi items)
+static void make_groups(struct test_blob *b, int ngroups) {
+  b->len = 0;
+  int g;
+  for (g = 0; g < ngroups; ++g) {
+    test_blob_group(b, g, ngroups, 4);
+    test_blob_filler(b, 0x13ec);
+    if (g >= ngroups - 20)
+      test_blob_item(b, 0x55f2, 0x300, name, sizeof name);
+    else
+      test_blob_filler(b, 0x13ed);
+    test_blob_filler(b, 0x55f8);
+    test_blob_filler(b, 0x55f9);
+  }
+}
+
+static void test_groups(const struct mec_mr3_options *options) {
+  static struct test_blob b;
+  static unsigned char output[sizeof b.data];
+  // past the 16 tables of the policy:
+  make_groups(&b, 18);
+  CHECK(mec_mr3_scrub_ex(output, b.data, b.len, options));
+  CHECK(!contains(output, b.len, "TANAKA"));
+  CHECK(mec_mr3_needs_scrub(output, b.len, options) == 0);
+  struct mec_mr3_membuf out = {0};
+  CHECK(stream(b.data, b.len, 5, options, &out));
+  CHECK(out.len == b.len && memcmp(out.data, output, b.len) == 0);
+  free(out.data);
+
+  // groups are numbered on 8 bits:
+  make_groups(&b, 255);
+  CHECK(mec_mr3_scrub_ex(output, b.data, b.len, options));
+  CHECK(!contains(output, b.len, "TANAKA"));
+  make_groups(&b, 256);
+  CHECK(!mec_mr3_scrub_ex(output, b.data, b.len, options));
+  CHECK(mec_mr3_needs_scrub(b.data, b.len, options) == -1);
+  out = (struct mec_mr3_membuf){0};
+  CHECK(!stream(b.data, b.len, 64, options, &out));
+  free(out.data);
+}
+
+static void test_policy(void) {
+  static const char text[] = "# group key action\n"
+                             "* 55f2 blank\n"
+                             "1 55f2 keep\n";
+  struct mec_mr3_policy *policy =
+      mec_mr3_policy_parse(text, sizeof text - 1);
+  CHECK(policy != NULL);
+  if (!policy)
+    return;
+  CHECK(mec_mr3_policy_action(policy, 1, 0x55f2) == MEC_MR3_KEEP);
+  CHECK(mec_mr3_policy_action(policy, 2, 0x55f2) == MEC_MR3_BLANK);
+  CHECK(mec_mr3_policy_action(policy, 16, 0x55f2) == MEC_MR3_BLANK);
+  CHECK(mec_mr3_policy_action(policy, 255, 0x55f2) == MEC_MR3_BLANK);
+  CHECK(mec_mr3_policy_action(policy, 255, 0x55f3) == MEC_MR3_KEEP);
+  const struct mec_mr3_policy *def = mec_mr3_policy_default();
+  CHECK(mec_mr3_policy_action(def, 17, 0x55f2) == MEC_MR3_BLANK);
+  CHECK(mec_mr3_policy_action(def, 200, 0x6d83) == MEC_MR3_BLANK);
+
+  // group numbers past the tables can not be named:
+  static const char bad[] = "16 55f2 blank\n";
+  CHECK(mec_mr3_policy_parse(bad, sizeof bad - 1) == NULL);
+
+  mec_mr3_policy_free(policy);
+
+  // comments of any length, on their own line or after a rule:
+  char text2[512], *p = text2;
+  memset(p, '#', 200);
+  p += 200;
+  p += sprintf(p, "\n  1 55f3 blank  # ");
+  memset(p, '-', 200);
+  p += 200;
+  *p++ = '\n';
+  policy = mec_mr3_policy_parse(text2, (size_t)(p - text2));
+  CHECK(policy != NULL);
+  CHECK(policy && mec_mr3_policy_action(policy, 1, 0x55f3) == MEC_MR3_BLANK);
+  mec_mr3_policy_free(policy);
+  // but a rule still has to fit in a line of 127 bytes:
+  p = text2 + sprintf(text2, "1 55f3 blank");
+  memset(p, '+', 200);
+  p += 200;
+  CHECK(mec_mr3_policy_parse(text2, (size_t)(p - text2)) == NULL);
+
+  static const char wildcard[] = "* 55f2 remove\n";
+  policy = mec_mr3_policy_parse(wildcard, sizeof wildcard - 1);
+  CHECK(policy != NULL);
+  struct mec_mr3_options options = {0};
+  options.policy = policy;
+  test_groups(&options);
+  mec_mr3_policy_free(policy);
+}
+
+// a name to blank, then 3 uids to remap
+static void make_uids(struct test_blob *b) {
+  static const char *const uids[] = {"1.2.392.200036.9116.2.1",
+                                     "1.2.392.200036.9116.2.2",
+                                     "1.2.392.200036.9116.2.3"};
+  unsigned char b136[136];
+  b->len = 0;
+  test_blob_group(b, 0, 1, 4);
+  test_blob_item(b, 0x0003, 0x300, name, sizeof name);
+  memset(b136, 0, sizeof b136);
+  strcpy((char *)b136 + 4, uids[0]);
+  strcpy((char *)b136 + 4 + 65, uids[1]);
+  test_blob_item(b, 0x0001, 0x1f4100, b136, sizeof b136);
+  memset(b136, 0, sizeof b136);
+  strcpy((char *)b136 + 4, uids[2]);
+  test_blob_item(b, 0x0002, 0x1f4100, b136, sizeof b136);
+  test_blob_filler(b, 0x0004);
+}
+
+static void test_remap(void) {
+  static const char text[] = "1 0001 remap\n"
+                             "1 0002 remap\n"
+                             "1 0003 blank\n";
+  struct mec_mr3_policy *policy =
+      mec_mr3_policy_parse(text, sizeof text - 1);
+  CHECK(policy != NULL);
+  if (!policy)
+    return;
+  static struct test_blob b, copy;
+  make_uids(&b);
+  copy = b;
+  struct mec_mr3_options options = {0};
+  options.policy = policy;
+  // room for 2 uids only, the blob is left untouched:
+  options.uid_map = mec_mr3_uid_map_open(NULL, 1);
+  CHECK(options.uid_map != NULL);
+  CHECK(!mec_mr3_scrub_ex(b.data, b.data, b.len, &options));
+  CHECK(memcmp(b.data, copy.data, b.len) == 0);
+  mec_mr3_uid_map_close(options.uid_map);
+
+  options.uid_map = mec_mr3_uid_map_open(NULL, 3);
+  CHECK(mec_mr3_scrub_ex(b.data, b.data, b.len, &options));
+  CHECK(mec_mr3_uid_map_size(options.uid_map) == 3);
+  CHECK(!contains(b.data, b.len, "TANAKA"));
+  CHECK(!contains(b.data, b.len, "1.2.392."));
+  // the same replacements a second time:
+  static unsigned char output[sizeof b.data];
+  CHECK(mec_mr3_scrub_ex(output, copy.data, copy.len, &options));
+  CHECK(memcmp(output, b.data, b.len) == 0);
+  mec_mr3_uid_map_close(options.uid_map);
+  mec_mr3_policy_free(policy);
+}
+
+int main(int argc, char *argv[]) {
+  if (argc != 2) {
+    fprintf(stderr, "usage: %s sample.raw\n", argv[0]);
+    return 1;
+  }
+  test_sample(argv[1]);
+  test_groups(NULL);
+  test_policy();
+  test_remap();
+  return test_result(argv[0]);
+}
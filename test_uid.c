@@ -0,0 +1,212 @@
+#include "mec_mr3_uid.h"
+#include "test_util.h"
+
+#include <unistd.h>
+
+enum { NUIDS = 50000 };
+
+static char replacements[NUIDS][MEC_MR3_UID_MIN_LEN];
+
+static int compare(const void *a, const void *b) {
+  return memcmp(a, b, MEC_MR3_UID_MIN_LEN);
+}
+
+static void make_uid(unsigned i, char *uid) {
+  snprintf(uid, MEC_MR3_UID_MIN_LEN + 1, "1.2.392.%08u", i);
+}
+
+// "2.25." then a uuid, below 2^128 and without leading zero, then maybe a
+// second component
+static bool is_replacement(const char *uid, size_t len) {
+  static const char max[] = "340282366920938463463374607431768211456"; // 2^128
+  if (len < 6 || memcmp(uid, "2.25.", 5) != 0)
+    return false;
+  const char *p = uid + 5;
+  const char *end = uid + len;
+  int component;
+  for (component = 0; component < 2 && p != end; ++component) {
+    const char *start = p;
+    while (p != end && *p >= '0' && *p <= '9')
+      ++p;
+    const size_t n = (size_t)(p - start);
+    if (n == 0 || (n > 1 && *start == '0'))
+      return false;
+    if (component == 0 &&
+        (n > sizeof max - 1 ||
+         (n == sizeof max - 1 && memcmp(start, max, n) >= 0)))
+      return false;
+    if (p != end && *p++ != '.')
+      return false;
+    if (p == end && p[-1] == '.')
+      return false;
+  }
+  return p == end;
+}
+
+static void test_unique(void) {
+  struct mec_mr3_uid_map *map = mec_mr3_uid_map_open(NULL, NUIDS);
+  CHECK(map != NULL);
+  if (!map)
+    return;
+  char uid[MEC_MR3_UID_MIN_LEN + 1];
+  unsigned i;
+  bool good = true;
+  for (i = 0; i < NUIDS; ++i) {
+    make_uid(i, uid);
+    good = good &&
+           mec_mr3_uid_map_get(map, uid, MEC_MR3_UID_MIN_LEN, replacements[i]);
+    good = good && is_replacement(replacements[i], MEC_MR3_UID_MIN_LEN);
+  }
+  CHECK(good);
+  CHECK(mec_mr3_uid_map_size(map) == NUIDS);
+  // the same uid twice:
+  make_uid(7, uid);
+  char out[MEC_MR3_UID_MIN_LEN];
+  CHECK(mec_mr3_uid_map_get(map, uid, MEC_MR3_UID_MIN_LEN, out));
+  CHECK(memcmp(out, replacements[7], sizeof out) == 0);
+  CHECK(mec_mr3_uid_map_size(map) == NUIDS);
+
+  qsort(replacements, NUIDS, sizeof *replacements, compare);
+  for (i = 1; i < NUIDS; ++i) {
+    if (compare(replacements[i - 1], replacements[i]) == 0)
+      break;
+  }
+  CHECK(i == NUIDS);
+  mec_mr3_uid_map_close(map);
+}
+
+static void test_short(void) {
+  struct mec_mr3_uid_map *map = mec_mr3_uid_map_open(NULL, 1); // 2 slots
+  CHECK(map != NULL);
+  if (!map)
+    return;
+  static const char uid[] = "1.2.392.200036.9116";
+  char out[sizeof uid];
+  CHECK(!mec_mr3_uid_map_get(map, uid, 5, out));
+  CHECK(!mec_mr3_uid_map_get(map, uid, MEC_MR3_UID_MIN_LEN - 1, out));
+  CHECK(mec_mr3_uid_map_get(map, uid, MEC_MR3_UID_MIN_LEN, out));
+  CHECK(mec_mr3_uid_map_get(map, uid, sizeof uid - 1, out));
+  CHECK(is_replacement(out, sizeof uid - 1));
+  CHECK(mec_mr3_uid_map_size(map) == 2);
+  // full:
+  CHECK(!mec_mr3_uid_map_get(map, uid, MEC_MR3_UID_MIN_LEN + 1, out));
+  mec_mr3_uid_map_close(map);
+}
+
+// capacity 3 gives 8 slots, the map fails at the 9th uid
+static void test_full(void) {
+  struct mec_mr3_uid_map *map = mec_mr3_uid_map_open(NULL, 3);
+  CHECK(map != NULL);
+  if (!map)
+    return;
+  char uid[MEC_MR3_UID_MIN_LEN + 1], out[MEC_MR3_UID_MIN_LEN];
+  unsigned i;
+  bool good = true;
+  for (i = 0; i < 8; ++i) {
+    make_uid(i, uid);
+    good = good && mec_mr3_uid_map_get(map, uid, MEC_MR3_UID_MIN_LEN, out);
+  }
+  CHECK(good);
+  make_uid(8, uid);
+  CHECK(!mec_mr3_uid_map_get(map, uid, MEC_MR3_UID_MIN_LEN, out));
+  // known uids are still found:
+  make_uid(0, uid);
+  CHECK(mec_mr3_uid_map_get(map, uid, MEC_MR3_UID_MIN_LEN, out));
+  mec_mr3_uid_map_close(map);
+}
+
+// valid uids of every length
+static void test_lengths(void) {
+  struct mec_mr3_uid_map *map = mec_mr3_uid_map_open(NULL, 64);
+  CHECK(map != NULL);
+  if (!map)
+    return;
+  char uid[64 + 1];
+  memset(uid, '1', sizeof uid - 1);
+  memcpy(uid, "1.2.392.", 8);
+  size_t len;
+  bool good = true;
+  for (len = MEC_MR3_UID_MIN_LEN; len <= 64; ++len) {
+    char out[64];
+    good = good && mec_mr3_uid_map_get(map, uid, len, out) &&
+           is_replacement(out, len);
+  }
+  CHECK(good);
+  mec_mr3_uid_map_close(map);
+}
+
+// replacements survive in the file
+static void test_file(void) {
+  char filename[] = "/tmp/test_uid.XXXXXX";
+  const int fd = mkstemp(filename);
+  CHECK(fd >= 0);
+  if (fd < 0)
+    return;
+  close(fd); // empty, the map is created in it
+  static const char uid[] = "1.2.392.200036.9116.2.5";
+  char out[sizeof uid], again[sizeof uid];
+  struct mec_mr3_uid_map *map = mec_mr3_uid_map_open(filename, 64);
+  CHECK(map != NULL);
+  CHECK(map && mec_mr3_uid_map_get(map, uid, sizeof uid - 1, out));
+  mec_mr3_uid_map_close(map);
+  map = mec_mr3_uid_map_open(filename, 0);
+  CHECK(map != NULL);
+  CHECK(map && mec_mr3_uid_map_size(map) == 1);
+  CHECK(map && mec_mr3_uid_map_get(map, uid, sizeof uid - 1, again));
+  CHECK(memcmp(out, again, sizeof uid - 1) == 0);
+  mec_mr3_uid_map_close(map);
+  unlink(filename);
+}
+
+// a writer killed between taking a slot and publishing it: the next process
+// opening the file alone gives the slot back. Pokes at the file layout: a
+// header of 64 bytes, inserting at 40, then slots of 144 bytes, state first
+static void test_crash(void) {
+  char filename[] = "/tmp/test_uid.XXXXXX";
+  const int fd = mkstemp(filename);
+  CHECK(fd >= 0);
+  if (fd < 0)
+    return;
+  static const char uid[] = "1.2.392.200036.9116.2.5";
+  static const char other[] = "1.2.392.200036.9116.2.6";
+  char out[sizeof uid], again[sizeof uid];
+  struct mec_mr3_uid_map *map = mec_mr3_uid_map_open(filename, 4); // 8 slots
+  CHECK(map && mec_mr3_uid_map_get(map, uid, sizeof uid - 1, out));
+  mec_mr3_uid_map_close(map);
+  unsigned i;
+  for (i = 0; i < 8; ++i) {
+    uint32_t state;
+    CHECK(pread(fd, &state, 4, 64 + 144 * i) == 4);
+    if (state == 0) {
+      state = 1; // busy
+      CHECK(pwrite(fd, &state, 4, 64 + 144 * i) == 4);
+    }
+  }
+  const uint64_t inserting = 7;
+  CHECK(pwrite(fd, &inserting, 8, 40) == 8);
+  close(fd);
+
+  // dry runs recover their private copy only:
+  map = mec_mr3_uid_map_open_private(filename);
+  CHECK(map && mec_mr3_uid_map_get(map, other, sizeof other - 1, again));
+  mec_mr3_uid_map_close(map);
+  map = mec_mr3_uid_map_open(filename, 0);
+  CHECK(map != NULL);
+  CHECK(map && mec_mr3_uid_map_get(map, uid, sizeof uid - 1, again));
+  CHECK(memcmp(out, again, sizeof uid - 1) == 0);
+  CHECK(map && mec_mr3_uid_map_get(map, other, sizeof other - 1, again));
+  CHECK(map && mec_mr3_uid_map_size(map) == 2);
+  mec_mr3_uid_map_close(map);
+  unlink(filename);
+}
+
+int main(int argc, char *argv[]) {
+  (void)argc;
+  test_unique();
+  test_short();
+  test_full();
+  test_lengths();
+  test_file();
+  test_crash();
+  return test_result(argv[0]);
+}
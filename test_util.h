@@ -0,0 +1,98 @@
+#pragma once
+
+// helpers shared by the test programs
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+static int failures;
+
+#define CHECK(x)                                                               \
+  do {                                                                         \
+    if (!(x)) {                                                                \
+      fprintf(stderr, "%s:%d: CHECK(%s) failed\n", __FILE__, __LINE__, #x);   \
+      ++failures;                                                              \
+    }                                                                          \
+  } while (0)
+
+static inline void *test_read_file(const char *filename, size_t *len) {
+  FILE *f = fopen(filename, "rb");
+  if (!f)
+    return NULL;
+  char *buf = NULL;
+  long size = -1;
+  if (fseek(f, 0, SEEK_END) == 0)
+    size = ftell(f);
+  if (size > 0 && fseek(f, 0, SEEK_SET) == 0) {
+    buf = malloc((size_t)size);
+    if (buf && fread(buf, 1, (size_t)size, f) != (size_t)size) {
+      free(buf);
+      buf = NULL;
+    }
+  }
+  fclose(f);
+  *len = (size_t)size;
+  return buf;
+}
+
+static inline uint64_t test_fnv1a(const void *buf, size_t len) {
+  const unsigned char *p = buf;
+  uint64_t h = UINT64_C(0xcbf29ce484222325);
+  size_t i;
+  for (i = 0; i < len; ++i)
+    h = (h ^ p[i]) * UINT64_C(0x100000001b3);
+  return h;
+}
+
+/* synthetic blob, written in the MEC_MR3 layout */
+struct test_blob {
+  unsigned char data[1 << 16];
+  size_t len;
+};
+
+static inline void test_blob_bytes(struct test_blob *b, const void *p,
+                                   size_t n) {
+  if (b->len + n > sizeof b->data) {
+    fprintf(stderr, "test blob too large\n");
+    exit(1);
+  }
+  memcpy(b->data + b->len, p, n);
+  b->len += n;
+}
+
+static inline void test_blob_u32(struct test_blob *b, uint32_t v) {
+  test_blob_bytes(b, &v, sizeof v);
+}
+
+// count of group g out of ngroups, nitems must be above 3
+static inline void test_blob_group(struct test_blob *b, int g, int ngroups,
+                                   uint32_t nitems) {
+  if (g == ngroups - 1)
+    test_blob_u32(b, 1); // the last set of groups is this one
+  test_blob_u32(b, nitems);
+}
+
+static inline void test_blob_item(struct test_blob *b, uint32_t key,
+                                  uint32_t type, const void *payload,
+                                  uint32_t len) {
+  static const unsigned char separator[20] = {[8] = 0xc};
+  test_blob_u32(b, key);
+  test_blob_u32(b, type);
+  test_blob_u32(b, len);
+  test_blob_bytes(b, separator, sizeof separator);
+  test_blob_bytes(b, payload, len);
+}
+
+// a float item, to pad groups
+static inline void test_blob_filler(struct test_blob *b, uint32_t key) {
+  const float f = 1.5f;
+  test_blob_item(b, key, 0xff000800, &f, sizeof f);
+}
+
+static inline int test_result(const char *name) {
+  if (failures)
+    fprintf(stderr, "%s: %d failure(s)\n", name, failures);
+  return failures ? 1 : 0;
+}
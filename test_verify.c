@@ -0,0 +1,102 @@
+#include "mec_mr3.h"
+#include "mec_mr3_policy.h"
+#include "mec_mr3_verify.h"
+#include "test_util.h"
+
+static void test_sample(const char *filename) {
+  size_t len;
+  char *input = test_read_file(filename, &len);
+  CHECK(input != NULL);
+  if (!input)
+    return;
+  struct mec_mr3_verify_report report;
+  CHECK(!mec_mr3_verify_scrubbed(input, len, NULL, &report));
+  CHECK(report.valid && report.failures != 0);
+  CHECK(mec_mr3_scrub_inplace(input, len));
+  CHECK(mec_mr3_verify_scrubbed(input, len, NULL, &report));
+  CHECK(report.valid && report.fields != 0 && report.unverifiable == 0);
+  CHECK(!mec_mr3_verify_scrubbed(input, len - 1, NULL, &report));
+  CHECK(!report.valid);
+  free(input);
+}
+
+// one string item of key 55f2 in group g, out of ngroups
+static void make_blob(struct test_blob *b, int g, int ngroups,
+                      const char *str) {
+  b->len = 0;
+  int i;
+  for (i = 0; i < ngroups; ++i) {
+    test_blob_group(b, i, ngroups, 4);
+    test_blob_filler(b, 0x13ec);
+    if (i == g)
+      test_blob_item(b, 0x55f2, 0x300, str, (uint32_t)strlen(str) + 1);
+    else
+      test_blob_filler(b, 0x13ed);
+    test_blob_filler(b, 0x13ee);
+    test_blob_filler(b, 0x13ef);
+  }
+}
+
+static bool verify(const struct mec_mr3_policy *policy, int g, int ngroups,
+                   const char *str, struct mec_mr3_verify_report *report) {
+  static struct test_blob b;
+  make_blob(&b, g, ngroups, str);
+  struct mec_mr3_options options = {0};
+  options.policy = policy;
+  return mec_mr3_verify_scrubbed(b.data, b.len, &options, report);
+}
+
+static struct mec_mr3_policy *parse(const char *text) {
+  struct mec_mr3_policy *policy = mec_mr3_policy_parse(text, strlen(text));
+  CHECK(policy != NULL);
+  return policy;
+}
+
+static void test_policy(void) {
+  struct mec_mr3_verify_report report;
+  // built-in policy, in any group:
+  CHECK(!verify(NULL, 0, 1, "TANAKA", &report));
+  CHECK(report.failures == 1 && report.key == 0x55f2 && report.group == 1);
+  CHECK(!verify(NULL, 19, 20, "TANAKA", &report));
+  CHECK(report.group == 20);
+  CHECK(verify(NULL, 0, 1, "      ", &report));
+
+  // later rules override earlier ones, '*' reaches every group:
+  struct mec_mr3_policy *policy = parse("* 55f2 blank\n1 55f2 keep\n");
+  CHECK(verify(policy, 0, 2, "TANAKA", &report));
+  CHECK(!verify(policy, 1, 2, "TANAKA", &report));
+  CHECK(!verify(policy, 16, 17, "TANAKA", &report));
+  mec_mr3_policy_free(policy);
+  policy = parse("1 55f2 keep\n* 55f2 remove\n");
+  CHECK(!verify(policy, 0, 1, "TANAKA", &report));
+  mec_mr3_policy_free(policy);
+  // keys in any order, a key only named for another group is kept:
+  policy = parse("* 6d80 blank\n2 55f2 blank\n* 0001 remove\n3 55f2 hash\n");
+  CHECK(verify(policy, 0, 3, "TANAKA", &report));
+  CHECK(!verify(policy, 1, 3, "Tanaka", &report));
+  CHECK(!verify(policy, 2, 3, "Tanaka", &report));
+  CHECK(verify(policy, 2, 3, "TANAKA", &report));
+  mec_mr3_policy_free(policy);
+}
+
+static void test_hash(void) {
+  struct mec_mr3_policy *policy = parse("* 55f2 hash\n");
+  struct mec_mr3_verify_report report;
+  // a name in capitals can not be told from a pseudonym:
+  CHECK(verify(policy, 0, 1, "TANAKA", &report));
+  CHECK(report.fields == 1 && report.unverifiable == 1);
+  CHECK(!verify(policy, 0, 1, "Tanaka", &report));
+  CHECK(report.failures == 1 && report.unverifiable == 0);
+  mec_mr3_policy_free(policy);
+}
+
+int main(int argc, char *argv[]) {
+  if (argc != 2) {
+    fprintf(stderr, "usage: %s sample.raw\n", argv[0]);
+    return 1;
+  }
+  test_sample(argv[1]);
+  test_policy();
+  test_hash();
+  return test_result(argv[0]);
+}
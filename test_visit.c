@@ -0,0 +1,244 @@
+#include "mec_mr3_payload.h"
+#include "mec_mr3_visit.h"
+#include "test_util.h"
+
+#include <stdbool.h>
+
+// what the callbacks saw, in order
+struct seen {
+  char log[1024];
+  size_t calls;
+  size_t stop_at; // the callback of this call returns false, 0 for never
+};
+
+static bool add(struct seen *s, const char *fmt, const char *str, size_t n) {
+  char entry[160];
+  snprintf(entry, sizeof entry, fmt, (int)n, str);
+  strncat(s->log, entry, sizeof s->log - strlen(s->log) - 1);
+  return ++s->calls != s->stop_at;
+}
+
+static bool on_float32_array(const struct mec_mr3_item *item,
+                             const void *values, size_t n, void *user) {
+  char str[64] = "";
+  size_t i;
+  for (i = 0; i < n; ++i) {
+    snprintf(str + strlen(str), sizeof str - strlen(str), "%s%g",
+             i ? "," : "", mec_mr3_float32_at(values, i));
+  }
+  (void)item;
+  return add(user, "f[%.*s] ", str, strlen(str));
+}
+
+static bool on_int32_array(const struct mec_mr3_item *item,
+                           const void *values, size_t n, void *user) {
+  char str[64] = "";
+  size_t i;
+  for (i = 0; i < n; ++i) {
+    snprintf(str + strlen(str), sizeof str - strlen(str), "%s%d",
+             i ? "," : "", (int)mec_mr3_int32_at(values, i));
+  }
+  (void)item;
+  return add(user, "i[%.*s] ", str, strlen(str));
+}
+
+static bool on_float64(const struct mec_mr3_item *item, double value,
+                       void *user) {
+  char str[32];
+  snprintf(str, sizeof str, "%g", value);
+  (void)item;
+  return add(user, "d%.*s ", str, strlen(str));
+}
+
+static bool on_bool(const struct mec_mr3_item *item, bool value,
+                    void *user) {
+  (void)item;
+  return add(user, "b%.*s ", value ? "1" : "0", 1);
+}
+
+static bool on_string(const struct mec_mr3_item *item,
+                      const struct mec_mr3_str *str, void *user) {
+  (void)item;
+  return add(user, "s'%.*s' ", str->ptr, str->len);
+}
+
+static bool on_datetime(const struct mec_mr3_item *item,
+                        const struct mec_mr3_str *str, void *user) {
+  (void)item;
+  return add(user, "t'%.*s' ", str->ptr, str->len);
+}
+
+static bool on_struct136(const struct mec_mr3_item *item,
+                         const struct mec_mr3_struct136 *s, void *user) {
+  (void)item;
+  return add(user, "136'%.*s' ", s->uid2.ptr, s->uid2.len);
+}
+
+static bool on_struct436(const struct mec_mr3_item *item,
+                         const struct mec_mr3_struct436 *s, void *user) {
+  char str[128];
+  snprintf(str, sizeof str, "%.*s,%.*s,%u", (int)s->buf3.len, s->buf3.ptr,
+           (int)s->modality.len, s->modality.ptr, (unsigned)s->val);
+  (void)item;
+  return add(user, "436'%.*s' ", str, strlen(str));
+}
+
+static bool on_struct516(const struct mec_mr3_item *item,
+                         const struct mec_mr3_struct516 *s, void *user) {
+  char str[128];
+  snprintf(str, sizeof str, "%.*s,%u%u%u%u%u%u", (int)s->buf5.len,
+           s->buf5.ptr, (unsigned)s->bools[0], (unsigned)s->bools[1],
+           (unsigned)s->bools[2], (unsigned)s->bools[3],
+           (unsigned)s->bools[4], (unsigned)s->bools[5]);
+  (void)item;
+  return add(user, "516'%.*s' ", str, strlen(str));
+}
+
+static bool on_struct325(const struct mec_mr3_item *item,
+                         const struct mec_mr3_struct325 *s, void *user) {
+  (void)item;
+  return add(user, "325'%.*s' ", s->array[4].ptr, s->array[4].len);
+}
+
+static bool on_other(const struct mec_mr3_item *item, void *user) {
+  char str[16];
+  snprintf(str, sizeof str, "%x", (unsigned)item->type);
+  return add(user, "?%.*s ", str, strlen(str));
+}
+
+static const struct mec_mr3_visitor visitor = {
+    on_float32_array, on_int32_array, on_float64,   on_bool,
+    on_string,        on_datetime,    on_struct136, on_struct436,
+    on_struct516,     on_struct325,   on_other,
+};
+
+// an ISO_8859_1_STRING payload with its header
+static size_t make_iso(unsigned char *payload, const char *str) {
+  const size_t len = strlen(str);
+  struct buffer19 b19 = {{(char)0xdf, (char)0xff, 0x79}, 0, 1, 9, 0, {0},
+                         2, 0, 0};
+  memcpy(b19.iso, "ISO8859-1", 9);
+  b19.len2 = (unsigned char)(sizeof b19 + len - 4);
+  b19.len4 = (unsigned char)len;
+  memcpy(payload, &b19, sizeof b19);
+  memcpy(payload + sizeof b19, str, len);
+  return sizeof b19 + len;
+}
+
+#define EXPECTED                                                               \
+  "f[1.5] f[1,2,3,4] f[] f[1,2,3,4,5,6] i[-1,7] d0.25 b1 b0 s'TANAKA' "     \
+  "s'ISO' s'TARO' t'11/12/2002,11:27:32' 136'1.2.3' 436'YAMADA,MR,42' "     \
+  "516'1.2.4,101001' 325'HANA' ?1200 "
+
+static void make_blob(struct test_blob *b) {
+  static const float floats[] = {1, 2, 3, 4, 5, 6};
+  static const int32_t ints[] = {-1, 7};
+  static const double d = 0.25;
+  static const float f = 1.5f;
+  static const uint32_t yes = 1, no = 0;
+  b->len = 0;
+  test_blob_group(b, 0, 2, 9);
+  test_blob_item(b, 0x0001, FLOAT32_VM1, &f, sizeof f);
+  test_blob_item(b, 0x0002, FLOAT32_VM1N, floats, 4 * sizeof *floats);
+  test_blob_item(b, 0x0003, FLOAT32_VM2N, floats, 0);
+  test_blob_item(b, 0x0004, FLOAT32_VM3N, floats, sizeof floats);
+  test_blob_item(b, 0x0005, INT32_VM1N, ints, sizeof ints);
+  test_blob_item(b, 0x0006, FLOAT64_VM1, &d, sizeof d);
+  test_blob_item(b, 0x0007, BOOL_04, &yes, sizeof yes);
+  test_blob_item(b, 0x0008, BOOL_2A, &no, sizeof no);
+  test_blob_item(b, 0x0009, SHIFT_JIS_STRING, "TANAKA\0JUNK", 11);
+
+  test_blob_group(b, 1, 2, 8);
+  test_blob_item(b, 0x000a, ISO_8859_1_STRING, "ISO", 3);
+  unsigned char iso[64];
+  test_blob_item(b, 0x000b, ISO_8859_1_STRING, iso, make_iso(iso, "TARO"));
+  test_blob_item(b, 0x000c, DATETIME, "11/12/2002,11:27:32", 19);
+  struct buffer136 b136;
+  memset(&b136, 0, sizeof b136);
+  strcpy(b136.uid2, "1.2.3");
+  test_blob_item(b, 0x000d, STRUCT_136, &b136, sizeof b136);
+  struct buffer436 b436;
+  memset(&b436, 0, sizeof b436);
+  strcpy(b436.buf3, "YAMADA");
+  strcpy(b436.modality, "MR");
+  b436.val = 42;
+  test_blob_item(b, 0x000e, STRUCT_436, &b436, sizeof b436);
+  struct buffer516 b516;
+  memset(&b516, 0, sizeof b516);
+  strcpy(b516.buf5, "1.2.4");
+  b516.bools[0] = b516.bools[2] = b516.bools[5] = 1;
+  test_blob_item(b, 0x000f, STRUCT_516, &b516, sizeof b516);
+  struct buffer325 b325;
+  memset(&b325, 0, sizeof b325);
+  strcpy(b325.array[4], "HANA");
+  test_blob_item(b, 0x0010, STRUCT_325, &b325, sizeof b325);
+  test_blob_item(b, 0x0011, 0x1200, "x", 1);
+}
+
+static void test_visit(void) {
+  static struct test_blob b;
+  make_blob(&b);
+  struct seen s = {"", 0, 0};
+  CHECK(mec_mr3_visit(b.data, b.len, &visitor, &s));
+  CHECK(strcmp(s.log, EXPECTED) == 0);
+  CHECK(s.calls == 17);
+
+  // a callback returning false stops the visit:
+  struct seen stop = {"", 0, 3};
+  CHECK(!mec_mr3_visit(b.data, b.len, &visitor, &stop));
+  CHECK(strcmp(stop.log, "f[1.5] f[1,2,3,4] f[] ") == 0);
+
+  // no callbacks, still valid:
+  static const struct mec_mr3_visitor none;
+  CHECK(mec_mr3_visit(b.data, b.len, &none, NULL));
+  // invalid layout:
+  CHECK(!mec_mr3_visit(b.data, b.len - 1, &visitor, &s));
+}
+
+// payloads are checked whether or not there is a callback for them
+static bool valid(uint32_t type, const void *payload, uint32_t len) {
+  static struct test_blob b;
+  b.len = 0;
+  test_blob_group(&b, 0, 1, 4);
+  test_blob_filler(&b, 0x13ec);
+  test_blob_item(&b, 0x0001, type, payload, len);
+  test_blob_filler(&b, 0x13ee);
+  test_blob_filler(&b, 0x13ef);
+  static const struct mec_mr3_visitor none;
+  const bool good = mec_mr3_visit(b.data, b.len, &none, NULL);
+  struct seen s = {"", 0, 0};
+  CHECK(good == mec_mr3_visit(b.data, b.len, &visitor, &s));
+  return good;
+}
+
+static void test_invalid(void) {
+  static const unsigned char zeros[520];
+  static const uint32_t two = 2;
+  CHECK(valid(FLOAT32_VM1, zeros, 4));
+  CHECK(!valid(FLOAT32_VM1, zeros, 0));
+  CHECK(!valid(FLOAT32_VM1, zeros, 8));
+  CHECK(!valid(FLOAT32_VM1N, zeros, 6));
+  CHECK(valid(FLOAT32_VM2N, zeros, 16));
+  CHECK(!valid(FLOAT32_VM2N, zeros, 12));
+  CHECK(valid(FLOAT32_VM3N, zeros, 24));
+  CHECK(!valid(FLOAT32_VM3N, zeros, 16));
+  CHECK(!valid(INT32_VM1N, zeros, 7));
+  CHECK(!valid(FLOAT64_VM1, zeros, 4));
+  CHECK(!valid(BOOL_04, &two, sizeof two));
+  CHECK(!valid(BOOL_2A, zeros, 2));
+  CHECK(!valid(DATETIME, "31/04/2002,11:27:32", 19));
+  CHECK(!valid(STRUCT_136, zeros, 135));
+  CHECK(!valid(STRUCT_436, zeros, 437));
+  CHECK(!valid(STRUCT_516, zeros, 512));
+  CHECK(!valid(STRUCT_325, zeros, 324));
+  // the magic of an ISO8859-1 header, but no header:
+  static const unsigned char magic[] = {0xdf, 0xff, 0x79, 'A', 'B'};
+  CHECK(!valid(ISO_8859_1_STRING, magic, sizeof magic));
+}
+
+int main(int argc, char *argv[]) {
+  (void)argc;
+  test_visit();
+  test_invalid();
+  return test_result(argv[0]);
+}